@@ -0,0 +1,5 @@
+/*
+* bench.h
+*/ 
+
+int benchSuiteEmuEeprom(void);
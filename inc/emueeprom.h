@@ -1,36 +1,205 @@
-/*
-* emueeprom.h
-*/
-
-#ifndef EMU_EEPROM_H
-#define EMU_EEPROM_H
-
-#include <unistd.h>
-
-#include <flash.h>
-
-#define BLOCK_START_ADDR 0x00000000
-
-#define VADDR_SIZE 2u // bytes
-#define SIZE_SIZE 2u // bytes
-#define INFO_SIZE (VADDR_SIZE + SIZE_SIZE)
-#define CRC_SIZE 2u // bytes
-#define MIN_ENTRY_SIZE (INFO_SIZE + 1u)
-#define MAX_DATA_PER_PAGE (PAGE_SIZE - INFO_SIZE - CRC_SIZE)
-
-typedef struct {
-    uint8_t pageBuffer[PAGE_SIZE];
-    uint16_t bufferPos;
-    uint16_t currPage;
-    uint8_t currBlock;
-} emueeprom_info_t;
-
-void emuEepromInit(void);
-void emuEepromDestroy(void);
-void emuEepromInfo(emueeprom_info_t *pInfo);
-ssize_t emuEepromWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen);
-ssize_t emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen);
-ssize_t emuEepromErase(uint16_t vAddr,  uint16_t dataLen);
-ssize_t emuEepromFlush(void);
-
+/*
+* emueeprom.h
+*/
+
+#ifndef EMU_EEPROM_H
+#define EMU_EEPROM_H
+
+#include <unistd.h>
+
+#include <flash.h>
+
+#define BLOCK_START_ADDR 0x00000000
+#define BLOCK_COUNT 4u // blocks used by the emulated EEPROM, at least 2
+#define MAX_VIRTUAL_ADDR (BLOCK_SIZE / 2) // < BLOCK_SIZE
+
+#ifndef EMUEEPROM_NO_METRICS
+    #define EMUEEPROM_METRICS // latency histograms and trace hooks, see emuEepromLatency()
+#endif
+
+#define VADDR_SIZE 2u // bytes
+#define SIZE_SIZE 2u // bytes
+#define INFO_SIZE (VADDR_SIZE + SIZE_SIZE)
+#define CRC_SIZE 2u // bytes
+#define MIN_ENTRY_SIZE (INFO_SIZE + 1u)
+#define MAX_DATA_PER_PAGE (PAGE_SIZE - INFO_SIZE - CRC_SIZE)
+#define TX_BUFFER_SIZE 256u // bytes of records a transaction can hold
+#define ASYNC_QUEUE_DEPTH 64u // writes queued before emuEepromWriteAsync waits
+#define PAGE_BUFFER_COUNT 8u // most flushed pages the ring can hold before programming them together
+#define MIRROR_MAX_LAG 64u // pages the mirror can trail the flash by
+#define CURSOR_STALE (-2) // emuEepromChangesSince: the block the cursor points into was reclaimed
+
+typedef struct {
+    uint8_t pageBuffer[PAGE_SIZE];
+    uint16_t bufferPos;
+    uint16_t currPage;
+    uint8_t currBlock;
+} emueeprom_info_t;
+
+typedef struct {
+    uint32_t eraseCount[BLOCK_COUNT]; // erase count of each block
+    uint32_t minCount;
+    uint32_t maxCount;
+} emueeprom_wear_t;
+
+typedef struct {
+    uint32_t cacheBytes; // RAM held by the block cache
+    uint32_t cacheHits; // reads served from RAM
+    uint32_t cacheMisses; // reads that went to flash
+    uint64_t flashBytesRead;
+    uint64_t flashBytesSaved; // bytes served from RAM instead of flash
+    uint32_t summaryBytes; // RAM held by the page summaries
+    uint32_t pagesVisited; // pages parsed by lookups
+    uint32_t pagesSkipped; // pages a lookup ruled out by their summary
+    uint64_t userBytes; // bytes written and erased by the application
+    uint64_t copyBytes; // bytes copied by transfers, demotions and cold compactions
+    uint32_t pagesProgrammed; // flushed pages of the current block
+    uint32_t programCalls; // flash writes that programmed them
+    uint32_t viewsInPlace; // views pointing into flash
+    uint32_t viewsCopied; // views that had to copy
+    uint32_t inlineErases; // blocks erased in the middle of a transfer or import
+    uint32_t idleErases; // reclaimed blocks erased ahead by emuEepromIdle or the async worker
+    uint32_t transfers; // block transfers completed
+    uint32_t transferPages; // pages of old blocks scanned by transfers
+    uint32_t transferEntries; // entries written by transfers, one per streak copied
+    uint32_t shareRetries; // shared reads started over because the writer published meanwhile
+    uint32_t mirrorPages; // pages copied to the mirror as they were programmed
+    uint32_t mirrorResyncPages; // divergent pages copied to the mirror when it was brought up to date
+    uint32_t scrubPages; // pages and headers verified by the scrubber
+    uint32_t scrubPasses; // passes over every block completed
+    uint32_t scrubCorrupt; // pages and headers found with a bad CRC, once per pass
+    uint32_t scrubRelocations; // blocks whose live data was moved after a corrupt page
+    uint32_t updates; // writes made through a compare, by emuEepromUpdate, emuEepromCas and emuEepromAdd
+    uint64_t updateBytesSaved; // entry bytes they did not log compared with a whole write
+    uint32_t casFailed; // emuEepromCas calls that found another value
+    uint32_t syncs; // fdatasyncs made for the durability mode
+    uint32_t windowSyncs; // group commits closed by emuEepromIdle once their window ran out
+} emueeprom_stats_t;
+
+typedef struct {
+    uint8_t const *pData; // valid until emuEepromReleaseView
+    uint16_t len; // bytes read
+    uint8_t block; // block the view points into, BLOCK_COUNT if pData is a copy
+} emueeprom_view_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t len;
+    void *pBuffer; // len bytes
+    uint8_t *pValid; // (len + 7) / 8 bytes, bit set for each byte holding data, can be NULL
+} emueeprom_req_t;
+
+typedef void (*emueeprom_callback_t)(ssize_t result, void *pContext);
+
+typedef struct {
+    uint32_t eraseCount; // of the block the cursor points into, tells a reused block apart
+    uint16_t transferCount; // of the block the cursor points into
+    uint16_t page;
+    uint16_t offset; // in the page, where the next entry starts
+} emueeprom_cursor_t;
+
+// len is 0 for an erased address, return non-zero to stop
+typedef int (*emueeprom_change_t)(uint16_t vAddr, uint16_t len, void const *pData, void *pContext);
+
+// page 0 is the block header
+typedef void (*emueeprom_corrupt_t)(uint8_t block, uint16_t page, void *pContext);
+
+#ifdef EMUEEPROM_METRICS
+#define LATENCY_BUCKETS 32u
+
+typedef enum {
+    op_write = 0,
+    op_read,
+    op_erase,
+    op_flush,
+    op_update,
+    op_cas,
+    op_add,
+    op_tx_begin,
+    op_tx_commit,
+    op_tx_abort,
+    op_write_async,
+    op_sync,
+    op_read_range,
+    op_read_all,
+    op_read_multi,
+    op_read_view,
+    op_import,
+    op_transfer,
+    op_total
+} emueeprom_op_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint32_t buckets[LATENCY_BUCKETS]; // bucket i counts calls under 2^(i + 1) ns, the last one the rest
+} emueeprom_latency_t;
+
+// end is 0 when the call starts and 1 when it returns, result is only set at the end, pData is the data of writes,
+// updates and async writes, the two pointers to the expected and desired value of op_cas, the int32_t delta of
+// op_add, the request array and a pointer to its size_t count for op_read_multi, and the image and validity
+// bitmap for op_import
+typedef void (*emueeprom_trace_t)(emueeprom_op_t op, int end, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result, void *pContext);
+#endif
+
+typedef enum {
+    durable_none = 0, // flushed pages are left to the OS
+    durable_flush, // fdatasync on every flush and commit
+    durable_group, // one fdatasync per window of flushes and commits
+    durable_dsync // flash file opened with O_DSYNC, every page program is durable
+} emueeprom_durability_t;
+
+void emuEepromInit(void);
+void emuEepromDestroy(void);
+void emuEepromInfo(emueeprom_info_t *pInfo);
+ssize_t emuEepromWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen);
+ssize_t emuEepromUpdate(uint16_t vAddr, void const *pBuffer, uint16_t buffLen);
+ssize_t emuEepromCas(uint16_t vAddr, void const *pExpected, void const *pDesired, uint16_t len);
+ssize_t emuEepromAdd(uint16_t vAddr, int32_t delta, uint32_t *pValue);
+ssize_t emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen);
+ssize_t emuEepromReadRange(uint16_t vAddr, void *pBuffer, uint16_t buffLen, uint8_t *pValid);
+ssize_t emuEepromReadAll(void *pBuffer, uint8_t *pValid);
+ssize_t emuEepromReadView(uint16_t vAddr, uint16_t buffLen, emueeprom_view_t *pView);
+void emuEepromReleaseView(emueeprom_view_t *pView);
+ssize_t emuEepromReadMulti(emueeprom_req_t const *pReqs, size_t numReqs);
+ssize_t emuEepromImport(void const *pImage, uint8_t const *pValid);
+ssize_t emuEepromHotCold(uint8_t hotGenerations);
+ssize_t emuEepromErase(uint16_t vAddr,  uint16_t dataLen);
+ssize_t emuEepromFlush(void);
+void emuEepromWear(emueeprom_wear_t *pWear);
+ssize_t emuEepromTxBegin(void);
+ssize_t emuEepromTxCommit(void);
+void emuEepromTxAbort(void);
+ssize_t emuEepromAsyncStart(void);
+void emuEepromAsyncStop(void);
+ssize_t emuEepromWriteAsync(uint16_t vAddr, void const *pBuffer, uint16_t buffLen, emueeprom_callback_t callback, void *pContext);
+void emuEepromWait(uint32_t ticket);
+ssize_t emuEepromSync(void);
+ssize_t emuEepromDurability(emueeprom_durability_t mode, uint32_t windowUs, uint16_t windowFlushes);
+uint32_t emuEepromCache(uint32_t budget);
+ssize_t emuEepromPageBuffers(uint16_t count);
+void emuEepromEraseAhead(int enable);
+ssize_t emuEepromIdle(void);
+void emuEepromCursor(emueeprom_cursor_t *pCursor);
+ssize_t emuEepromChangesSince(emueeprom_cursor_t *pCursor, emueeprom_change_t change, void *pContext);
+ssize_t emuEepromMirror(int enable, uint16_t lag);
+void emuEepromScrub(uint32_t pagesPerSec, int relocate, emueeprom_corrupt_t corrupt, void *pContext);
+ssize_t emuEepromScrubStart(void);
+void emuEepromScrubStop(void);
+ssize_t emuEepromShareWriter(int wait);
+ssize_t emuEepromShareRelease(void);
+ssize_t emuEepromShareAttach(void);
+ssize_t emuEepromShareRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen);
+uint32_t emuEepromShareGeneration(void);
+void emuEepromStats(emueeprom_stats_t *pStats);
+void emuEepromStatsReset(void);
+#ifdef EMUEEPROM_METRICS
+void emuEepromLatency(emueeprom_op_t op, emueeprom_latency_t *pLatency);
+uint64_t emuEepromLatencyQuantile(emueeprom_latency_t const *pLatency, uint16_t perMille);
+void emuEepromLatencyReset(void);
+void emuEepromLatencyDump(void);
+void emuEepromTrace(emueeprom_trace_t trace, void *pContext);
+#endif
+
 #endif  // EMU_EEPROM_H
\ No newline at end of file
@@ -1,18 +1,31 @@
-/*
-* flash.h
-*/
-
-#ifndef FLASH_H
-#define FLASH_H
-
-#include <unistd.h>
-
-#include "flash_config.h"
-
-int flashInit(void);
-ssize_t flashWrite(off_t offset, void const *pBuff, size_t numBytes);
-ssize_t flashRead(off_t offset, void *pBuff, size_t numBytes);
-void flashBlockErase(int blockNum, int blockCount);
-void flashDump(uint32_t address, uint32_t bytes);
-
+/*
+* flash.h
+*/
+
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <unistd.h>
+
+#include "flash_config.h"
+
+int flashInit(void);
+ssize_t flashWrite(off_t offset, void const *pBuff, size_t numBytes);
+ssize_t flashRead(off_t offset, void *pBuff, size_t numBytes);
+void const *flashMap(off_t offset, size_t numBytes);
+void *flashShared(size_t numBytes);
+ssize_t flashLock(int wait);
+void flashUnlock(void);
+void flashBlockErase(int blockNum, int blockCount);
+ssize_t flashWriteSync(off_t offset, void const *pBuff, size_t numBytes);
+ssize_t flashSync(void);
+uint32_t flashSetQueueDepth(uint32_t depth);
+ssize_t flashSetSyncWrites(int enable);
+int flashMirrorInit(void);
+ssize_t flashMirrorWrite(off_t offset, void const *pBuff, size_t numBytes);
+ssize_t flashMirrorRead(off_t offset, void *pBuff, size_t numBytes);
+void flashMirrorErase(int blockNum, int blockCount);
+void flashClose(void);
+void flashDump(uint32_t address, uint32_t bytes);
+
 #endif // FLASH_H
\ No newline at end of file
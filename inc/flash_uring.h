@@ -0,0 +1,18 @@
+/*
+* flash_uring.h
+*/
+
+#ifndef FLASH_URING_H
+#define FLASH_URING_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+int uringInit(int fd, uint32_t depth);
+void uringExit(void);
+ssize_t uringWrite(off_t offset, void const *pBuff, size_t numBytes, int durable);
+ssize_t uringFill(off_t offset, size_t numBytes);
+ssize_t uringSync(void);
+ssize_t uringWaitRange(off_t offset, size_t numBytes);
+
+#endif // FLASH_URING_H
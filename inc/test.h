@@ -1,5 +1,5 @@
-/*
-* test.h
-*/ 
-
+/*
+* test.h
+*/ 
+
 int testSuiteEmuEeprom(void);
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+* trace.h
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <emueeprom.h>
+
+#define TRACE_MAGIC 0x52544D45 // "EMTR"
+#define TRACE_VERSION 3u
+#define TRACE_SPAN_VALID 0x8000 // set in the len of a span whose request has a bitmap
+#define TRACE_VALID_SIZE (MAX_VIRTUAL_ADDR / 8u) // validity bitmap bytes after an op_import record
+
+#ifdef EMUEEPROM_METRICS
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+} trace_header_t;
+
+typedef struct {
+    uint32_t deltaUs; // time since the previous call started
+    uint32_t hash; // FNV-1a of the data written or imported, the delta of an add, the requests of a multi read, 0 for other calls
+    uint32_t expectHash; // FNV-1a of the value a compare-and-swap expects, 0 for other calls
+    uint16_t vAddr;
+    uint16_t len;
+    uint8_t op; // emueeprom_op_t
+    uint8_t reserved[3];
+} trace_record_t;
+
+// one per request after an op_read_multi record
+typedef struct {
+    uint16_t vAddr;
+    uint16_t len;
+} trace_span_t;
+
+typedef struct {
+    uint32_t calls[op_total]; // calls replayed, transfers are the ones they caused
+    uint32_t errors; // calls that returned an error
+    uint64_t elapsedUs;
+    uint64_t userBytes;
+    uint64_t copyBytes;
+    uint64_t flashBytes; // page bytes programmed in the log
+    emueeprom_latency_t latency[op_total];
+} trace_report_t;
+
+int traceRecordStart(char const *pPath);
+void traceRecordStop(void);
+int traceReplay(char const *pPath, int paced, trace_report_t *pReport);
+void traceReportPrint(trace_report_t const *pReport);
+#endif
+
+#endif // TRACE_H
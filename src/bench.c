@@ -0,0 +1,1847 @@
+/*
+* bench.c
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <bench.h>
+#include <emueeprom.h>
+#include <flash.h>
+
+#define BENCH_SEED 1u
+#define BENCH_VIRT_ADDR 1024u
+#define BENCH_WEAR_ROUNDS 8u
+#define BENCH_WEAR_TRANSFERS 128u // transfers per round
+#define BENCH_TX_GROUPS 2000u
+#define BENCH_ASYNC_WRITES 20000u
+#define BENCH_QD_WRITES 20000u
+#define BENCH_QD_BLOCKS 8u
+#define BENCH_COMMITS 2000u
+#define BENCH_GROUP_WINDOW_US 2000u
+#define BENCH_GROUP_FLUSHES 16u
+#define BENCH_CACHE_OPS 20000u
+#define BENCH_COLD_VIRT_ADDR 1536u // written once, after BENCH_VIRT_ADDR
+#define BENCH_COLD_COUNT 64u
+#define BENCH_SUMMARY_READS 20000u
+#define BENCH_BOOT_VALUES 256u // 4 byte values read at boot
+#define BENCH_BOOT_ROUNDS 200u
+#define BENCH_PROVISION_WRITES 4096u // 4 byte writes replayed to provision BENCH_VIRT_ADDR bytes
+#define BENCH_HOT_VALUES 16u // 4 byte values rewritten after BENCH_VIRT_ADDR of settings
+#define BENCH_HOT_WRITES 20000u
+#define BENCH_HOT_GENERATIONS 2u
+#define BENCH_RING_WRITES 40000u
+#define BENCH_VIEW_BLOBS 32u // values of MAX_DATA_PER_PAGE bytes
+#define BENCH_VIEW_READS 20000u
+#define BENCH_MULTI_REQS 40u // scattered 4 byte values read together
+#define BENCH_MULTI_ROUNDS 500u
+#define BENCH_ERASE_WRITES 20000u
+#define BENCH_FORMAT_MAX_KB (16u * 1024u)
+#define BENCH_LARGE_BYTES (4u * 1024u * 1024u) // written per record size and method
+#define BENCH_GC_PAGES ((BLOCK_SIZE / PAGE_SIZE) - 5u) // data pages a compacted live set may use, leaving 4 free
+#define BENCH_GC_MAX_WRITES 100000u // 4 byte rewrites before giving up on a transfer
+#define BENCH_SHARE_READS 20000u // random 4 byte reads per reader process
+#define BENCH_SHARE_MAX_READERS 4u
+#define BENCH_FEED_ROUNDS 200u
+#define BENCH_FEED_MAX_WRITES 256u // random 4 byte writes between syncs
+#define BENCH_MIRROR_WRITES 20000u
+#define BENCH_MIRROR_FLUSHED 5000u // writes each followed by a flush
+#define BENCH_MIRROR_MISSED 64u // flushed writes made with the mirror stopped
+#define BENCH_SCRUB_OPS 20000u // random 4 byte writes and as many reads, per budget
+#define BENCH_UPDATE_STRUCT 64u // bytes of each struct rewritten
+#define BENCH_UPDATE_STRUCTS 16u
+#define BENCH_UPDATE_OPS 20000u // rewrites per mix and method
+#define BENCH_COUNTERS 16u // 4 byte counters
+#define BENCH_COUNTER_ADDS 20000u // increments per method, split between the threads
+#define BENCH_COUNTER_THREADS 4u
+
+typedef struct {
+    int add; // emuEepromAdd, or a read then a write
+    uint32_t adds;
+    unsigned int seed;
+} bench_counter_t;
+
+uint64_t _benchNowUs(void);
+uint32_t _benchTransfers(emueeprom_wear_t *pStart, emueeprom_wear_t *pEnd);
+int _benchWearSpread(void);
+int _benchTxCommit(void);
+int _benchAsyncLatency(void);
+int _benchCompareU32(void const *pA, void const *pB);
+int _benchQueueDepth(void);
+int _benchDurability(void);
+int _benchCache(void);
+int _benchPageSummary(void);
+int _benchReadAll(void);
+int _benchImport(void);
+int _benchHotCold(void);
+int _benchPageBuffers(void);
+int _benchReadView(void);
+int _benchReadMulti(void);
+int _benchLargeWrites(void);
+int _benchEraseAhead(void);
+int _benchFormat(void);
+int _benchTransferCost(void);
+int _benchSharedRead(void);
+void _benchSharedReader(uint64_t *pResult);
+int _benchChangeFeed(void);
+int _benchApplyChange(uint16_t vAddr, uint16_t len, void const *pData, void *pContext);
+int _benchMirror(void);
+int _benchScrub(void);
+int _benchUpdate(void);
+int _benchCounters(void);
+void *_benchCounter(void *pArg);
+
+typedef struct {
+    int (*pBench)(void);
+    char const *pName;
+} bench_case_t;
+
+static const bench_case_t m_benches[] = {
+    {_benchWearSpread, "Wear spread"},
+    {_benchTxCommit, "Transaction commit"},
+    {_benchAsyncLatency, "Async latency"},
+    {_benchQueueDepth, "Queue depth"},
+    {_benchDurability, "Durability"},
+    {_benchCache, "Cache"},
+    {_benchPageSummary, "Page summary"},
+    {_benchReadAll, "Read all"},
+    {_benchImport, "Import"},
+    {_benchHotCold, "Hot/cold"},
+    {_benchPageBuffers, "Page buffers"},
+    {_benchReadView, "Read view"},
+    {_benchReadMulti, "Read multi"},
+    {_benchLargeWrites, "Large writes"},
+    {_benchEraseAhead, "Erase ahead"},
+    {_benchFormat, "Format"},
+    {_benchTransferCost, "Transfer cost"},
+    {_benchSharedRead, "Shared read"},
+    {_benchChangeFeed, "Change feed"},
+    {_benchMirror, "Mirror"},
+    {_benchScrub, "Scrub"},
+    {_benchUpdate, "Update"},
+    {_benchCounters, "Counters"},
+};
+
+
+/*!------------------------------------------------------------------------------
+    @brief Run all benchmarks. Erases existing emulated EEPROM.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int benchSuiteEmuEeprom(void)
+{
+    emuEepromDestroy();
+    emuEepromInit();
+    srand(BENCH_SEED);
+
+#ifdef EMUEEPROM_METRICS
+    emuEepromLatencyReset();
+#endif
+
+    printf("Starting benchmarks..\n");
+    int result = 0;
+    for(size_t i = 0; i < (sizeof(m_benches) / sizeof(m_benches[0])); i++)
+    {
+        result = m_benches[i].pBench();
+        if(result < 0)
+        {
+            printf("%s failed.\n", m_benches[i].pName);
+            break;
+        }
+    }
+
+#ifdef EMUEEPROM_METRICS
+    printf("Latency over all benchmarks\n");
+    emuEepromLatencyDump();
+#endif
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Monotonic time in microseconds.
+    @param None
+    @return Current time.
+*///-----------------------------------------------------------------------------
+uint64_t _benchNowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000u) + ((uint64_t)now.tv_nsec / 1000u);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Amount of transfers done between two wear reports.
+    @param *pStart - Wear report before.
+    @param *pEnd - Wear report after.
+    @return Number of blocks erased.
+*///-----------------------------------------------------------------------------
+uint32_t _benchTransfers(emueeprom_wear_t *pStart, emueeprom_wear_t *pEnd)
+{
+    uint32_t transfers = 0;
+
+    for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+    {
+        transfers += (pEnd->eraseCount[i] - pStart->eraseCount[i]);
+    }
+
+    return transfers;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Long run of random writes, reporting the erase count spread.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchWearSpread(void)
+{
+    emueeprom_wear_t startWear, wear;
+    uint32_t value = 0;
+
+    emuEepromWear(&startWear);
+    printf("Wear spread (%u blocks, random 4 byte writes)\n", BLOCK_COUNT);
+    printf("%10s %10s %10s %10s %16s\n", "transfers", "min", "max", "spread", "ping-pong max");
+
+    for(uint16_t round = 1; round <= BENCH_WEAR_ROUNDS; round++)
+    {
+        do
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value);
+            value++;
+            if(emuEepromWrite(vAddr, &value, sizeof(value)) < 0)
+            {
+                return -1;
+            }
+
+            emuEepromWear(&wear);
+        } while(_benchTransfers(&startWear, &wear) < (round * BENCH_WEAR_TRANSFERS));
+
+        uint32_t transfers = _benchTransfers(&startWear, &wear);
+        // two fixed blocks would take every erase between them
+        printf("%10u %10u %10u %10u %16u\n", transfers, wear.minCount, wear.maxCount, 
+            wear.maxCount - wear.minCount, startWear.maxCount + ((transfers + 1u) / 2u));
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Group updates of three settings, flushed per record versus one transaction.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchTxCommit(void)
+{
+    emueeprom_wear_t startWear, endWear;
+    uint32_t group[3] = {0}; // ip, mask, gateway
+
+    printf("Group update (%u groups of %u settings)\n", BENCH_TX_GROUPS, 3u);
+    printf("%16s %12s %12s\n", "mode", "us/group", "transfers");
+
+    for(int mode = 0; mode < 2; mode++)
+    {
+        emuEepromWear(&startWear);
+        uint64_t start = _benchNowUs();
+
+        for(uint32_t i = 0; i < BENCH_TX_GROUPS; i++)
+        {
+            if(mode)
+            {
+                emuEepromTxBegin();
+            }
+
+            for(uint16_t u = 0; u < 3u; u++)
+            {
+                group[u] = i;
+                if(emuEepromWrite(u * sizeof(group[u]), &group[u], sizeof(group[u])) < 0)
+                {
+                    return -1;
+                }
+
+                if(!mode)
+                {
+                    emuEepromFlush();
+                }
+            }
+
+            if(mode && (emuEepromTxCommit() < 0))
+            {
+                return -1;
+            }
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromWear(&endWear);
+        printf("%16s %12.2f %12u\n", mode ? "transaction" : "flush per write", 
+            (double)elapsed / BENCH_TX_GROUPS, _benchTransfers(&startWear, &endWear));
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Caller observed latency of emuEepromWrite versus emuEepromWriteAsync.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchAsyncLatency(void)
+{
+    uint32_t *pLatency = malloc(BENCH_ASYNC_WRITES * sizeof(uint32_t));
+    int result = 0;
+
+    if(pLatency == NULL)
+    {
+        return -1;
+    }
+
+    printf("Caller latency (%u random 4 byte writes)\n", BENCH_ASYNC_WRITES);
+    printf("%8s %10s %10s %10s %10s %12s\n", "mode", "p50 us", "p99 us", "p999 us", "max us", "total ms");
+
+    for(int mode = 0; (mode < 2) && (result >= 0); mode++)
+    {
+        uint64_t start = _benchNowUs();
+
+        if(mode && (emuEepromAsyncStart() < 0))
+        {
+            result = -1;
+            break;
+        }
+
+        for(uint32_t i = 0; i < BENCH_ASYNC_WRITES; i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            uint64_t callStart = _benchNowUs();
+            ssize_t count = mode ? emuEepromWriteAsync(vAddr, &i, sizeof(i), NULL, NULL) : emuEepromWrite(vAddr, &i, sizeof(i));
+            pLatency[i] = (uint32_t)(_benchNowUs() - callStart);
+            if(count < 0)
+            {
+                result = -1;
+                break;
+            }
+        }
+
+        if(mode)
+        {
+            emuEepromSync();
+            emuEepromAsyncStop();
+        }
+        else
+        {
+            emuEepromFlush();
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        qsort(pLatency, BENCH_ASYNC_WRITES, sizeof(uint32_t), _benchCompareU32);
+        printf("%8s %10u %10u %10u %10u %12.2f\n", mode ? "async" : "sync", 
+            pLatency[BENCH_ASYNC_WRITES / 2u], pLatency[(BENCH_ASYNC_WRITES * 99u) / 100u], 
+            pLatency[(BENCH_ASYNC_WRITES * 999u) / 1000u], pLatency[BENCH_ASYNC_WRITES - 1u], elapsed / 1000.0);
+    }
+
+    free(pLatency);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief qsort compare for uint32_t.
+*///-----------------------------------------------------------------------------
+int _benchCompareU32(void const *pA, void const *pB)
+{
+    uint32_t a = *(uint32_t const *)pA;
+    uint32_t b = *(uint32_t const *)pB;
+
+    return (a > b) - (a < b);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Blocking flash writes versus io_uring at several queue depths.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchQueueDepth(void)
+{
+    uint32_t const depths[] = {0u, 1u, 4u, 16u, 64u};
+    uint8_t page[PAGE_SIZE];
+    int result = 0;
+
+    memset(page, 0xA5, sizeof(page));
+    printf("Flash queue depth (%u pages programmed and %u blocks erased, then %u random 4 byte writes)\n", 
+        (BENCH_QD_BLOCKS * BLOCK_SIZE) / PAGE_SIZE, BENCH_QD_BLOCKS, BENCH_QD_WRITES);
+    printf("%8s %14s %14s %14s\n", "depth", "pages/s", "erases/s", "writes/s");
+
+    for(size_t i = 0; (i < (sizeof(depths) / sizeof(depths[0]))) && (result >= 0); i++)
+    {
+        uint32_t depth = flashSetQueueDepth(depths[i]);
+        if(depth != depths[i])
+        {
+            printf("%8u %14s\n", depths[i], "unavailable");
+            continue;
+        }
+
+        // raw page programs, then erases of the same blocks
+        uint64_t start = _benchNowUs();
+        for(uint32_t u = 0; u < ((BENCH_QD_BLOCKS * BLOCK_SIZE) / PAGE_SIZE); u++)
+        {
+            flashWrite(BLOCK_START_ADDR + (BLOCK_COUNT * BLOCK_SIZE) + (u * PAGE_SIZE), page, PAGE_SIZE);
+        }
+
+        result = flashSync();
+        uint64_t programTime = _benchNowUs() - start;
+
+        start = _benchNowUs();
+        for(uint32_t u = 0; u < BENCH_QD_BLOCKS; u++)
+        {
+            flashBlockErase(BLOCK_COUNT + u, 1);
+        }
+
+        flashSync();
+        uint64_t eraseTime = _benchNowUs() - start;
+
+        // through the emulated EEPROM
+        emuEepromDestroy();
+        emuEepromInit();
+        start = _benchNowUs();
+        for(uint32_t u = 0; u < BENCH_QD_WRITES; u++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(u))) * sizeof(u);
+            if(emuEepromWrite(vAddr, &u, sizeof(u)) < 0)
+            {
+                result = -1;
+                break;
+            }
+        }
+
+        emuEepromFlush();
+        flashSync();
+        uint64_t writeTime = _benchNowUs() - start;
+
+        printf("%8u %14.0f %14.0f %14.0f\n", depth, 
+            ((BENCH_QD_BLOCKS * BLOCK_SIZE) / PAGE_SIZE) * 1e6 / programTime, 
+            BENCH_QD_BLOCKS * 1e6 / eraseTime, BENCH_QD_WRITES * 1e6 / writeTime);
+    }
+
+    flashSetQueueDepth(0);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Flush latency and throughput of each durability mode, every write is
+    followed by a flush.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchDurability(void)
+{
+    emueeprom_durability_t const modes[] = {durable_none, durable_flush, durable_group, durable_dsync};
+    char const *pNames[] = {"none", "flush", "group", "dsync"};
+    uint32_t *pLatency = malloc(BENCH_COMMITS * sizeof(uint32_t));
+    int result = 0;
+
+    if(pLatency == NULL)
+    {
+        return -1;
+    }
+
+    printf("Durability (%u 4 byte write and flush commits, group window %u us or %u flushes)\n", 
+        BENCH_COMMITS, BENCH_GROUP_WINDOW_US, BENCH_GROUP_FLUSHES);
+    printf("%8s %12s %10s %10s %10s\n", "mode", "commits/s", "p50 us", "p99 us", "max us");
+
+    for(size_t m = 0; (m < (sizeof(modes) / sizeof(modes[0]))) && (result >= 0); m++)
+    {
+        emuEepromDestroy();
+        emuEepromInit();
+        if(emuEepromDurability(modes[m], BENCH_GROUP_WINDOW_US, BENCH_GROUP_FLUSHES) < 0)
+        {
+            result = -1;
+            break;
+        }
+
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; i < BENCH_COMMITS; i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            uint64_t commitStart = _benchNowUs();
+            if((emuEepromWrite(vAddr, &i, sizeof(i)) < 0) || (emuEepromFlush() < 0))
+            {
+                result = -1;
+                break;
+            }
+
+            pLatency[i] = (uint32_t)(_benchNowUs() - commitStart);
+        }
+
+        emuEepromSync();
+        uint64_t elapsed = _benchNowUs() - start;
+
+        if(result >= 0)
+        {
+            qsort(pLatency, BENCH_COMMITS, sizeof(uint32_t), _benchCompareU32);
+            printf("%8s %12.0f %10u %10u %10u\n", pNames[m], BENCH_COMMITS * 1e6 / elapsed, 
+                pLatency[BENCH_COMMITS / 2u], pLatency[(BENCH_COMMITS * 99u) / 100u], pLatency[BENCH_COMMITS - 1u]);
+        }
+    }
+
+    emuEepromDurability(durable_none, 0u, 0u);
+    free(pLatency);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Mixed random reads and writes with no cache, the active block cached and
+    the whole partition cached.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchCache(void)
+{
+    uint32_t const budgets[] = {0u, BLOCK_SIZE, BLOCK_COUNT * BLOCK_SIZE};
+    int result = 0;
+
+    printf("Block cache (%u random 4 byte reads, one write every 4 reads)\n", BENCH_CACHE_OPS);
+    printf("%8s %12s %10s %14s %14s\n", "RAM", "ops/s", "hit %", "flash read KB", "saved KB");
+
+    for(size_t b = 0; (b < (sizeof(budgets) / sizeof(budgets[0]))) && (result >= 0); b++)
+    {
+        emueeprom_stats_t stats;
+
+        emuEepromDestroy();
+        emuEepromInit();
+        uint32_t cacheBytes = emuEepromCache(budgets[b]);
+        emuEepromStatsReset();
+
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; i < BENCH_CACHE_OPS; i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            uint32_t data = 0;
+            ssize_t count = ((i % 4u) == 0u) ? emuEepromWrite(vAddr, &i, sizeof(i)) : emuEepromRead(vAddr, &data, sizeof(data));
+            if(count < 0)
+            {
+                result = -1;
+                break;
+            }
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromStats(&stats);
+        uint32_t lookups = stats.cacheHits + stats.cacheMisses;
+        printf("%8u %12.0f %10.1f %14.1f %14.1f\n", cacheBytes, BENCH_CACHE_OPS * 1e6 / elapsed, 
+            lookups ? (100.0 * stats.cacheHits / lookups) : 0.0, stats.flashBytesRead / 1024.0, stats.flashBytesSaved / 1024.0);
+    }
+
+    emuEepromCache(0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pages parsed per read with page summaries, for rarely written addresses
+    under a nearly full block of hot writes, and for the hot addresses themselves.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchPageSummary(void)
+{
+    emueeprom_info_t info;
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+
+    for(uint32_t i = 0; (i < BENCH_COLD_COUNT) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(BENCH_COLD_VIRT_ADDR + (i * sizeof(i)), &i, sizeof(i)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    emuEepromInfo(&info);
+    for(uint32_t i = 0; (info.currPage < (BLOCK_SIZE / PAGE_SIZE) - 4u) && (result >= 0); i++)
+    {
+        uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+        if(emuEepromWrite(vAddr, &i, sizeof(i)) < 0)
+        {
+            result = -1;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    printf("Page summaries (%u reads over %u pages)\n", BENCH_SUMMARY_READS, info.currPage - 1u);
+    printf("%8s %14s %14s %10s %12s\n", "reads", "visited/read", "skipped/read", "us/read", "RAM bytes");
+
+    for(int cold = 1; (cold >= 0) && (result >= 0); cold--)
+    {
+        emueeprom_stats_t stats;
+        emuEepromStatsReset();
+
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; i < BENCH_SUMMARY_READS; i++)
+        {
+            uint32_t data = 0;
+            uint16_t vAddr = cold ? (BENCH_COLD_VIRT_ADDR + ((rand() % BENCH_COLD_COUNT) * sizeof(data))) : 
+                ((rand() % (BENCH_VIRT_ADDR / sizeof(data))) * sizeof(data));
+            if(emuEepromRead(vAddr, &data, sizeof(data)) < 0)
+            {
+                result = -1;
+                break;
+            }
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromStats(&stats);
+        printf("%8s %14.2f %14.2f %10.2f %12u\n", cold ? "cold" : "hot", (double)stats.pagesVisited / BENCH_SUMMARY_READS, 
+            (double)stats.pagesSkipped / BENCH_SUMMARY_READS, (double)elapsed / BENCH_SUMMARY_READS, stats.summaryBytes);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Boot time config load, one read per value against a single pass read.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchReadAll(void)
+{
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[MAX_VIRTUAL_ADDR / 8u];
+    uint32_t values[BENCH_BOOT_VALUES];
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+
+    // every value written once, then updated until the block is half full
+    for(uint32_t i = 0; (i < (4u * BENCH_BOOT_VALUES)) && (result >= 0); i++)
+    {
+        uint32_t index = (i < BENCH_BOOT_VALUES) ? i : (rand() % BENCH_BOOT_VALUES);
+        values[index] = i;
+        if(emuEepromWrite(index * sizeof(uint32_t), &values[index], sizeof(uint32_t)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    emuEepromFlush();
+    printf("Boot load (%u values of 4 bytes, %u rounds)\n", BENCH_BOOT_VALUES, BENCH_BOOT_ROUNDS);
+    printf("%10s %12s\n", "method", "us/load");
+
+    for(int method = 0; (method < 3) && (result >= 0); method++)
+    {
+        uint64_t start = _benchNowUs();
+        for(uint32_t round = 0; (round < BENCH_BOOT_ROUNDS) && (result >= 0); round++)
+        {
+            if(method == 0)
+            {
+                for(uint32_t i = 0; i < BENCH_BOOT_VALUES; i++)
+                {
+                    uint32_t data = 0;
+                    if((emuEepromRead(i * sizeof(data), &data, sizeof(data)) != sizeof(data)) || (data != values[i]))
+                    {
+                        result = -1;
+                        break;
+                    }
+                }
+            }
+            else if(method == 1)
+            {
+                if((emuEepromReadRange(0u, image, sizeof(values), valid) != sizeof(values)) || memcmp(image, values, sizeof(values)))
+                {
+                    result = -1;
+                }
+            }
+            else if((emuEepromReadAll(image, valid) < (ssize_t)sizeof(values)) || memcmp(image, values, sizeof(values)))
+            {
+                result = -1;
+            }
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        char const *pNames[] = {"per-value", "range", "all"};
+        printf("%10s %12.1f\n", pNames[method], (double)elapsed / BENCH_BOOT_ROUNDS);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Provisioning by replaying writes against importing the final image.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchImport(void)
+{
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[MAX_VIRTUAL_ADDR / 8u];
+    static uint8_t readBack[MAX_VIRTUAL_ADDR];
+    static uint8_t readValid[MAX_VIRTUAL_ADDR / 8u];
+    int result = 0;
+
+    memset(valid, 0, sizeof(valid));
+    memset(valid, 0xFF, BENCH_VIRT_ADDR / 8u);
+
+    printf("Provisioning (%u bytes, %u replayed 4 byte writes)\n", BENCH_VIRT_ADDR, BENCH_PROVISION_WRITES);
+    printf("%8s %10s %10s %10s\n", "method", "ms", "erases", "pages");
+
+    for(int method = 0; (method < 2) && (result >= 0); method++)
+    {
+        emueeprom_wear_t startWear, endWear;
+        emueeprom_info_t info;
+
+        emuEepromDestroy();
+        emuEepromInit();
+        emuEepromWear(&startWear);
+        srand(BENCH_SEED);
+
+        uint64_t start = _benchNowUs();
+        if(method == 0)
+        {
+            for(uint32_t i = 0; (i < BENCH_PROVISION_WRITES) && (result >= 0); i++)
+            {
+                // every value once, then updates
+                uint16_t vAddr = ((i < (BENCH_VIRT_ADDR / sizeof(i))) ? i : (rand() % (BENCH_VIRT_ADDR / sizeof(i)))) * sizeof(i);
+                memcpy(&image[vAddr], &i, sizeof(i));
+                if(emuEepromWrite(vAddr, &i, sizeof(i)) < 0)
+                {
+                    result = -1;
+                }
+            }
+
+            emuEepromFlush();
+        }
+        else if(emuEepromImport(image, valid) != BENCH_VIRT_ADDR)
+        {
+            result = -1;
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromWear(&endWear);
+        emuEepromInfo(&info);
+        if((emuEepromReadAll(readBack, readValid) != BENCH_VIRT_ADDR) || memcmp(readBack, image, BENCH_VIRT_ADDR))
+        {
+            result = -1;
+        }
+
+        printf("%8s %10.2f %10u %10u\n", method ? "import" : "replay", elapsed / 1000.0, 
+            _benchTransfers(&startWear, &endWear), info.currPage - 1u);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Settings written once and counters rewritten often, with and without
+    hot/cold separation.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchHotCold(void)
+{
+    static uint8_t image[BENCH_VIRT_ADDR];
+    static uint8_t readBack[BENCH_VIRT_ADDR];
+    int result = 0;
+
+    printf("Hot/cold (%u settings bytes, %u writes to %u counters)\n", BENCH_VIRT_ADDR, BENCH_HOT_WRITES, BENCH_HOT_VALUES);
+    printf("%12s %10s %12s %12s %10s\n", "generations", "erases", "user bytes", "copy bytes", "copy/user");
+
+    for(int method = 0; (method < 2) && (result >= 0); method++)
+    {
+        emueeprom_wear_t startWear, endWear;
+        emueeprom_stats_t stats;
+        uint8_t generations = method ? BENCH_HOT_GENERATIONS : 0u;
+
+        emuEepromDestroy();
+        emuEepromInit();
+        emuEepromHotCold(generations);
+        srand(BENCH_SEED);
+
+        for(uint32_t i = 0; (i < (BENCH_VIRT_ADDR / sizeof(i))) && (result >= 0); i++)
+        {
+            memcpy(&image[i * sizeof(i)], &i, sizeof(i));
+            if(emuEepromWrite(i * sizeof(i), &i, sizeof(i)) < 0)
+            {
+                result = -1;
+            }
+        }
+
+        emuEepromStatsReset();
+        emuEepromWear(&startWear);
+        for(uint32_t i = 0; (i < BENCH_HOT_WRITES) && (result >= 0); i++)
+        {
+            if(emuEepromWrite(BENCH_VIRT_ADDR + ((rand() % BENCH_HOT_VALUES) * sizeof(i)), &i, sizeof(i)) < 0)
+            {
+                result = -1;
+            }
+        }
+
+        emuEepromWear(&endWear);
+        emuEepromStats(&stats);
+        if((emuEepromRead(0u, readBack, BENCH_VIRT_ADDR) != BENCH_VIRT_ADDR) || memcmp(readBack, image, BENCH_VIRT_ADDR))
+        {
+            result = -1;
+        }
+
+        printf("%12u %10u %12llu %12llu %10.2f\n", generations, _benchTransfers(&startWear, &endWear), 
+            (unsigned long long)stats.userBytes, (unsigned long long)stats.copyBytes, 
+            (double)stats.copyBytes / (stats.userBytes ? stats.userBytes : 1u));
+    }
+
+    emuEepromHotCold(0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Sustained 4 byte writes with a growing page buffer ring.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchPageBuffers(void)
+{
+    uint16_t depths[] = {1u, 2u, PAGE_BUFFER_COUNT};
+    int result = 0;
+
+    printf("Page buffers (%u writes of 4 bytes)\n", BENCH_RING_WRITES);
+    printf("%8s %12s %10s %14s\n", "buffers", "writes/s", "pages", "flash writes");
+
+    for(uint16_t d = 0; (d < (sizeof(depths) / sizeof(depths[0]))) && (result >= 0); d++)
+    {
+        emueeprom_stats_t stats;
+
+        emuEepromDestroy();
+        emuEepromInit();
+        emuEepromPageBuffers(depths[d]);
+        emuEepromStatsReset();
+        srand(BENCH_SEED);
+
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; (i < BENCH_RING_WRITES) && (result >= 0); i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            if(emuEepromWrite(vAddr, &i, sizeof(i)) < 0)
+            {
+                result = -1;
+            }
+        }
+
+        emuEepromFlush();
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromStats(&stats);
+        printf("%8u %12.0f %10u %14u\n", depths[d], (BENCH_RING_WRITES * 1000000.0) / elapsed, 
+            stats.pagesProgrammed, stats.programCalls);
+    }
+
+    emuEepromPageBuffers(1u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reading whole values by copy against viewing them in place.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchReadView(void)
+{
+    uint8_t blob[MAX_DATA_PER_PAGE];
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+
+    for(uint32_t i = 0; (i < BENCH_VIEW_BLOBS) && (result >= 0); i++)
+    {
+        memset(blob, i, sizeof(blob));
+        if(emuEepromWrite(i * sizeof(blob), blob, sizeof(blob)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    emuEepromFlush();
+    printf("Read view (%u reads of %u byte values)\n", BENCH_VIEW_READS, (unsigned)sizeof(blob));
+    printf("%8s %10s %10s\n", "method", "us/read", "copied");
+
+    for(int method = 0; (method < 2) && (result >= 0); method++)
+    {
+        emueeprom_stats_t stats;
+
+        emuEepromStatsReset();
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; (i < BENCH_VIEW_READS) && (result >= 0); i++)
+        {
+            uint16_t vAddr = (rand() % BENCH_VIEW_BLOBS) * sizeof(blob);
+            if(method == 0)
+            {
+                if((emuEepromRead(vAddr, blob, sizeof(blob)) != sizeof(blob)) || (blob[0] != (vAddr / sizeof(blob))))
+                {
+                    result = -1;
+                }
+            }
+            else
+            {
+                emueeprom_view_t view;
+                if((emuEepromReadView(vAddr, sizeof(blob), &view) != sizeof(blob)) || (view.pData[0] != (vAddr / sizeof(blob))))
+                {
+                    result = -1;
+                }
+
+                emuEepromReleaseView(&view);
+            }
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromStats(&stats);
+        printf("%8s %10.2f %10u\n", method ? "view" : "read", (double)elapsed / BENCH_VIEW_READS, 
+            method ? stats.viewsCopied : BENCH_VIEW_READS);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Telemetry style reads of scattered values, one read each against one
+    multi-get, as the block fills.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchReadMulti(void)
+{
+    uint32_t values[BENCH_MULTI_REQS];
+    emueeprom_req_t reqs[BENCH_MULTI_REQS];
+    uint8_t fills[] = {25u, 50u, 90u}; // percent of the block written
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+
+    printf("Read multi (%u values of 4 bytes, %u rounds)\n", BENCH_MULTI_REQS, BENCH_MULTI_ROUNDS);
+    printf("%6s %8s %12s %14s\n", "fill", "method", "us/round", "visited/round");
+
+    for(uint16_t f = 0; (f < sizeof(fills)) && (result >= 0); f++)
+    {
+        emueeprom_info_t info;
+
+        emuEepromInfo(&info);
+        for(uint32_t i = 0; (info.currPage < (((BLOCK_SIZE / PAGE_SIZE) * fills[f]) / 100u)) && (result >= 0); i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            if(emuEepromWrite(vAddr, &i, sizeof(i)) < 0)
+            {
+                result = -1;
+            }
+
+            emuEepromInfo(&info);
+        }
+
+        for(int method = 0; (method < 2) && (result >= 0); method++)
+        {
+            emueeprom_stats_t stats;
+
+            emuEepromStatsReset();
+            uint64_t start = _benchNowUs();
+            for(uint32_t round = 0; (round < BENCH_MULTI_ROUNDS) && (result >= 0); round++)
+            {
+                for(uint32_t i = 0; i < BENCH_MULTI_REQS; i++)
+                {
+                    reqs[i].vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(values[i]))) * sizeof(values[i]);
+                    reqs[i].len = sizeof(values[i]);
+                    reqs[i].pBuffer = &values[i];
+                    reqs[i].pValid = NULL;
+                }
+
+                if(method == 0)
+                {
+                    for(uint32_t i = 0; i < BENCH_MULTI_REQS; i++)
+                    {
+                        if(emuEepromRead(reqs[i].vAddr, reqs[i].pBuffer, reqs[i].len) < 0)
+                        {
+                            result = -1;
+                        }
+                    }
+                }
+                else if(emuEepromReadMulti(reqs, BENCH_MULTI_REQS) < 0)
+                {
+                    result = -1;
+                }
+            }
+
+            uint64_t elapsed = _benchNowUs() - start;
+            emuEepromStats(&stats);
+            printf("%5u%% %8s %12.1f %14.1f\n", fills[f], method ? "multi" : "single", (double)elapsed / BENCH_MULTI_ROUNDS, 
+                (double)stats.pagesVisited / BENCH_MULTI_ROUNDS);
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Large records written a page of data at a time through the page buffer
+    against in one write, which programs their whole pages together.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchLargeWrites(void)
+{
+    static uint8_t record[MAX_VIRTUAL_ADDR];
+    uint16_t sizes[] = {256u, 512u, 1024u, MAX_VIRTUAL_ADDR};
+    int result = 0;
+
+    printf("Large writes (%u KB per size)\n", BENCH_LARGE_BYTES / 1024u);
+    printf("%8s %8s %10s %14s\n", "bytes", "method", "MB/s", "flash writes");
+
+    for(uint16_t s = 0; (s < (sizeof(sizes) / sizeof(sizes[0]))) && (result >= 0); s++)
+    {
+        for(int method = 0; (method < 2) && (result >= 0); method++)
+        {
+            emueeprom_stats_t stats;
+            uint32_t records = BENCH_LARGE_BYTES / sizes[s];
+
+            emuEepromDestroy();
+            emuEepromInit();
+            emuEepromStatsReset();
+
+            uint64_t start = _benchNowUs();
+            for(uint32_t i = 0; (i < records) && (result >= 0); i++)
+            {
+                memset(record, i, sizes[s]);
+                for(uint16_t pos = 0; (pos < sizes[s]) && (result >= 0); )
+                {
+                    uint16_t len = sizes[s] - pos;
+                    if((method == 0) && (len > MAX_DATA_PER_PAGE))
+                    {
+                        len = MAX_DATA_PER_PAGE;
+                    }
+
+                    if(emuEepromWrite(pos, &record[pos], len) < 0)
+                    {
+                        result = -1;
+                    }
+
+                    pos += len;
+                }
+            }
+
+            emuEepromFlush();
+            uint64_t elapsed = _benchNowUs() - start;
+            emuEepromStats(&stats);
+            printf("%8u %8s %10.2f %14u\n", sizes[s], method ? "direct" : "staged", 
+                (double)(records * sizes[s]) / elapsed, stats.programCalls);
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write latency with the old block erased at the end of each transfer against
+    erased ahead by the idle hook, called between writes.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchEraseAhead(void)
+{
+    uint32_t *pLatency = malloc(BENCH_ERASE_WRITES * sizeof(uint32_t));
+    int result = 0;
+
+    if(pLatency == NULL)
+    {
+        return -1;
+    }
+
+    printf("Erase-ahead (%u random 4 byte writes)\n", BENCH_ERASE_WRITES);
+    printf("%8s %10s %10s %10s %10s %10s\n", "mode", "p50 us", "p999 us", "max us", "inline", "ahead");
+
+    for(int mode = 0; (mode < 2) && (result >= 0); mode++)
+    {
+        emueeprom_stats_t stats;
+
+        emuEepromDestroy();
+        emuEepromInit();
+        emuEepromEraseAhead(mode);
+        emuEepromStatsReset();
+        srand(BENCH_SEED);
+
+        for(uint32_t i = 0; (i < BENCH_ERASE_WRITES) && (result >= 0); i++)
+        {
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i);
+            uint64_t callStart = _benchNowUs();
+            if(emuEepromWrite(vAddr, &i, sizeof(i)) < 0)
+            {
+                result = -1;
+            }
+
+            pLatency[i] = (uint32_t)(_benchNowUs() - callStart);
+            while(mode && (emuEepromIdle() > 0))
+            {
+            }
+        }
+
+        emuEepromStats(&stats);
+        qsort(pLatency, BENCH_ERASE_WRITES, sizeof(uint32_t), _benchCompareU32);
+        printf("%8s %10u %10u %10u %10u %10u\n", mode ? "ahead" : "inline", pLatency[BENCH_ERASE_WRITES / 2u], 
+            pLatency[(BENCH_ERASE_WRITES * 999u) / 1000u], pLatency[BENCH_ERASE_WRITES - 1u], stats.inlineErases, stats.idleErases);
+    }
+
+    emuEepromEraseAhead(0);
+    free(pLatency);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Time to format flash a page at a time, as the file backend used to, against
+    whole blocks in one erase. Sizes past FLASH_SIZE format the part repeatedly.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchFormat(void)
+{
+    uint32_t sizesKb[] = {FLASH_SIZE / 1024u, 1024u, 4096u, BENCH_FORMAT_MAX_KB};
+    uint8_t page[PAGE_SIZE];
+    int result = 0;
+
+    memset(page, 0xFF, sizeof(page));
+    emuEepromDestroy();
+
+    printf("Format (whole flash image)\n");
+    printf("%8s %8s %10s %10s\n", "KB", "method", "ms", "MB/s");
+
+    for(uint16_t s = 0; (s < (sizeof(sizesKb) / sizeof(sizesKb[0]))) && (result >= 0); s++)
+    {
+        uint32_t passes = (sizesKb[s] * 1024u) / FLASH_SIZE;
+        for(int method = 0; (method < 2) && (result >= 0); method++)
+        {
+            uint64_t start = _benchNowUs();
+            for(uint32_t pass = 0; (pass < passes) && (result >= 0); pass++)
+            {
+                if(method)
+                {
+                    flashBlockErase(0, FLASH_SIZE / BLOCK_SIZE);
+                    continue;
+                }
+
+                for(uint32_t offset = 0; (offset < FLASH_SIZE) && (result >= 0); offset += PAGE_SIZE)
+                {
+                    if(flashWrite(offset, page, sizeof(page)) != sizeof(page))
+                    {
+                        result = -1;
+                    }
+                }
+            }
+
+            uint64_t elapsed = _benchNowUs() - start;
+            printf("%8u %8s %10.2f %10.1f\n", sizesKb[s], method ? "blocks" : "pages", elapsed / 1000.0, 
+                (passes * (double)FLASH_SIZE) / elapsed);
+        }
+    }
+
+    emuEepromInit();
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Cost of one block transfer for live sets of 1% to 95% of the virtual
+    addresses, written as entries of one size or a mix. The live set is written once
+    and a 4 byte value inside it is rewritten until the block fills, the write that
+    transfers is measured. Live sets that would not fit in a block are skipped.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchTransferCost(void)
+{
+    static uint8_t data[MAX_VIRTUAL_ADDR];
+    uint16_t percents[] = {1u, 5u, 10u, 25u, 50u, 75u, 95u};
+    uint16_t mixes[][3] = {{1u, 1u, 1u}, {8u, 8u, 8u}, {64u, 64u, 64u}, {1u, 8u, 64u}};
+    char const *pMixNames[] = {"1 B", "8 B", "64 B", "mixed"};
+    int result = 0;
+
+    printf("Transfer cost (one transfer per live set)\n");
+    printf("%6s %5s %6s %8s %10s %8s %8s %8s %8s\n", "mix", "live", "bytes", "entries", "us", "read", "written", "emitted", "copied");
+
+    for(uint16_t m = 0; (m < (sizeof(mixes) / sizeof(mixes[0]))) && (result >= 0); m++)
+    {
+        for(uint16_t p = 0; (p < (sizeof(percents) / sizeof(percents[0]))) && (result >= 0); p++)
+        {
+            uint32_t target = (MAX_VIRTUAL_ADDR * percents[p]) / 100u;
+            uint32_t liveBytes = 0;
+            uint32_t entries = 0;
+            uint32_t pageBytes = 0;
+
+            // each entry costs its header, entries over a page are split in up to 4 pieces
+            while((liveBytes < target) && ((liveBytes + mixes[m][entries % 3u]) <= MAX_VIRTUAL_ADDR))
+            {
+                uint16_t size = mixes[m][entries % 3u];
+                pageBytes += size + (INFO_SIZE * ((size > MAX_DATA_PER_PAGE) ? 4u : 1u));
+                liveBytes += size;
+                entries++;
+            }
+
+            if(((pageBytes / MAX_DATA_PER_PAGE) + 1u) > BENCH_GC_PAGES)
+            {
+                printf("%6s %4u%% %6u %8u %10s\n", pMixNames[m], percents[p], liveBytes, entries, "no fit");
+                continue;
+            }
+
+            emuEepromDestroy();
+            emuEepromInit();
+
+            uint16_t vAddr = 0;
+            for(uint32_t i = 0; (i < entries) && (result >= 0); i++)
+            {
+                uint16_t size = mixes[m][i % 3u];
+                memset(data, i, size);
+                if(emuEepromWrite(vAddr, data, size) < 0)
+                {
+                    result = -1;
+                }
+
+                vAddr += size;
+            }
+
+            emueeprom_stats_t before;
+            emueeprom_stats_t after;
+            uint64_t elapsed = 0;
+            emuEepromStats(&after);
+            for(uint32_t i = 0; (i < BENCH_GC_MAX_WRITES) && (result >= 0); i++)
+            {
+                before = after;
+                uint64_t start = _benchNowUs();
+                if(emuEepromWrite(0u, &i, (liveBytes < sizeof(i)) ? liveBytes : sizeof(i)) < 0)
+                {
+                    result = -1;
+                }
+
+                elapsed = _benchNowUs() - start;
+                emuEepromStats(&after);
+                if(after.transfers != before.transfers)
+                {
+                    break;
+                }
+            }
+
+            if((result < 0) || (after.transfers == before.transfers))
+            {
+                result = -1;
+                break;
+            }
+
+            printf("%6s %4u%% %6u %8u %10u %8u %8u %8u %8llu\n", pMixNames[m], percents[p], liveBytes, entries, (uint32_t)elapsed,
+                after.transferPages - before.transferPages, after.pagesProgrammed - before.pagesProgrammed,
+                after.transferEntries - before.transferEntries, (unsigned long long)(after.copyBytes - before.copyBytes));
+        }
+    }
+
+    emuEepromDestroy();
+    emuEepromInit();
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Random reads from reader processes attached to the shared image, with the
+    writer idle or writing all along, against reads in the writer itself.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchSharedRead(void)
+{
+    uint64_t *pResults = mmap(NULL, BENCH_SHARE_MAX_READERS * 3u * sizeof(uint64_t), PROT_READ | PROT_WRITE, 
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int result = 0;
+
+    if(pResults == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    emuEepromDestroy();
+    emuEepromInit();
+    for(uint32_t i = 0; (i < (BENCH_VIRT_ADDR / sizeof(i))) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(i * sizeof(i), &i, sizeof(i)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    if((result < 0) || (emuEepromFlush() < 0) || (emuEepromShareWriter(0) < 0))
+    {
+        munmap(pResults, BENCH_SHARE_MAX_READERS * 3u * sizeof(uint64_t));
+        return -1;
+    }
+
+    printf("Shared reads (%u random 4 byte reads per process)\n", BENCH_SHARE_READS);
+    printf("%8s %8s %12s %10s %12s\n", "readers", "writer", "reads/s", "retries", "writes/s");
+
+    srand(BENCH_SEED);
+    uint64_t start = _benchNowUs();
+    for(uint32_t i = 0; (i < BENCH_SHARE_READS) && (result >= 0); i++)
+    {
+        uint32_t value;
+        if(emuEepromRead((rand() % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value), &value, sizeof(value)) != sizeof(value))
+        {
+            result = -1;
+        }
+    }
+
+    printf("%8s %8s %12.0f %10s %12s\n", "in-proc", "-", (BENCH_SHARE_READS * 1000000.0) / (_benchNowUs() - start), "-", "-");
+
+    for(uint16_t readers = 1u; (readers <= BENCH_SHARE_MAX_READERS) && (result >= 0); readers *= 2u)
+    {
+        for(int busy = 0; (busy < 2) && (result >= 0); busy++)
+        {
+            uint16_t running = 0;
+            uint32_t writes = 0;
+
+            memset(pResults, 0, BENCH_SHARE_MAX_READERS * 3u * sizeof(uint64_t));
+            fflush(stdout);
+            for(uint16_t r = 0; r < readers; r++)
+            {
+                pid_t pid = fork();
+                if(pid == 0)
+                {
+                    _benchSharedReader(&pResults[r * 3u]);
+                }
+
+                running += (pid > 0);
+            }
+
+            start = _benchNowUs();
+            while(running)
+            {
+                if(!busy)
+                {
+                    running -= (wait(NULL) > 0);
+                    continue;
+                }
+
+                uint32_t value = writes;
+                if(emuEepromWrite((writes % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value), &value, sizeof(value)) < 0)
+                {
+                    result = -1;
+                }
+
+                writes++;
+                while(waitpid(-1, NULL, WNOHANG) > 0)
+                {
+                    running--;
+                }
+            }
+
+            uint64_t elapsed = _benchNowUs() - start;
+            uint64_t readerUs = 0;
+            uint64_t retries = 0;
+            for(uint16_t r = 0; r < readers; r++)
+            {
+                readerUs = (pResults[r * 3u] > readerUs) ? pResults[r * 3u] : readerUs;
+                retries += pResults[(r * 3u) + 1u];
+                if(pResults[(r * 3u) + 2u] || !pResults[r * 3u])
+                {
+                    result = -1;
+                }
+            }
+
+            printf("%8u %8s %12.0f %10llu %12.0f\n", readers, busy ? "writing" : "idle", 
+                readerUs ? ((readers * BENCH_SHARE_READS * 1000000.0) / readerUs) : 0.0, (unsigned long long)retries,
+                (writes * 1000000.0) / elapsed);
+        }
+    }
+
+    emuEepromShareRelease();
+    munmap(pResults, BENCH_SHARE_MAX_READERS * 3u * sizeof(uint64_t));
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reader process of _benchSharedRead, attaches to the image on its own
+    descriptors and exits when done.
+    @param *pResult - Filled with time taken in us, retries and errors.
+    @return Does not return.
+*///-----------------------------------------------------------------------------
+void _benchSharedReader(uint64_t *pResult)
+{
+    emueeprom_stats_t stats;
+    uint64_t errors = 0;
+
+    flashClose();
+    if((flashInit() <= 0) || (emuEepromShareAttach() < 0))
+    {
+        pResult[2] = 1u;
+        _exit(1);
+    }
+
+    emuEepromStatsReset();
+    srand(getpid());
+    uint64_t start = _benchNowUs();
+    for(uint32_t i = 0; i < BENCH_SHARE_READS; i++)
+    {
+        uint32_t value;
+        uint16_t index = rand() % (BENCH_VIRT_ADDR / sizeof(value));
+        if(emuEepromShareRead(index * sizeof(value), &value, sizeof(value)) != sizeof(value))
+        {
+            errors++;
+        }
+    }
+
+    emuEepromStats(&stats);
+    pResult[0] = _benchNowUs() - start;
+    pResult[1] = stats.shareRetries;
+    pResult[2] = errors;
+    _exit(0);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Keeping a copy of BENCH_VIRT_ADDR bytes in sync by reading everything
+    again against following the change feed, for several amounts of writes between
+    syncs. A stale cursor falls back to reading everything.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchChangeFeed(void)
+{
+    static uint8_t mirror[MAX_VIRTUAL_ADDR];
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[MAX_VIRTUAL_ADDR / 8u];
+    emueeprom_cursor_t cursor;
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+    for(uint32_t i = 0; (i < (BENCH_VIRT_ADDR / sizeof(i))) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(i * sizeof(i), &i, sizeof(i)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    emuEepromFlush();
+    emuEepromCursor(&cursor);
+    emuEepromReadAll(mirror, valid);
+
+    printf("Change feed (%u syncs of %u bytes)\n", BENCH_FEED_ROUNDS, BENCH_VIRT_ADDR);
+    printf("%8s %12s %12s %12s %8s\n", "writes", "all us", "feed us", "changes", "stale");
+
+    srand(BENCH_SEED);
+    for(uint32_t writes = 1u; (writes <= BENCH_FEED_MAX_WRITES) && (result >= 0); writes *= 16u)
+    {
+        uint64_t allUs = 0;
+        uint64_t feedUs = 0;
+        uint64_t changes = 0;
+        uint32_t stale = 0;
+        for(uint32_t round = 0; (round < BENCH_FEED_ROUNDS) && (result >= 0); round++)
+        {
+            for(uint32_t i = 0; i < writes; i++)
+            {
+                uint32_t value = rand();
+                if(emuEepromWrite((rand() % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value), &value, sizeof(value)) < 0)
+                {
+                    result = -1;
+                }
+            }
+
+            uint64_t start = _benchNowUs();
+            emuEepromReadAll(image, valid);
+            allUs += _benchNowUs() - start;
+
+            start = _benchNowUs();
+            ssize_t count = emuEepromChangesSince(&cursor, _benchApplyChange, mirror);
+            if(count == CURSOR_STALE)
+            {
+                emuEepromCursor(&cursor);
+                emuEepromReadAll(mirror, valid);
+                stale++;
+            }
+
+            feedUs += _benchNowUs() - start;
+            changes += (count > 0) ? count : 0;
+            if((count < 0) && (count != CURSOR_STALE))
+            {
+                result = -1;
+            }
+            else if(memcmp(mirror, image, BENCH_VIRT_ADDR))
+            {
+                result = -1;
+            }
+        }
+
+        printf("%8u %12.1f %12.1f %12.1f %8u\n", writes, (double)allUs / BENCH_FEED_ROUNDS, (double)feedUs / BENCH_FEED_ROUNDS,
+            (double)changes / BENCH_FEED_ROUNDS, stale);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Change feed callback of _benchChangeFeed, applies a change to the copy.
+*///-----------------------------------------------------------------------------
+int _benchApplyChange(uint16_t vAddr, uint16_t len, void const *pData, void *pContext)
+{
+    uint8_t *pMirror = pContext;
+
+    if(len)
+    {
+        memcpy(&pMirror[vAddr], pData, len);
+    }
+    else
+    {
+        pMirror[vAddr] = 0xFF;
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write throughput with no mirror, a mirror copied in the same call and
+    mirrors lagging behind, then the pages a mirror that missed some writes copies.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchMirror(void)
+{
+    uint16_t const lags[] = {0u, 0u, 8u, MIRROR_MAX_LAG};
+    char const *pNames[] = {"off", "same", "lag 8", "lag 64"};
+    emueeprom_stats_t startStats, stats;
+    double baseRate[2] = {0.0, 0.0};
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+    printf("Mirror (random 4 byte writes, %u buffered and %u flushed)\n", BENCH_MIRROR_WRITES, BENCH_MIRROR_FLUSHED);
+    printf("%8s %12s %9s %12s %9s %8s\n", "mode", "writes/s", "overhead", "flushed/s", "overhead", "pages");
+
+    for(uint16_t mode = 0; (mode < (sizeof(lags) / sizeof(lags[0]))) && (result >= 0); mode++)
+    {
+        double rate[2];
+        if(mode && (emuEepromMirror(1, lags[mode]) < 0))
+        {
+            result = -1;
+            break;
+        }
+
+        srand(BENCH_SEED);
+        emuEepromStats(&startStats);
+        for(int flushed = 0; (flushed < 2) && (result >= 0); flushed++)
+        {
+            uint32_t writes = flushed ? BENCH_MIRROR_FLUSHED : BENCH_MIRROR_WRITES;
+            uint64_t start = _benchNowUs();
+            for(uint32_t i = 0; (i < writes) && (result >= 0); i++)
+            {
+                uint32_t value = rand();
+                if((emuEepromWrite((rand() % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value), &value, sizeof(value)) < 0) ||
+                    (flushed && (emuEepromFlush() < 0)))
+                {
+                    result = -1;
+                }
+            }
+
+            rate[flushed] = (writes * 1000000.0) / (_benchNowUs() - start);
+            baseRate[flushed] = mode ? baseRate[flushed] : rate[flushed];
+        }
+
+        emuEepromStats(&stats);
+        printf("%8s %12.0f %8.1f%% %12.0f %8.1f%% %8u\n", pNames[mode], rate[0], ((baseRate[0] / rate[0]) - 1.0) * 100.0,
+            rate[1], ((baseRate[1] / rate[1]) - 1.0) * 100.0, stats.mirrorPages - startStats.mirrorPages);
+        if(emuEepromMirror(0, 0u) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    // the mirror is up to date, except for what is written while it is stopped
+    for(uint32_t i = 0; (i < BENCH_MIRROR_MISSED) && (result >= 0); i++)
+    {
+        if((emuEepromWrite((rand() % (BENCH_VIRT_ADDR / sizeof(i))) * sizeof(i), &i, sizeof(i)) < 0) || (emuEepromFlush() < 0))
+        {
+            result = -1;
+        }
+    }
+
+    uint64_t start = _benchNowUs();
+    ssize_t count = (result >= 0) ? emuEepromMirror(1, 0u) : -1;
+    printf("Resync after %u unmirrored flushed writes: %d of %u pages copied in %llu us\n", BENCH_MIRROR_MISSED, (int)count,
+        BLOCK_COUNT * (BLOCK_SIZE / PAGE_SIZE), (unsigned long long)(_benchNowUs() - start));
+    if((count < 0) || (emuEepromMirror(0, 0u) < 0))
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Caller latency of writes and reads with the scrub worker off and running
+    at several budgets, and the pages it verified.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchScrub(void)
+{
+    uint32_t const budgets[] = {0u, 1000u, 10000u, 100000u, 10000000u};
+    uint32_t *pLatency = malloc(2u * BENCH_SCRUB_OPS * sizeof(uint32_t));
+    emueeprom_stats_t startStats, stats;
+    int result = 0;
+
+    if(pLatency == NULL)
+    {
+        return -1;
+    }
+
+    emuEepromDestroy();
+    emuEepromInit();
+    printf("Scrub (caller latency of %u random 4 byte writes and reads)\n", BENCH_SCRUB_OPS);
+    printf("%10s %8s %8s %8s %8s %8s %8s %10s %10s\n", "pages/s", "w p50", "w p99", "w max", "r p50", "r p99", "r max", 
+        "verified/s", "passes");
+
+    for(uint16_t mode = 0; (mode < (sizeof(budgets) / sizeof(budgets[0]))) && (result >= 0); mode++)
+    {
+        uint32_t *pWrite = pLatency;
+        uint32_t *pRead = &pLatency[BENCH_SCRUB_OPS];
+
+        emuEepromScrub(budgets[mode], 0, NULL, NULL);
+        if(budgets[mode] && (emuEepromScrubStart() < 0))
+        {
+            result = -1;
+            break;
+        }
+
+        srand(BENCH_SEED);
+        emuEepromStats(&startStats);
+        uint64_t start = _benchNowUs();
+        for(uint32_t i = 0; (i < BENCH_SCRUB_OPS) && (result >= 0); i++)
+        {
+            uint32_t value = rand();
+            uint16_t vAddr = (rand() % (BENCH_VIRT_ADDR / sizeof(value))) * sizeof(value);
+            uint64_t callStart = _benchNowUs();
+            ssize_t count = emuEepromWrite(vAddr, &value, sizeof(value));
+            pWrite[i] = (uint32_t)(_benchNowUs() - callStart);
+
+            callStart = _benchNowUs();
+            count = (count < 0) ? count : emuEepromRead(vAddr, &value, sizeof(value));
+            pRead[i] = (uint32_t)(_benchNowUs() - callStart);
+            result = (count < 0) ? -1 : result;
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromScrubStop();
+        emuEepromStats(&stats);
+
+        qsort(pWrite, BENCH_SCRUB_OPS, sizeof(uint32_t), _benchCompareU32);
+        qsort(pRead, BENCH_SCRUB_OPS, sizeof(uint32_t), _benchCompareU32);
+        printf("%10u %8u %8u %8u %8u %8u %8u %10.0f %10u\n", budgets[mode], pWrite[BENCH_SCRUB_OPS / 2u], 
+            pWrite[(BENCH_SCRUB_OPS * 99u) / 100u], pWrite[BENCH_SCRUB_OPS - 1u], pRead[BENCH_SCRUB_OPS / 2u],
+            pRead[(BENCH_SCRUB_OPS * 99u) / 100u], pRead[BENCH_SCRUB_OPS - 1u], 
+            ((stats.scrubPages - startStats.scrubPages) * 1000000.0) / elapsed, stats.scrubPasses - startStats.scrubPasses);
+    }
+
+    emuEepromScrub(0u, 0, NULL, NULL);
+    free(pLatency);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Rewrite 64 byte structs with emuEepromWrite and with emuEepromUpdate,
+    changing nothing, one byte, one 4 byte field, 8 scattered bytes or all of it.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchUpdate(void)
+{
+    uint16_t const changed[] = {0u, 1u, 4u, 8u, BENCH_UPDATE_STRUCT};
+    char const *pNames[] = {"none", "1 byte", "field", "8 bytes", "all"};
+    static uint8_t structs[BENCH_UPDATE_STRUCTS][BENCH_UPDATE_STRUCT];
+    emueeprom_stats_t startStats, stats;
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+    printf("Update (%u rewrites of %u byte structs per mix)\n", BENCH_UPDATE_OPS, BENCH_UPDATE_STRUCT);
+    printf("%8s %10s %10s %12s %12s %10s %10s %12s\n", "changed", "write us", "update us", "write pages", "update pages", 
+        "write xfer", "upd xfer", "saved B/op");
+
+    srand(BENCH_SEED);
+    for(uint16_t i = 0; i < BENCH_UPDATE_STRUCTS; i++)
+    {
+        for(uint16_t j = 0; j < BENCH_UPDATE_STRUCT; j++)
+        {
+            structs[i][j] = rand();
+        }
+
+        emuEepromWrite(BENCH_VIRT_ADDR + (i * BENCH_UPDATE_STRUCT), structs[i], BENCH_UPDATE_STRUCT);
+    }
+
+    for(uint16_t mix = 0; (mix < (sizeof(changed) / sizeof(changed[0]))) && (result >= 0); mix++)
+    {
+        double callUs[2];
+        uint32_t pages[2];
+        uint32_t transfers[2];
+
+        for(int update = 0; (update < 2) && (result >= 0); update++)
+        {
+            srand(BENCH_SEED);
+            emuEepromStats(&startStats);
+            uint64_t start = _benchNowUs();
+            for(uint32_t i = 0; (i < BENCH_UPDATE_OPS) && (result >= 0); i++)
+            {
+                uint16_t index = rand() % BENCH_UPDATE_STRUCTS;
+                uint16_t field = (rand() % (BENCH_UPDATE_STRUCT / 4u)) * 4u;
+                for(uint16_t j = 0; j < changed[mix]; j++)
+                {
+                    // a field is contiguous, other mixes are spread over the struct
+                    uint16_t offset = (changed[mix] == 4u) ? (field + j) : ((j * (BENCH_UPDATE_STRUCT / changed[mix])) + (rand() % (BENCH_UPDATE_STRUCT / changed[mix])));
+                    structs[index][offset]++;
+                }
+
+                uint16_t vAddr = BENCH_VIRT_ADDR + (index * BENCH_UPDATE_STRUCT);
+                ssize_t count = update ? emuEepromUpdate(vAddr, structs[index], BENCH_UPDATE_STRUCT) : 
+                    emuEepromWrite(vAddr, structs[index], BENCH_UPDATE_STRUCT);
+                result = (count < 0) ? -1 : result;
+            }
+
+            callUs[update] = (double)(_benchNowUs() - start) / BENCH_UPDATE_OPS;
+            emuEepromStats(&stats);
+            pages[update] = stats.pagesProgrammed - startStats.pagesProgrammed;
+            transfers[update] = stats.transfers - startStats.transfers;
+        }
+
+        printf("%8s %10.2f %10.2f %12u %12u %10u %10u %12.1f\n", pNames[mix], callUs[0], callUs[1], pages[0], pages[1], 
+            transfers[0], transfers[1], (double)(stats.updateBytesSaved - startStats.updateBytesSaved) / BENCH_UPDATE_OPS);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Count up random counters with emuEepromAdd and with a read followed by a
+    write, from one thread and from several, and count the increments lost to races.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _benchCounters(void)
+{
+    bench_counter_t counters[BENCH_COUNTER_THREADS];
+    pthread_t threads[BENCH_COUNTER_THREADS];
+    emueeprom_stats_t startStats, stats;
+    int result = 0;
+
+    emuEepromDestroy();
+    emuEepromInit();
+    printf("Counters (%u increments of %u 4 byte counters)\n", BENCH_COUNTER_ADDS, BENCH_COUNTERS);
+    printf("%11s %8s %10s %12s %10s %10s\n", "method", "threads", "us/add", "pages", "transfers", "lost");
+
+    for(uint16_t mode = 0; (mode < 4u) && (result >= 0); mode++)
+    {
+        uint16_t numThreads = (mode < 2u) ? 1u : BENCH_COUNTER_THREADS;
+        uint32_t total = 0;
+
+        emuEepromErase(BENCH_VIRT_ADDR, BENCH_COUNTERS * sizeof(uint32_t));
+        emuEepromStats(&startStats);
+        uint64_t start = _benchNowUs();
+        for(uint16_t i = 0; i < numThreads; i++)
+        {
+            counters[i].add = (mode % 2u);
+            counters[i].adds = BENCH_COUNTER_ADDS / numThreads;
+            counters[i].seed = BENCH_SEED + i;
+            if(pthread_create(&threads[i], NULL, _benchCounter, &counters[i]) != 0)
+            {
+                numThreads = i;
+                result = -1;
+            }
+        }
+
+        for(uint16_t i = 0; i < numThreads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        uint64_t elapsed = _benchNowUs() - start;
+        emuEepromStats(&stats);
+        for(uint16_t i = 0; i < BENCH_COUNTERS; i++)
+        {
+            uint32_t value = 0;
+            emuEepromRead(BENCH_VIRT_ADDR + (i * sizeof(value)), &value, sizeof(value));
+            total += value;
+        }
+
+        printf("%11s %8u %10.2f %12u %10u %10u\n", (mode % 2u) ? "add" : "read+write", numThreads, 
+            (double)elapsed / BENCH_COUNTER_ADDS, stats.pagesProgrammed - startStats.pagesProgrammed, 
+            stats.transfers - startStats.transfers, BENCH_COUNTER_ADDS - total);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Counter thread, increments random counters.
+    @param *pArg - Its bench_counter_t.
+    @return NULL
+*///-----------------------------------------------------------------------------
+void *_benchCounter(void *pArg)
+{
+    bench_counter_t *pCounter = pArg;
+
+    for(uint32_t i = 0; i < pCounter->adds; i++)
+    {
+        uint16_t vAddr = BENCH_VIRT_ADDR + ((rand_r(&pCounter->seed) % BENCH_COUNTERS) * sizeof(uint32_t));
+        if(pCounter->add)
+        {
+            emuEepromAdd(vAddr, 1, NULL);
+        }
+        else
+        {
+            // the value may change between the two calls
+            uint32_t value = 0;
+            emuEepromRead(vAddr, &value, sizeof(value));
+            value++;
+            emuEepromWrite(vAddr, &value, sizeof(value));
+        }
+    }
+
+    return NULL;
+}
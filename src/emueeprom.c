@@ -1,864 +1,5333 @@
-/*
-* emueeprom.c
-* 
-* Notes:
-* - Must used consectitive blocks.
-*
-*/
-
-#include <assert.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include <emueeprom.h>
-
-#define HEADER_SIZE PAGE_SIZE
-#define PAGES_PER_BLOCK (BLOCK_SIZE / PAGE_SIZE)
-#define DATA_PAGES_PER_BLOCK (PAGES_PER_BLOCK - 1u)
-
-#define BLOCK_DATA_OFFSET HEADER_SIZE
-
-#define BITS_PER_BYTE 8u
-#define ERASED 0xFF
-
-// page buffer
-#define VADDR_OFFSET 0u
-#define SIZE_OFFSET 2u
-#define DATA_OFFSET 4u
-#define PAGE_CRC_OFFSET (PAGE_SIZE - CRC_SIZE)
-
-#define MAX_VIRTUAL_ADDR (BLOCK_SIZE / 2) // < BLOCK_SIZE
-#define VIRTUAL_ADDR_BITS (MAX_VIRTUAL_ADDR / BITS_PER_BYTE)
-// Header
-#define UNIQUE_ID 0xBEEF
-#define INIT_CRC 0xFFFF
-
-#define BUFFER_START 0x0000
-#define PAGE_START 0x0001
-#define TRANSFER_START 0x0000
-#define TRANSFER_END 0xEEEE
-
-typedef struct {
-    uint16_t uniqueId; // user specific identifier
-    uint16_t blockNum; // block number starting at 0
-    uint16_t blockTotal; // total number of blocks used for emulated EEPROM
-    uint16_t transferCount;
-    uint16_t crc; // @TODO
-} header_info_t;
-
-typedef enum {
-    block_start = 0,
-    block_1 = 0,
-    block_2,
-    block_total,
-    block_error
-} blocks_t;
-
-ssize_t _emuEepromBufferWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen);
-size_t _emuEepromPageRead(uint8_t *pPage, uint8_t *pBitmap, uint16_t vAddr, void *pBuffer, uint16_t buffLen);
-ssize_t _emuEepromBlockRead(uint8_t *pBitmap, uint16_t vAddr, void *pBuffer, uint16_t buffLen);
-ssize_t _emuEepromBlockTransfer(void);
-void _emuEepromSetBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap);
-uint8_t _emuEepromReadBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap);
-ssize_t _emuEepromBlockFormat(blocks_t block, header_info_t header);
-blocks_t _emuEepromActiveBlock(header_info_t *pHeader);
-uint16_t _emuEepromCurrentPage(blocks_t block);
-uint32_t _emuEepromFindAvailablePage(uint32_t offset, uint16_t change);
-uint16_t _emuEepromHeaderCrc(header_info_t info);
-uint16_t _emuEepromPageCrc(uint8_t *pBuffer);
-
-static emueeprom_info_t m_info;
-static bool m_init = false;
-
-/*!------------------------------------------------------------------------------
-    @brief Initializes emulated EEPROM.
-    @param File descriptor from flash module.
-    @return File descriptor or -1 if an error occured.
-*///-----------------------------------------------------------------------------
-void emuEepromInit(void)
-{
-    assert(!m_init);
-
-    header_info_t header;
-
-    m_info.currBlock = _emuEepromActiveBlock(&header);
-    if(m_info.currBlock == block_error)
-    {
-        header.uniqueId = UNIQUE_ID;
-        header.blockNum = block_1;
-        header.blockTotal = block_total;
-        header.transferCount = TRANSFER_START;
-        header.crc = _emuEepromHeaderCrc(header);
-        _emuEepromBlockFormat(block_1, header);
-        m_info.currBlock = block_1;
-        m_info.currPage = PAGE_START;
-        m_info.bufferPos = BUFFER_START;
-        printf("Emulated EEPROM created.\n");
-    }
-    else
-    {
-        printf("Emulated EEPROM found.\n");
-        m_info.currPage = _emuEepromCurrentPage(m_info.currBlock);
-        m_info.bufferPos = BUFFER_START;
-        printf("Using block %d of %d.\nCurrent page: %d\n", m_info.currBlock + 1u, block_total, m_info.currPage);
-    }
-
-    memset(m_info.pageBuffer, ERASED, PAGE_SIZE);
-    
-    m_init = true;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Erase blocks containing emulated EEPROM.
-    @param None
-    @return None
-*///-----------------------------------------------------------------------------
-void emuEepromDestroy(void)
-{
-    assert(m_init);
-
-    flashBlockErase(block_start, block_total);
-    m_init = false;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Current info about emulated EEPROM.
-    @param *pInfo - Pointer to the infomation.
-    @return None
-*///-----------------------------------------------------------------------------
-void emuEepromInfo(emueeprom_info_t *pInfo)
-{
-    memcpy(pInfo->pageBuffer, m_info.pageBuffer, PAGE_SIZE);
-    pInfo->bufferPos = m_info.bufferPos;
-    pInfo->currPage = m_info.currPage;
-    pInfo->currBlock = m_info.currBlock;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Write data to emulated EEPROM.
-    @param vAddr - Virtual address associated with the data being written.
-    @param *pBuffer - Buffer of data to be written.
-    @param buffLen - Amount of bytes being written.
-    @return Amount of bytes written to emulated EEPROM or negative if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t emuEepromWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen)
-{
-    assert(m_init);
-    assert(buffLen > 0);
-    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
-
-    return _emuEepromBufferWrite(vAddr, pBuffer, buffLen);
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Read data back from the emulated EEPROM.
-    @param vAddr - Virtual address of data to read.
-    @param *pBuffer - Buffer to store read data.
-    @param buffLen - Amount of bytes read.
-    @return Amount of bytes read or negative number if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen)
-{
-    assert(m_init);
-    assert(buffLen > 0);
-    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
-
-    ssize_t count = 0;
-    uint8_t *pBitmap =  NULL; 
-
-    if(buffLen <= BITS_PER_BYTE)
-    {
-        pBitmap = calloc(1u, sizeof(uint8_t));
-    }
-    else
-    {
-        if(buffLen % BITS_PER_BYTE)
-        {
-            pBitmap = calloc((buffLen / BITS_PER_BYTE), sizeof(uint8_t));
-        }
-        else
-        {
-            pBitmap = calloc((buffLen / BITS_PER_BYTE) + 1u, sizeof(uint8_t));
-        }
-    }
-
-    if(pBitmap != NULL)
-    {
-
-        if(m_info.bufferPos != BUFFER_START)
-        {
-            count = _emuEepromPageRead(m_info.pageBuffer, pBitmap, vAddr, pBuffer, buffLen);
-            if((count >= 0) && (count != buffLen))
-            {
-                count = _emuEepromBlockRead(pBitmap, vAddr, pBuffer, buffLen);
-            }
-        }
-        else
-        {
-            count = _emuEepromBlockRead(pBitmap, vAddr, pBuffer, buffLen);
-        }
-
-        free(pBitmap);
-        pBitmap = NULL;
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Removes data related to virtual address from emulated EEPROM.
-    @param vAddr - Virtual address of data to be erased.
-    @param buffLen - Amount of data to erase.
-    @return INFO_SIZE if successful or negative if failed.
-*///-----------------------------------------------------------------------------
-ssize_t emuEepromErase(uint16_t vAddr, uint16_t dataLen)
-{
-    assert(m_init);
-    ssize_t count = 0;
-
-    for(uint16_t i = vAddr; i < (vAddr + dataLen); i++)
-    {
-        count = _emuEepromBufferWrite(i, NULL, 0);
-        if(count < 0)
-        {
-            break;
-        }
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Write the current page buffer to flash.
-    @param None
-    @return Amount of bytes written to flash or negative number if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t emuEepromFlush(void)
-{
-    assert(m_init);
-    assert(m_info.currBlock < block_total);
-    assert(m_info.currPage  < PAGES_PER_BLOCK);
-
-    ssize_t count = 0;
-
-    if(m_info.bufferPos != BUFFER_START)
-    {
-        // calculate the CRC for the page, store, then write to flash
-        uint32_t currOffset = BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (m_info.currPage * PAGE_SIZE);
-        uint16_t calcCrc = _emuEepromPageCrc(m_info.pageBuffer);
-        memcpy(&m_info.pageBuffer[PAGE_CRC_OFFSET], &calcCrc, sizeof(calcCrc));
-        count = flashWrite(currOffset, m_info.pageBuffer, PAGE_SIZE);
-        if(count > 0)
-        {
-            // reset info for page
-            m_info.bufferPos = BUFFER_START;
-            m_info.currPage++;
-            memset(m_info.pageBuffer, ERASED, PAGE_SIZE);
-            // if last page has been written to, initialize a block transfer
-            if(m_info.currPage >= PAGES_PER_BLOCK)
-            {
-                count = _emuEepromBlockTransfer();
-            }
-        }
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Write data to buffer. 
-    @param vAddr - Virtual address of data to be written.
-    @param *pBUffer - Buffer containing the data to be written.
-    @param buffLen - Amount of data (in bytes) to be written.
-    @return Amount of data written or negative value if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t _emuEepromBufferWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen)
-{
-    ssize_t count = 0;
-    uint16_t remainingSpace = ((PAGE_SIZE - CRC_SIZE) - m_info.bufferPos);
-
-    if(remainingSpace >= (INFO_SIZE + buffLen)) 
-    {
-        memcpy(&m_info.pageBuffer[m_info.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
-        memcpy(&m_info.pageBuffer[m_info.bufferPos + SIZE_OFFSET], &buffLen, sizeof(buffLen));
-        if(buffLen)
-        {
-            memcpy(&m_info.pageBuffer[m_info.bufferPos + DATA_OFFSET], pBuffer, buffLen);
-        }
-
-        m_info.bufferPos += (INFO_SIZE + buffLen);
-        count += buffLen;
-    }
-    else 
-    {
-        uint16_t writeCount = 0;
-        uint16_t pagesNeeded = 0;     
-        uint16_t remainder = 0;   
-
-        remainingSpace -= INFO_SIZE;
-        assert(buffLen > remainingSpace);
-        if((buffLen - remainingSpace) % MAX_DATA_PER_PAGE)
-        {
-            remainder = 1u;
-        }
-        else
-        {
-            remainder = 0u;
-        }
-
-        pagesNeeded = ((buffLen - remainingSpace) / MAX_DATA_PER_PAGE) + remainder + 1u; // 1 for existing page  
-
-        for(int i = 0; i < pagesNeeded; i++)
-        {
-            assert(remainingSpace != 0);
-            memcpy(&m_info.pageBuffer[m_info.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
-            memcpy(&m_info.pageBuffer[m_info.bufferPos + SIZE_OFFSET], &remainingSpace, sizeof(remainingSpace)); 
-            memcpy(&m_info.pageBuffer[m_info.bufferPos + DATA_OFFSET], pBuffer + writeCount, remainingSpace); 
-            m_info.bufferPos += (remainingSpace + INFO_SIZE);
-            writeCount += remainingSpace;
-
-            if(m_info.bufferPos >= PAGE_CRC_OFFSET)
-            {
-                count = emuEepromFlush();
-            }
-
-            if(count >= 0) 
-            {   
-                vAddr += remainingSpace;
-                buffLen -= remainingSpace;
-                if(buffLen == 0)
-                {
-                    break;
-                }
-
-                if(buffLen >= MAX_DATA_PER_PAGE)
-                {
-                    remainingSpace = MAX_DATA_PER_PAGE;
-                }
-                else
-                {
-                    remainingSpace = buffLen;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
-
-    // check if min. entry can fit in current buffer
-    if((m_info.bufferPos + INFO_SIZE) >= PAGE_CRC_OFFSET) 
-    {
-        ssize_t flushCount = emuEepromFlush();
-        if(flushCount <= 0)
-        {
-            count = -1;
-        }
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Read data from page. 
-    @param *pPage - Buffer of data to be searched.
-    @param *pBitmap - A bitmap corresponding to each virtual address.
-    @param vAddr - Virtual address of data being searched for.
-    @param *pBuffer - Buffer to store read data.
-    @param buffLen - Amount of data (in bytes) to read.
-    @return Amount of data (in bytes) read.
-*///-----------------------------------------------------------------------------
-size_t _emuEepromPageRead(uint8_t *pPage, uint8_t *pBitmap, uint16_t vAddr, void *pBuffer, uint16_t buffLen)
-{
-    size_t numRead = 0;
-    uint16_t numEntries = 0; 
-    uint8_t *pBuff = (uint8_t *)pBuffer;
-    uint16_t *pEntries = NULL;
-
-    // find all entries in buffer
-    for(uint16_t i = 0; i < PAGE_CRC_OFFSET;)
-    {
-        uint16_t entryAddr = 0;
-        uint16_t entrySize = 0;
-        memcpy(&entryAddr, &pPage[i + VADDR_OFFSET], sizeof(entryAddr));
-        memcpy(&entrySize, &pPage[i + SIZE_OFFSET], sizeof(entrySize));
-        if((entryAddr != ERASED) && (entrySize < MAX_VIRTUAL_ADDR))
-        {
-            pEntries = (uint16_t *)realloc(pEntries, sizeof(*pEntries) + (sizeof(*pEntries) * numEntries));
-            pEntries[numEntries] = i;
-            i += VADDR_SIZE + SIZE_SIZE + entrySize;
-            numEntries++;   
-        }
-        else
-        {
-            break;
-        }
-    }
-    // search buffer starting with the last
-    if(numEntries)
-    {
-        for(int i = (numEntries - 1); i >= 0; i--)
-        {
-            uint16_t tempVAddr = 0;
-            uint16_t tempSize = 0;
-
-            memcpy(&tempVAddr, &pPage[pEntries[i] + VADDR_OFFSET], sizeof(tempVAddr));
-            memcpy(&tempSize, &pPage[pEntries[i] + SIZE_OFFSET], sizeof(tempSize));
-            if(((tempVAddr <= vAddr) && (vAddr < (tempVAddr + tempSize))) || 
-            ((tempVAddr < (vAddr + buffLen)) && ((vAddr + buffLen) <= (tempVAddr + tempSize)))||
-            ((tempVAddr == vAddr) && (tempSize == 0)))
-            {
-                uint16_t amountFound = 0; // amount of bytes found in pPage
-                uint16_t storeIndex = 0; // location in pBuffer to store read data
-                uint16_t pageIndex = 0; // location to read from 
-                uint16_t foundVAddr = 0;
-        
-                if(tempVAddr <= vAddr)
-                {
-                    storeIndex = 0;
-                    pageIndex = (vAddr - tempVAddr);
-                    foundVAddr = vAddr;
-                    amountFound = (tempVAddr + tempSize) - vAddr;
-                    if(amountFound >= buffLen)
-                    {
-                        amountFound = buffLen;
-                    }
-
-                }
-                else
-                {
-                    storeIndex = (tempVAddr - vAddr);
-                    pageIndex = 0;
-                    foundVAddr = tempVAddr;
-                    amountFound = (vAddr + buffLen) - tempVAddr;
-                    if(amountFound >= tempSize)
-                    {
-                        amountFound = tempSize;
-                    }
-                }
-
-                if(amountFound)
-                {
-                    for(int u = 0; u < amountFound; u++)
-                    {   
-                        if(_emuEepromReadBit(vAddr, foundVAddr, pBitmap) == 0)
-                        {
-                            memcpy(&pBuff[storeIndex + u], &pPage[pEntries[i] + DATA_OFFSET + pageIndex + u], sizeof(uint8_t));
-                            _emuEepromSetBit(vAddr, foundVAddr, pBitmap);
-                            numRead++;
-                        }
-
-                        foundVAddr++;
-                    }
-                }
-                else // erased
-                {
-                    if(_emuEepromReadBit(vAddr, foundVAddr, pBitmap) == 0)
-                    {
-                        _emuEepromSetBit(vAddr, foundVAddr, pBitmap);
-                        numRead++;
-                        if(buffLen == 1u)
-                        {
-                            numRead = 0u;
-                            break;
-                        }
-                    }
-                }
-
-                if(numRead == buffLen)
-                {
-                    break;
-                }
-            }
-            else if((tempVAddr == vAddr) && (tempSize == 0)) // erased
-            {
-                break;
-            }
-        }
-    }
-
-    if(pEntries == NULL)
-    {
-        free(pEntries);
-        pEntries = NULL;
-    }
-
-    return numRead;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Read data from current block. 
-    @param *pBitmap - A bitmap corresponding to each virtual address.
-    @param vAddr - Virtual address of data being searched for.
-    @param *pBuffer - Buffer to store read data to.
-    @param buffLen - Amount of data (in bytes) to read.
-    @return Amount of data (in bytes) read.
-*///-----------------------------------------------------------------------------
-ssize_t _emuEepromBlockRead(uint8_t *pBitmap, uint16_t vAddr, void *pBuffer, uint16_t buffLen)
-{
-    uint8_t pageBuffer[PAGE_SIZE] = {0};
-    size_t numRead = 0;
-    
-    if(m_info.currPage > PAGE_START)
-    {
-        uint16_t lastPage = m_info.currPage - 1u;
-        for(int i = lastPage; i >= 0; i--)
-        {
-            uint32_t currOffset = (BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (i * PAGE_SIZE));
-            ssize_t count = flashRead(currOffset, pageBuffer, PAGE_SIZE);
-            if(count >= 0)
-            {
-                numRead += _emuEepromPageRead(pageBuffer, pBitmap, vAddr, pBuffer, buffLen);
-                if(numRead == buffLen)
-                {
-                    break;
-                }
-            }
-            else
-            {
-                return count;
-            }
-        }
-    }
-
-    return numRead;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Transfer latest data to next block.
-    @param None
-    @return Last amount of data written to buffer or negative value if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t _emuEepromBlockTransfer(void)
-{
-    uint8_t AddrBitMap[VIRTUAL_ADDR_BITS];
-    uint8_t tempBuffer[PAGE_SIZE];
-    uint32_t offset = (BLOCK_START_ADDR + (BLOCK_SIZE * m_info.currBlock));
-    blocks_t lastBlock = m_info.currBlock;
-    header_info_t header;
-
-    memset(AddrBitMap, 0, VIRTUAL_ADDR_BITS);
-
-    ssize_t count = flashRead(offset, &header, sizeof(header));
-    if(count > 0)
-    {
-        m_info.currBlock++;
-        if(m_info.currBlock == block_total)
-        {
-            m_info.currBlock = block_start;
-        }
-
-        if(header.transferCount >= TRANSFER_END)
-        {
-            header.transferCount = TRANSFER_START;
-        }
-        else
-        {
-            header.transferCount++;
-        }
-
-        header.blockNum = m_info.currBlock;
-        header.crc = _emuEepromHeaderCrc(header);
-        _emuEepromBlockFormat(m_info.currBlock, header);
-        m_info.bufferPos = 0; 
-        m_info.currPage = PAGE_START;
-
-        for(uint16_t i = 0; i < DATA_PAGES_PER_BLOCK; i++)
-        {
-            offset = (((lastBlock * BLOCK_SIZE) + (BLOCK_SIZE - PAGE_SIZE)) - (PAGE_SIZE * i));
-            count = flashRead(offset, tempBuffer, PAGE_SIZE);
-            if(count > 0)
-            {
-                uint16_t tempCrc = _emuEepromPageCrc(tempBuffer);
-                if(tempCrc == (uint16_t)(tempBuffer[PAGE_CRC_OFFSET] | tempBuffer[PAGE_CRC_OFFSET + 1] << BITS_PER_BYTE))
-                {
-                    uint16_t numEntries = 0, streak = 0, buffPos = 0;
-                    uint16_t *pEntries = malloc(sizeof(uint16_t));
-
-                    while(buffPos < (PAGE_CRC_OFFSET - MIN_ENTRY_SIZE))
-                    {   
-                        uint16_t entrySize = 0;
-                        pEntries[numEntries++] = buffPos;
-                        memcpy(&entrySize, &tempBuffer[buffPos + SIZE_OFFSET], sizeof(entrySize));
-                        buffPos += (VADDR_SIZE + SIZE_SIZE + entrySize);
-                        pEntries = realloc(pEntries, sizeof(*pEntries) + (numEntries * sizeof(uint16_t)));
-                    }
-    
-                    for(int u = (numEntries - 1); u >= 0; u--)
-                    {
-                        uint16_t tempVAddr, tempSize, newVAddr;
-                        memcpy(&tempVAddr, &tempBuffer[pEntries[u] + VADDR_OFFSET], sizeof(tempVAddr));
-                        memcpy(&tempSize, &tempBuffer[pEntries[u] + SIZE_OFFSET], sizeof(tempSize));
-                        newVAddr = tempVAddr;
-                        // iterate through data, while checking bitmap
-                        // if bitmap is already set, it will write the current streak of data
-                        for(uint16_t z = 0; z <= tempSize; z++)
-                        {
-                            bool found = false;
-
-                            if(z == tempSize)
-                            {
-                                found = true;
-                            }
-                            else if(_emuEepromReadBit(0u, newVAddr, AddrBitMap))
-                            {
-                                found = true;
-                            }
-                            
-                            if(found)
-                            {
-                                if(streak)
-                                {
-                                    count = _emuEepromBufferWrite(tempVAddr, &tempBuffer[pEntries[u] + DATA_OFFSET + (z - streak)], streak);
-                                    if(count > 0) 
-                                    {
-                                        for(uint16_t w = 0; w < streak; w++)
-                                        {
-                                            _emuEepromSetBit(0u, tempVAddr + w, AddrBitMap);
-                                        }
-
-                                        tempVAddr += ++streak;
-                                        streak = 0;   
-                                        found = false;                                  
-                                    }
-                                    else
-                                    {
-                                        break;
-                                    }
-                                }
-                                else
-                                {
-                                    tempVAddr++;
-                                }
-                            }
-                            else
-                            {
-                                streak++;
-                            }
-
-                            newVAddr++;
-                        }
-
-                        if(count <= 0)
-                        {
-                            break;
-                        }
-                    }
-                                
-                    free(pEntries);
-                    pEntries = NULL;
-                }
-            }
-        }
-
-        flashBlockErase(lastBlock, 1u);
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Set bits in bitmap.
-    @param vAddr - The virtual address to check.
-    @param *pBitmap - The bitmap to read from.
-    @param amount - Amount of bits to set.
-    @return None
-*///-----------------------------------------------------------------------------
-void _emuEepromSetBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap)
-{
-    assert(startAddr <= vAddr);
-    uint16_t index = (vAddr - startAddr) / BITS_PER_BYTE;
-    uint16_t bit = (vAddr - startAddr) % BITS_PER_BYTE;
-
-    pBitmap[index] |= (1 << bit);
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Read bit in bitmap.
-    @param vAddr - The virtual address to check.
-    @param *pBitmap - The bitmap to read from.
-    @return The value of the virtual address bit.
-*///-----------------------------------------------------------------------------
-uint8_t _emuEepromReadBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap)
-{
-    assert(startAddr <= vAddr);
-    uint8_t mask = 0x1;
-    uint16_t index = (vAddr - startAddr) / BITS_PER_BYTE;
-    uint16_t bit = (vAddr - startAddr) % BITS_PER_BYTE;
-
-    return ((pBitmap[index] >> bit) & mask);
-
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Formats block by erasing entire block and writing header.
-    @param block - The block to format.
-    @param header - Header information about the block and emulated EEPROM.
-    @return Amount of bytes written to flash or negative value if error occured.
-*///-----------------------------------------------------------------------------
-ssize_t _emuEepromBlockFormat(blocks_t block, header_info_t header)
-{
-    return flashWrite(BLOCK_START_ADDR + (BLOCK_SIZE * block), &header, sizeof(header));
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Find which block is the current block.
-    @param *pHeader - Header information about the active block.
-    @return Which block is currently active.
-*///-----------------------------------------------------------------------------
-blocks_t _emuEepromActiveBlock(header_info_t *pHeader)
-{
-    blocks_t foundBlock = block_error;
-    uint16_t foundCount = 0u;
-
-    for(blocks_t block = block_1; block < block_total; block++)
-    {
-        ssize_t count = flashRead((BLOCK_START_ADDR + (BLOCK_SIZE * block)), pHeader, sizeof(*pHeader));
-        if(count >= 0)
-        {
-            if(pHeader->uniqueId == UNIQUE_ID)
-            {
-                if(foundBlock == block_error)
-                {
-                    foundBlock = block;
-                    foundCount = pHeader->transferCount;
-                }
-                else
-                {
-                    if(foundCount == TRANSFER_END)
-                    {
-                        if(pHeader->transferCount == TRANSFER_START)
-                        {
-                            foundBlock = block;
-                            foundCount = pHeader->transferCount;
-                        }
-                    }
-                    else if((foundCount < pHeader->transferCount) && (pHeader->transferCount != TRANSFER_END))
-                    {
-                        foundBlock = block;
-                        foundCount = pHeader->transferCount;
-                    }
-                }                            
-            }
-        }
-        else
-        {
-            return block_error;
-        }
-    }
-    
-    return foundBlock;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Find the current page.
-    @param block - The block to search.
-    @return The page number of the next avaiable page.
-*///-----------------------------------------------------------------------------
-uint16_t _emuEepromCurrentPage(blocks_t block)
-{
-    uint32_t offset = BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (BLOCK_SIZE / 2u);
-
-    return _emuEepromFindAvailablePage(offset, (BLOCK_SIZE / 2u)) % PAGE_SIZE;
-}
-
-/*!------------------------------------------------------------------------------
-    @brief Recursively search for the next available page using a sort of binary search.
-    @param offset - Offset in flash to read data from.
-    @param change - The last amount of change in the offset.
-    @return The page number of the next avaiable page.
-*///-----------------------------------------------------------------------------
-uint32_t _emuEepromFindAvailablePage(uint32_t offset, uint16_t change)
-{
-    uint16_t tempVAddr = 0;
-    
-    ssize_t count = flashRead(offset, &tempVAddr, sizeof(tempVAddr));
-    if(count > 0)
-    {
-        if(tempVAddr <= MAX_VIRTUAL_ADDR) 
-        {
-            count = flashRead(offset + PAGE_SIZE, &tempVAddr, sizeof(tempVAddr));
-            if(count > 0)
-            {
-                if((tempVAddr > MAX_VIRTUAL_ADDR) || (((offset + PAGE_SIZE) % BLOCK_SIZE) == 0))
-                {
-                    return ((offset + PAGE_SIZE) / PAGE_SIZE);
-                }
-                else
-                {
-                    offset += (change / 2u);
-                }
-            }
-            else
-            {
-                return PAGE_START;
-            }
-        }
-        else
-        {
-            count = flashRead(offset - PAGE_SIZE, &tempVAddr, sizeof(tempVAddr));
-            if(count > 0)
-            {
-                if(tempVAddr <= MAX_VIRTUAL_ADDR)
-                {
-                    return ((offset / PAGE_SIZE) % PAGE_SIZE); 
-                }
-                else
-                {
-                    offset -= (change / 2u);
-                }
-            }
-            else
-            {
-                return PAGE_START;
-            }
-        }
-    }
-
-    return _emuEepromFindAvailablePage(offset, (change / 2u));
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Calculate CRC for header.
-    @param info - Header struct to calculate CRC from.
-    @return CRC value.
-*///-----------------------------------------------------------------------------
-uint16_t _emuEepromHeaderCrc(header_info_t info)
-{
-    uint16_t crc = 0xCECE; 
-
-    return crc;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Calculate CRC for page.
-    @param *pBuffer - Buffer to page data to calculate CRC from.
-    @return CRC value.
-*///-----------------------------------------------------------------------------
-uint16_t _emuEepromPageCrc(uint8_t *pBuffer)
-{
-    uint16_t crc = 0xBEEF;
-
-    return crc;
+/*
+* emueeprom.c
+* 
+* Notes:
+* - Must used consectitive blocks.
+*
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <emueeprom.h>
+
+#define HEADER_SIZE PAGE_SIZE
+#define PAGES_PER_BLOCK (BLOCK_SIZE / PAGE_SIZE)
+#define DATA_PAGES_PER_BLOCK (PAGES_PER_BLOCK - 1u)
+
+#define BLOCK_DATA_OFFSET HEADER_SIZE
+
+#define BITS_PER_BYTE 8u
+#define ERASED 0xFF
+#define ERASED_WORD 0xFFFF
+#define ERASED_COUNT 0xFFFFFFFF
+
+// page buffer
+#define VADDR_OFFSET 0u
+#define SIZE_OFFSET 2u
+#define DATA_OFFSET 4u
+#define PAGE_CRC_OFFSET (PAGE_SIZE - CRC_SIZE)
+#define MAX_ENTRIES_PER_PAGE (PAGE_CRC_OFFSET / INFO_SIZE)
+
+// entry size flags
+#define ENTRY_SIZE_MASK 0x0FFF
+#define ENTRY_CONTROL 0x4000 // marker entry, the virtual address holds the marker
+#define ENTRY_TX 0x8000 // only visible if followed by a commit marker
+
+#define MARKER_TX_BEGIN 0x0000
+#define MARKER_TX_COMMIT 0x0001
+
+#define VIRTUAL_ADDR_BITS (MAX_VIRTUAL_ADDR / BITS_PER_BYTE)
+// Header
+#define SUMMARY_GRANULE 8u // bytes of virtual address per summary filter bit
+#define SUMMARY_BITS 32u
+#define SUMMARY_MAX_GRANULES 16u // wider lookups are not filtered
+
+#define HEAT_GRANULE 16u // bytes of virtual address sharing an update age
+#define HEAT_GRANULES (MAX_VIRTUAL_ADDR / HEAT_GRANULE)
+#define COLD_MIN_FREE (PAGES_PER_BLOCK / 4u) // pages kept free in the cold block for demotions
+
+#define BLOCK_KIND_HOT 0xFFFF // log written by the application, left erased
+#define BLOCK_KIND_COLD 0xC01D // data demoted by transfers
+
+#define HEADER_FORMAT 0x0001 // page and header CRCs are CRC16
+#define LEGACY_PAGE_CRC 0xBEEF // constant page CRC of blocks written before HEADER_FORMAT
+#define LEGACY_HEADER_CRC 0xCECE
+
+#define UNIQUE_ID 0xBEEF
+#define RETIRED_ID 0x0000 // programmed over the unique ID of a block left for erase-ahead
+#define INIT_CRC 0xFFFF
+
+#define BUFFER_START 0x0000
+#define PAGE_START 0x0001
+#define TRANSFER_START 0x0000
+#define TRANSFER_END 0xEEEE
+#define SCAN_IN_RAM 0xFFFFFFFF
+
+#define DIRECT_MIN_PAGES 2u // whole pages of a write worth building and programming at once
+#define DIRECT_MAX_PAGES ((MAX_VIRTUAL_ADDR / MAX_DATA_PER_PAGE) + 1u)
+
+#define SHARE_MAGIC 0x53484D45 // "EMHS"
+#define SHARE_RETRIES 1000u // attempts of a shared read before giving up on a busy writer
+
+#define SCRUB_BATCH 8u // most pages verified per hold of the engine lock
+#define SCRUB_BURST 16u // pages of budget kept while nothing is verified
+#define SCRUB_MAX_WAIT_US 100000u // longest sleep of the scrub worker
+#define US_PER_SEC 1000000u
+
+#define UPDATE_PIECE_BYTES 16u // an update may leave a value in one more piece per this many bytes
+#define UPDATE_MAX_PAGES 4u // pages a lookup may parse before the value is written whole, closer to the front
+#define UPDATE_MAX_RUNS ((MAX_VIRTUAL_ADDR / (INFO_SIZE + 1u)) + 1u)
+
+typedef struct {
+    uint16_t uniqueId; // user specific identifier
+    uint16_t blockNum; // block number starting at 0
+    uint16_t blockTotal; // total number of blocks used for emulated EEPROM
+    uint16_t transferCount;
+    uint16_t crc; // CRC16 of the header, erase count left out
+    uint16_t kind; // BLOCK_KIND_HOT or BLOCK_KIND_COLD
+    uint32_t eraseCount; // programmed right after the block is erased
+    uint16_t format; // HEADER_FORMAT, erased in blocks of the legacy format
+    uint16_t reserved; // left erased
+} header_info_t;
+
+#if (BLOCK_COUNT < 2u) || ((BLOCK_START_ADDR + (BLOCK_COUNT * BLOCK_SIZE)) > FLASH_SIZE)
+    #error Invalid BLOCK_COUNT.
+#endif
+
+typedef enum {
+    block_start = 0,
+    block_1 = 0,
+    block_2,
+    block_total = BLOCK_COUNT,
+    block_error
+} blocks_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t buffLen;
+    void *pBuffer;
+    uint8_t *pBitmap; // bytes already found, relative to vAddr
+    uint16_t numFound; // bytes found, including erased
+    uint16_t numRead; // bytes of data copied to pBuffer
+    uint8_t *pValid; // bytes holding data, relative to vAddr, can be NULL
+} read_context_t;
+
+typedef struct {
+    bool cold; // demote entries that have not been updated lately
+    bool keepErased; // erased entries still shadow data in the cold block
+    uint8_t *pBitmap; // addresses already transferred
+    ssize_t count;
+    uint16_t droppedPage; // newest page holding an entry left out of the new block, 0 if none
+} transfer_context_t;
+
+typedef struct {
+    uint8_t buffer[TX_BUFFER_SIZE]; // records held until commit, stored as entries
+    uint16_t bufferPos;
+    bool open;
+} tx_info_t;
+
+typedef enum {
+    async_write = 0,
+    async_flush
+} async_op_t;
+
+typedef struct {
+    async_op_t op;
+    uint16_t vAddr;
+    uint16_t buffLen;
+    uint8_t *pData; // copy of the caller's data
+    emueeprom_callback_t callback;
+    void *pContext;
+    uint32_t ticket;
+} async_request_t;
+
+typedef struct {
+    async_request_t queue[ASYNC_QUEUE_DEPTH];
+    uint16_t head;
+    uint16_t count;
+    uint32_t nextTicket;
+    uint32_t doneTicket;
+    bool running;
+    bool idleWork; // reclaimed blocks to erase once the queue is empty
+    pthread_t worker;
+    pthread_mutex_t lock; // taken after m_lock when both are needed
+    pthread_cond_t changed;
+} async_info_t;
+
+typedef struct {
+    emueeprom_durability_t mode;
+    uint32_t windowUs;
+    uint16_t windowFlushes;
+    uint16_t pending; // flushes and commits since the last sync
+    uint64_t pendingSinceUs; // time of the oldest one not yet synced
+} durable_info_t;
+
+typedef struct {
+    uint8_t *pBlock[BLOCK_COUNT]; // RAM copy of each held block, NULL if not held
+    uint8_t slots; // blocks the memory budget allows
+    uint8_t held;
+} cache_info_t;
+
+typedef struct {
+    uint16_t minVAddr;
+    uint16_t maxVAddr; // last address covered
+    uint32_t filter; // Bloom filter of the address granules covered
+} page_summary_t;
+
+typedef struct {
+    uint8_t lastWrite[HEAT_GRANULES]; // generation of the last write to each granule
+    uint8_t generation; // counts transfers
+    uint8_t hotGenerations; // transfers without a write before data is cold, 0 is off
+    blocks_t block; // cold block, block_error if none
+    uint16_t currPage;
+    uint16_t bufferPos;
+    uint16_t compactCount; // header transfer count of the cold block
+    bool formatted; // header written
+    uint8_t pageBuffer[PAGE_SIZE];
+} cold_info_t;
+
+typedef struct {
+    uint8_t pages[PAGE_BUFFER_COUNT * PAGE_SIZE]; // flushed pages not programmed yet, in page order
+    uint32_t offset; // flash offset of the first page
+    uint16_t count;
+    uint16_t depth; // pages held before the ring is programmed
+} page_ring_t;
+
+typedef struct {
+    uint32_t offset; // flash offset of the page being scanned, SCAN_IN_RAM if not on flash
+    uint8_t const *pPage; // copy of it handed to the visitor
+} scan_page_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t len;
+    uint32_t offset; // flash offset of the range, SCAN_IN_RAM if not in one entry on flash
+} view_context_t;
+
+typedef struct {
+    uint16_t pins[BLOCK_COUNT]; // views held into each block
+    bool stale[BLOCK_COUNT]; // erase waiting for the last view to be released
+    uint16_t held;
+} view_info_t;
+
+typedef struct {
+    bool ahead; // reclaimed blocks are retired and erased later, when idle
+    bool reclaimed[BLOCK_COUNT]; // retired, the erase is still owed
+    bool blank[BLOCK_COUNT]; // known to be erased, no blank check needed
+} erase_info_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t len; // 0 once the range needs no more pages
+} scan_range_t;
+
+typedef struct {
+    emueeprom_req_t *pReqs; // copy of the requests sorted by virtual address
+    size_t numReqs;
+    uint16_t maxLen; // longest request
+    scan_range_t *pSpans; // requests merged, for finding the ones an entry touches
+    scan_range_t *pRanges; // same spans, len cleared once every byte is found
+    uint16_t *pRemaining; // bytes of each span not found yet
+    uint16_t numSpans; // spans never touch, so at most MAX_VIRTUAL_ADDR / 2 whatever numReqs is
+    uint16_t openSpans;
+    uint8_t *pBitmap; // addresses found, shared by all requests
+    ssize_t numRead;
+} multi_context_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t size; // with its flags
+    uint16_t page;
+    uint16_t offset;
+    bool visible; // data entry, committed if part of a transaction
+} change_entry_t;
+
+typedef struct {
+    bool valid; // a transfer happened since mounting
+    emueeprom_cursor_t last; // block the last transfer left, only its identity is used
+    uint16_t droppedPage; // cursors at or before this page of it miss an entry
+    emueeprom_cursor_t first; // first entry of the block it made
+} feed_info_t;
+
+typedef struct {
+    uint16_t vAddr;
+    uint16_t buffLen;
+    uint16_t numFound; // bytes found, including erased
+    uint16_t entries; // entries visited so far
+    uint32_t pages; // flushed pages the lookup parsed
+    uint8_t found[VIRTUAL_ADDR_BITS]; // bytes already found, relative to vAddr
+    uint8_t current[MAX_VIRTUAL_ADDR]; // current value, relative to vAddr
+    uint16_t piece[MAX_VIRTUAL_ADDR]; // entry holding each byte, 0 if none or rewritten
+    uint16_t runs[UPDATE_MAX_RUNS][2]; // start and end of the runs to write
+} update_info_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation; // odd while the writer changes what readers can see
+    uint16_t currPage; // pages programmed in the current block
+    uint16_t coldPage;
+    uint8_t currBlock;
+    uint8_t coldBlock; // block_error if there is none
+} share_meta_t;
+
+typedef struct {
+    share_meta_t *pMeta; // in the mapping shared by every process using the image
+    uint8_t const *pImage; // mapped flash, set in readers
+    bool writer;
+    uint16_t depth; // nested changes, published when the outermost one ends
+    uint16_t programmed[BLOCK_COUNT]; // pages of each block that reached flash
+} share_info_t;
+
+typedef struct {
+    bool enabled;
+    uint16_t lag; // pages held back, 0 copies in the same call
+    uint16_t count;
+    uint32_t offsets[MIRROR_MAX_LAG]; // pages programmed but not copied yet, in program order
+    uint8_t pages[MIRROR_MAX_LAG][PAGE_SIZE];
+} mirror_info_t;
+
+typedef struct {
+    uint32_t pagesPerSec; // budget, 0 is off
+    bool relocate; // move live data off a block once a corrupt page is found in it
+    emueeprom_corrupt_t corrupt;
+    void *pContext;
+    blocks_t block; // next page verified
+    uint16_t page;
+    uint64_t credit; // budget built up, US_PER_SEC per page
+    uint64_t lastUs;
+    bool running;
+    pthread_t worker;
+    pthread_mutex_t lock; // taken without m_lock
+    pthread_cond_t changed;
+} scrub_info_t;
+
+#ifdef EMUEEPROM_METRICS
+typedef struct {
+    emueeprom_latency_t latency[op_total];
+    emueeprom_trace_t trace; // called at the start and end of each call, NULL if none
+    void *pTraceContext;
+    pthread_mutex_t lock; // taken last, after m_lock when both are held
+} metrics_info_t;
+
+#define TRACE_BEGIN(op, vAddr, len, pData) uint64_t traceStartNs = _emuEepromTraceBegin((op), (vAddr), (len), (pData))
+#define TRACE_END(op, vAddr, len, pData, result) _emuEepromTraceEnd((op), traceStartNs, (vAddr), (len), (pData), (result))
+#else
+#define TRACE_BEGIN(op, vAddr, len, pData)
+#define TRACE_END(op, vAddr, len, pData, result)
+#endif
+
+// return true to stop the scan
+typedef bool (*entry_visitor_t)(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+
+ssize_t _emuEepromFlush(void);
+ssize_t _emuEepromDurable(bool force);
+ssize_t _emuEepromDurableDue(void);
+uint64_t _emuEepromNowUs(void);
+#ifdef EMUEEPROM_METRICS
+uint64_t _emuEepromNowNs(void);
+uint64_t _emuEepromTraceBegin(emueeprom_op_t op, uint16_t vAddr, uint16_t len, void const *pData);
+void _emuEepromTraceEnd(emueeprom_op_t op, uint64_t startNs, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result);
+#endif
+ssize_t _emuEepromTxCommit(void);
+ssize_t _emuEepromAsyncPush(async_op_t op, uint16_t vAddr, void const *pBuffer, uint16_t buffLen, emueeprom_callback_t callback, void *pContext);
+void _emuEepromAsyncDrain(void);
+bool _emuEepromAsyncRead(read_context_t *pRead);
+void *_emuEepromAsyncWorker(void *pArg);
+void _emuEepromSyncDone(ssize_t result, void *pContext);
+ssize_t _emuEepromBufferWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen, uint16_t flags);
+ssize_t _emuEepromUpdateScan(uint16_t vAddr, uint16_t buffLen);
+ssize_t _emuEepromUpdateRuns(uint8_t const *pData);
+bool _emuEepromUpdateEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+ssize_t _emuEepromDirectWrite(uint16_t vAddr, uint8_t const *pData, uint16_t pages, uint16_t flags);
+uint16_t _emuEepromPagesNeeded(uint16_t *pBufferPos, uint16_t buffLen);
+ssize_t _emuEepromTxAppend(uint16_t vAddr, void const *pBuffer, uint16_t buffLen);
+uint16_t _emuEepromTxPages(void);
+uint16_t _emuEepromImportPages(uint8_t const *pValid);
+ssize_t _emuEepromImport(uint8_t const *pImage, uint8_t const *pValid);
+uint16_t _emuEepromPageEntries(uint8_t const *pPage, uint16_t *pEntries);
+bool _emuEepromPageScan(uint8_t const *pPage, bool *pCommitted, entry_visitor_t visitor, void *pContext);
+ssize_t _emuEepromBlockScan(blocks_t block, uint16_t lastPage, bool verify, scan_range_t const *pRanges, uint16_t numRanges, bool *pCommitted, entry_visitor_t visitor, void *pContext);
+ssize_t _emuEepromScan(scan_range_t const *pRanges, uint16_t numRanges, entry_visitor_t visitor, void *pContext);
+void _emuEepromPageSummary(uint8_t const *pPage, page_summary_t *pSummary);
+bool _emuEepromPageMayHold(page_summary_t const *pSummary, uint16_t vAddr, uint16_t len);
+uint32_t _emuEepromSummaryBits(uint16_t granule);
+void _emuEepromSummaryBuild(void);
+ssize_t _emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen);
+ssize_t _emuEepromReadRange(uint16_t vAddr, void *pBuffer, uint16_t buffLen, uint8_t *pValid);
+bool _emuEepromReadEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+bool _emuEepromViewEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+bool _emuEepromMultiEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+int _emuEepromReqCompare(void const *pLeft, void const *pRight);
+bool _emuEepromTransferEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+void _emuEepromTransferDropped(transfer_context_t *pTransfer);
+ssize_t _emuEepromBlockTransfer(void);
+void _emuEepromSetBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap);
+uint8_t _emuEepromReadBit(uint16_t startAddr, uint16_t vAddr, uint8_t const *pBitmap);
+ssize_t _emuEepromBlockFormat(blocks_t block, header_info_t header);
+void _emuEepromBlockErase(blocks_t block);
+void _emuEepromBlockErased(blocks_t block);
+void _emuEepromBlockPrepare(blocks_t block);
+void _emuEepromBlockReclaim(blocks_t block);
+ssize_t _emuEepromIdleErase(void);
+bool _emuEepromBlockBlank(blocks_t block);
+blocks_t _emuEepromNextBlock(blocks_t currBlock);
+void _emuEepromLoadWear(void);
+blocks_t _emuEepromActiveBlock(header_info_t *pHeader, uint16_t kind);
+uint16_t _emuEepromCurrentPage(blocks_t block);
+bool _emuEepromPageErased(blocks_t block, uint16_t page);
+ssize_t _emuEepromFlashRead(uint32_t offset, void *pBuff, size_t numBytes);
+ssize_t _emuEepromFlashWrite(uint32_t offset, void const *pBuff, size_t numBytes);
+ssize_t _emuEepromRingPush(uint32_t offset, uint8_t const *pPage);
+ssize_t _emuEepromRingDrain(void);
+void _emuEepromCacheHold(blocks_t block);
+void _emuEepromCacheMount(void);
+void _emuEepromHeat(uint16_t vAddr, uint16_t len);
+bool _emuEepromIsCold(uint16_t vAddr, uint16_t len);
+void _emuEepromAge(void);
+ssize_t _emuEepromColdPrepare(void);
+ssize_t _emuEepromColdOpen(void);
+ssize_t _emuEepromColdCompact(void);
+bool _emuEepromColdAppend(uint16_t vAddr, uint8_t const *pData, uint16_t len);
+ssize_t _emuEepromColdFlush(void);
+ssize_t _emuEepromColdFormat(void);
+bool _emuEepromColdCopyEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext);
+uint16_t _emuEepromHeaderCrc(header_info_t info);
+uint16_t _emuEepromPageCrc(uint8_t const *pBuffer);
+bool _emuEepromPageCrcValid(uint8_t const *pBuffer, bool legacy);
+bool _emuEepromBlockLegacy(blocks_t block);
+void _emuEepromCursor(emueeprom_cursor_t *pCursor);
+ssize_t _emuEepromLogPage(uint16_t page, uint8_t *pPage);
+ssize_t _emuEepromChanges(emueeprom_cursor_t *pCursor, emueeprom_cursor_t const *pEnd, emueeprom_change_t change, void *pContext);
+void _emuEepromShareBegin(void);
+void _emuEepromShareEnd(void);
+void _emuEepromShareProgrammed(uint32_t offset, size_t numBytes);
+void _emuEepromMirrorProgrammed(uint32_t offset, void const *pBuff, size_t numBytes);
+void _emuEepromMirrorErased(blocks_t block);
+ssize_t _emuEepromMirrorCopy(void);
+ssize_t _emuEepromMirrorSync(void);
+ssize_t _emuEepromScrubStep(void);
+int _emuEepromScrubPage(blocks_t block, uint16_t page);
+uint16_t _emuEepromScrubLimit(blocks_t block);
+void *_emuEepromScrubWorker(void *pArg);
+uint16_t _emuEepromCrc(uint16_t crc, void const *pData, size_t numBytes);
+
+static emueeprom_info_t m_info;
+static bool m_init = false;
+static uint32_t m_eraseCount[BLOCK_COUNT];
+static tx_info_t m_tx;
+static durable_info_t m_durable = {.mode = durable_none};
+static cache_info_t m_cache;
+static emueeprom_stats_t m_stats;
+static page_summary_t m_summary[PAGES_PER_BLOCK]; // pages of the current block
+static cold_info_t m_cold = {.block = block_error};
+static page_ring_t m_ring = {.depth = 1u}; // pages flushed but still in RAM
+static scan_page_t m_scanPage = {.offset = SCAN_IN_RAM};
+static view_info_t m_view;
+static erase_info_t m_erase;
+static share_info_t m_share;
+static mirror_info_t m_mirror;
+static scrub_info_t m_scrub = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+static feed_info_t m_feed;
+static update_info_t m_update; // used under m_lock, too big for the stack
+#ifdef EMUEEPROM_METRICS
+static metrics_info_t m_metrics = {.lock = PTHREAD_MUTEX_INITIALIZER};
+#endif
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER; // engine state, held by every public call
+static async_info_t m_async = {
+    .nextTicket = 1u,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+
+/*!------------------------------------------------------------------------------
+    @brief Initializes emulated EEPROM.
+    @param File descriptor from flash module.
+    @return File descriptor or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+void emuEepromInit(void)
+{
+    assert(!m_init);
+
+    header_info_t header;
+
+    _emuEepromLoadWear();
+    m_info.currBlock = _emuEepromActiveBlock(&header, BLOCK_KIND_HOT);
+    m_cold.block = (m_info.currBlock == block_error) ? block_error : _emuEepromActiveBlock(&header, BLOCK_KIND_COLD);
+    memset(m_cold.lastWrite, m_cold.generation, sizeof(m_cold.lastWrite));
+    memset(m_erase.reclaimed, 0, sizeof(m_erase.reclaimed));
+    memset(m_erase.blank, 0, sizeof(m_erase.blank));
+
+    // any other block still in use is left over from an interrupted transfer or retired
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        if((block != m_info.currBlock) && (block != m_cold.block))
+        {
+            if(_emuEepromBlockBlank(block))
+            {
+                m_erase.blank[block] = true;
+            }
+            else
+            {
+                _emuEepromBlockErase(block);
+            }
+        }
+    }
+
+    if(m_info.currBlock == block_error)
+    {
+        m_info.currBlock = _emuEepromNextBlock(block_error);
+        _emuEepromCacheMount();
+        header.uniqueId = UNIQUE_ID;
+        header.blockNum = m_info.currBlock;
+        header.blockTotal = block_total;
+        header.transferCount = TRANSFER_START;
+        header.kind = BLOCK_KIND_HOT;
+        _emuEepromBlockFormat(m_info.currBlock, header);
+        m_info.currPage = PAGE_START;
+        m_info.bufferPos = BUFFER_START;
+        printf("Emulated EEPROM created.\n");
+    }
+    else
+    {
+        printf("Emulated EEPROM found.\n");
+        _emuEepromCacheMount();
+        m_info.currPage = _emuEepromCurrentPage(m_info.currBlock);
+        m_info.bufferPos = BUFFER_START;
+        _emuEepromSummaryBuild();
+        if(m_cold.block != block_error)
+        {
+            _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * m_cold.block), &header, sizeof(header));
+            m_cold.compactCount = header.transferCount;
+            m_cold.currPage = _emuEepromCurrentPage(m_cold.block);
+            m_cold.bufferPos = BUFFER_START;
+            m_cold.formatted = true;
+            memset(m_cold.pageBuffer, ERASED, PAGE_SIZE);
+        }
+
+        printf("Using block %d of %d.\nCurrent page: %d\n", m_info.currBlock + 1u, block_total, m_info.currPage);
+    }
+
+    memset(m_info.pageBuffer, ERASED, PAGE_SIZE);
+    
+    m_init = true;
+
+    // block was filled but the transfer never started
+    if(m_info.currPage >= PAGES_PER_BLOCK)
+    {
+        _emuEepromBlockTransfer();
+    }
+
+    // a mirror set up before the mount misses the pages an earlier process held back
+    if(m_mirror.enabled && (_emuEepromMirrorSync() < 0))
+    {
+        printf("Error bringing the mirror up to date.\n");
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase blocks containing emulated EEPROM.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromDestroy(void)
+{
+    assert(m_init);
+    assert(!m_async.running);
+    assert(!m_scrub.running);
+    assert(!m_view.held);
+
+    // the whole partition in one erase, then the new counts
+    _emuEepromShareBegin();
+    _emuEepromRingDrain();
+    flashBlockErase(block_start, block_total);
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        _emuEepromBlockErased(block);
+    }
+
+    m_cold.block = block_error;
+    m_feed.valid = false;
+    _emuEepromShareEnd();
+    m_init = false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Current info about emulated EEPROM.
+    @param *pInfo - Pointer to the infomation.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromInfo(emueeprom_info_t *pInfo)
+{
+    pthread_mutex_lock(&m_lock);
+    memcpy(pInfo->pageBuffer, m_info.pageBuffer, PAGE_SIZE);
+    pInfo->bufferPos = m_info.bufferPos;
+    pInfo->currPage = m_info.currPage;
+    pInfo->currBlock = m_info.currBlock;
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase count of each block used by the emulated EEPROM.
+    @param *pWear - Pointer to the wear report.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromWear(emueeprom_wear_t *pWear)
+{
+    pthread_mutex_lock(&m_lock);
+    pWear->minCount = ERASED_COUNT;
+    pWear->maxCount = 0u;
+
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        pWear->eraseCount[block] = m_eraseCount[block];
+        if(m_eraseCount[block] < pWear->minCount)
+        {
+            pWear->minCount = m_eraseCount[block];
+        }
+
+        if(m_eraseCount[block] > pWear->maxCount)
+        {
+            pWear->maxCount = m_eraseCount[block];
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write data to emulated EEPROM.
+    @param vAddr - Virtual address associated with the data being written.
+    @param *pBuffer - Buffer of data to be written.
+    @param buffLen - Amount of bytes being written.
+    @return Amount of bytes written to emulated EEPROM or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    ssize_t count = 0;
+    TRACE_BEGIN(op_write, vAddr, buffLen, pBuffer);
+
+    // queued writes go first to keep the order
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(m_tx.open)
+    {
+        count = _emuEepromTxAppend(vAddr, pBuffer, buffLen);
+    }
+    else
+    {
+        count = _emuEepromBufferWrite(vAddr, pBuffer, buffLen, 0u);
+        _emuEepromHeat(vAddr, buffLen);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_write, vAddr, buffLen, pBuffer, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write data to emulated EEPROM, logging only the bytes that differ from
+    what it holds. Runs of changed bytes closer than an entry header are joined, so
+    no more is logged than by emuEepromWrite. A transfer copies each piece of a value
+    as its own entry, so once the value would be split in too many pieces all of it
+    is written instead. In a transaction it writes all of it, the staged data is not
+    visible to the compare.
+    @param vAddr - Virtual address associated with the data being written.
+    @param *pBuffer - Buffer of data to be written.
+    @param buffLen - Amount of bytes being written.
+    @return Amount of bytes written to emulated EEPROM, 0 if nothing changed, or
+    negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromUpdate(uint16_t vAddr, void const *pBuffer, uint16_t buffLen)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    ssize_t count = 0;
+    TRACE_BEGIN(op_update, vAddr, buffLen, pBuffer);
+
+    // queued writes go first to keep the order
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(m_tx.open)
+    {
+        count = _emuEepromTxAppend(vAddr, pBuffer, buffLen);
+    }
+    else
+    {
+        count = _emuEepromUpdateScan(vAddr, buffLen);
+        if(count >= 0)
+        {
+            count = _emuEepromUpdateRuns(pBuffer);
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_update, vAddr, buffLen, pBuffer, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Compare and swap, write the desired value only if the address holds the
+    expected one, with a single lookup under the engine lock. Only the bytes that
+    change are logged, as by emuEepromUpdate.
+    @param vAddr - Virtual address of the value.
+    @param *pExpected - Value it must hold, erased or unwritten bytes never match.
+    @param *pDesired - Value to write.
+    @param len - Amount of bytes of each.
+    @return 1 if swapped, 0 if it held another value, negative if error occured or
+    a transaction is open, the staged data is not visible to the compare.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromCas(uint16_t vAddr, void const *pExpected, void const *pDesired, uint16_t len)
+{
+    assert(m_init);
+    assert(len > 0);
+    assert((vAddr + len) <= MAX_VIRTUAL_ADDR);
+
+    ssize_t count = -1;
+    TRACE_BEGIN(op_cas, vAddr, len, ((void const *[2]){pExpected, pDesired}));
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(!m_tx.open)
+    {
+        count = _emuEepromUpdateScan(vAddr, len);
+    }
+
+    if(count >= 0)
+    {
+        bool same = (memcmp(m_update.current, pExpected, len) == 0);
+        for(uint16_t i = 0; (i < len) && same; i++)
+        {
+            same = (m_update.piece[i] != 0u);
+        }
+
+        if(same)
+        {
+            count = _emuEepromUpdateRuns(pDesired);
+            count = (count < 0) ? count : 1;
+        }
+        else
+        {
+            m_stats.casFailed++;
+            count = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_cas, vAddr, len, ((void const *[2]){pExpected, pDesired}), count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Add to a 4 byte counter with a single lookup under the engine lock. A
+    counter never written, or erased, starts at 0. Only the low bytes that change are
+    logged, an increment usually logs a single byte.
+    @param vAddr - Virtual address of the counter.
+    @param delta - Amount to add, the counter wraps around.
+    @param *pValue - Set to the new value, can be NULL.
+    @return Amount of bytes written or negative if error occured or a transaction is
+    open, the staged data is not visible to the lookup.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromAdd(uint16_t vAddr, int32_t delta, uint32_t *pValue)
+{
+    assert(m_init);
+    assert((vAddr + sizeof(uint32_t)) <= MAX_VIRTUAL_ADDR);
+
+    ssize_t count = -1;
+    uint32_t value = 0;
+    TRACE_BEGIN(op_add, vAddr, sizeof(value), &delta);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(!m_tx.open)
+    {
+        count = _emuEepromUpdateScan(vAddr, sizeof(value));
+    }
+
+    if(count >= 0)
+    {
+        uint8_t bytes[sizeof(value)];
+        for(uint16_t i = 0; i < sizeof(value); i++)
+        {
+            bytes[i] = m_update.piece[i] ? m_update.current[i] : 0u;
+        }
+
+        memcpy(&value, bytes, sizeof(value));
+        value += (uint32_t)delta;
+        count = _emuEepromUpdateRuns((uint8_t const *)&value);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    if((count >= 0) && (pValue != NULL))
+    {
+        *pValue = value;
+    }
+
+    TRACE_END(op_add, vAddr, sizeof(value), &delta, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read data back from the emulated EEPROM.
+    @param vAddr - Virtual address of data to read.
+    @param *pBuffer - Buffer to store read data.
+    @param buffLen - Amount of bytes read.
+    @return Amount of bytes read or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    TRACE_BEGIN(op_read, vAddr, buffLen, NULL);
+    ssize_t count = _emuEepromRead(vAddr, pBuffer, buffLen);
+    TRACE_END(op_read, vAddr, buffLen, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read data back from the emulated EEPROM, untraced.
+    @param vAddr - Virtual address of data to read.
+    @param *pBuffer - Buffer to store read data.
+    @param buffLen - Amount of bytes read.
+    @return Amount of bytes read or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen)
+{
+    ssize_t count = 0;
+    read_context_t read;
+
+    read.vAddr = vAddr;
+    read.buffLen = buffLen;
+    read.pBuffer = pBuffer;
+    read.numFound = 0;
+    read.numRead = 0;
+    read.pValid = NULL;
+    read.pBitmap = calloc((buffLen + BITS_PER_BYTE - 1u) / BITS_PER_BYTE, sizeof(uint8_t));
+
+    if(read.pBitmap != NULL)
+    {
+        pthread_mutex_lock(&m_lock);
+        if(!_emuEepromAsyncRead(&read))
+        {
+            scan_range_t range = {.vAddr = vAddr, .len = buffLen};
+            count = _emuEepromScan(&range, 1u, _emuEepromReadEntry, &read);
+        }
+
+        pthread_mutex_unlock(&m_lock);
+        if(count >= 0)
+        {
+            count = read.numRead;
+        }
+
+        free(read.pBitmap);
+        read.pBitmap = NULL;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read every live address of a range in a single pass over the block.
+    @param vAddr - Virtual address to start reading from.
+    @param *pBuffer - Buffer to store the image of the range.
+    @param buffLen - Amount of bytes in the range.
+    @param *pValid - Bitmap of bytes that hold data, (buffLen + 7) / 8 bytes. Bit
+    (addr - vAddr) is set if the address was written and not erased.
+    @return Amount of bytes holding data or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromReadRange(uint16_t vAddr, void *pBuffer, uint16_t buffLen, uint8_t *pValid)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    TRACE_BEGIN(op_read_range, vAddr, buffLen, NULL);
+    ssize_t count = _emuEepromReadRange(vAddr, pBuffer, buffLen, pValid);
+    TRACE_END(op_read_range, vAddr, buffLen, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read every live address of a range in a single pass, untraced.
+    @param vAddr - Virtual address to start reading from.
+    @param *pBuffer - Buffer to store the image of the range.
+    @param buffLen - Amount of bytes in the range.
+    @param *pValid - Bitmap of bytes that hold data, (buffLen + 7) / 8 bytes.
+    @return Amount of bytes holding data or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromReadRange(uint16_t vAddr, void *pBuffer, uint16_t buffLen, uint8_t *pValid)
+{
+    uint8_t found[VIRTUAL_ADDR_BITS] = {0};
+    ssize_t count = 0;
+    read_context_t read;
+
+    memset(pValid, 0, (buffLen + BITS_PER_BYTE - 1u) / BITS_PER_BYTE);
+    read.vAddr = vAddr;
+    read.buffLen = buffLen;
+    read.pBuffer = pBuffer;
+    read.numFound = 0;
+    read.numRead = 0;
+    read.pValid = pValid;
+    read.pBitmap = found;
+
+    pthread_mutex_lock(&m_lock);
+    if(!_emuEepromAsyncRead(&read))
+    {
+        scan_range_t range = {.vAddr = vAddr, .len = buffLen};
+        count = _emuEepromScan(&range, 1u, _emuEepromReadEntry, &read);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    if(count >= 0)
+    {
+        count = read.numRead;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Replace the contents with an image, packed into the fewest pages of a
+    fresh block. Unflushed writes are dropped, the old block stays active until the
+    new one is complete.
+    @param *pImage - Image of MAX_VIRTUAL_ADDR bytes.
+    @param *pValid - Bitmap of MAX_VIRTUAL_ADDR / 8 bytes, a bit is set for each
+    address to store.
+    @return Amount of bytes imported or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromImport(void const *pImage, uint8_t const *pValid)
+{
+    assert(m_init);
+
+    ssize_t count = -1;
+    TRACE_BEGIN(op_import, 0u, 0u, ((void const *[2]){pImage, pValid}));
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(!m_tx.open && (_emuEepromImportPages(pValid) < DATA_PAGES_PER_BLOCK))
+    {
+        _emuEepromShareBegin();
+        m_feed.valid = false;
+        count = _emuEepromImport(pImage, pValid);
+        if((count >= 0) && ((_emuEepromRingDrain() < 0) || (_emuEepromDurable(true) < 0)))
+        {
+            count = -1;
+        }
+
+        _emuEepromShareEnd();
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_import, 0u, 0u, ((void const *[2]){pImage, pValid}), count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Separate rarely updated data from the rest. At each transfer, data not
+    written for hotGenerations transfers is moved to a cold block instead of being
+    copied again, so transfers mostly copy hot data. The cold block is compacted on
+    its own when it runs low on pages. Needs at least 3 blocks.
+    @param hotGenerations - Transfers without a write before data is cold, 0 turns
+    it off and folds the cold block back in at the next transfer.
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromHotCold(uint8_t hotGenerations)
+{
+    ssize_t result = -1;
+
+    if(BLOCK_COUNT >= 3u)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_cold.hotGenerations = hotGenerations;
+        pthread_mutex_unlock(&m_lock);
+        result = 0;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read without copying. If the range is stored in one entry on flash, the
+    view points at it in mapped flash and holds its block, so a transfer or cold
+    compaction leaves that block unerased until the view is released. Otherwise the
+    range is copied as emuEepromRead would.
+    @param vAddr - Virtual address of data to read.
+    @param buffLen - Amount of bytes to read.
+    @param *pView - The view, must be given to emuEepromReleaseView.
+    @return Amount of bytes read or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromReadView(uint16_t vAddr, uint16_t buffLen, emueeprom_view_t *pView)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    view_context_t find = {.vAddr = vAddr, .len = buffLen, .offset = SCAN_IN_RAM};
+    ssize_t count = -1;
+    TRACE_BEGIN(op_read_view, vAddr, buffLen, NULL);
+
+    pView->pData = NULL;
+    pView->len = 0;
+    pView->block = BLOCK_COUNT;
+
+    _emuEepromAsyncDrain();
+    scan_range_t range = {.vAddr = vAddr, .len = buffLen};
+    pthread_mutex_lock(&m_lock);
+    if((_emuEepromScan(&range, 1u, _emuEepromViewEntry, &find) >= 0) && (find.offset != SCAN_IN_RAM))
+    {
+        // a page still in the ring is not on flash yet
+        bool held = ((find.offset >= m_ring.offset) && (find.offset < (m_ring.offset + (m_ring.count * PAGE_SIZE))));
+        if(!held || (_emuEepromRingDrain() >= 0))
+        {
+            pView->pData = flashMap(find.offset, buffLen);
+        }
+
+        if(pView->pData != NULL)
+        {
+            pView->block = (find.offset - BLOCK_START_ADDR) / BLOCK_SIZE;
+            pView->len = buffLen;
+            m_view.pins[pView->block]++;
+            m_view.held++;
+            m_stats.viewsInPlace++;
+            count = buffLen;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    if(pView->pData == NULL)
+    {
+        uint8_t *pCopy = malloc(buffLen);
+        if(pCopy != NULL)
+        {
+            count = _emuEepromRead(vAddr, pCopy, buffLen);
+            if(count >= 0)
+            {
+                pView->pData = pCopy;
+                pView->len = count;
+                pthread_mutex_lock(&m_lock);
+                m_stats.viewsCopied++;
+                pthread_mutex_unlock(&m_lock);
+            }
+            else
+            {
+                free(pCopy);
+            }
+        }
+    }
+
+    TRACE_END(op_read_view, vAddr, buffLen, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Release a view. The last view into a block lets an erase held back by
+    it go ahead.
+    @param *pView - The view from emuEepromReadView.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromReleaseView(emueeprom_view_t *pView)
+{
+    if(pView->block < BLOCK_COUNT)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_view.pins[pView->block]--;
+        m_view.held--;
+        if(!m_view.pins[pView->block] && m_view.stale[pView->block])
+        {
+            m_view.stale[pView->block] = false;
+            _emuEepromBlockErase(pView->block);
+        }
+
+        pthread_mutex_unlock(&m_lock);
+    }
+    else
+    {
+        free((void *)pView->pData);
+    }
+
+    pView->pData = NULL;
+    pView->len = 0;
+    pView->block = BLOCK_COUNT;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read the whole emulated EEPROM in a single pass over the block.
+    @param *pBuffer - Buffer of MAX_VIRTUAL_ADDR bytes to store the image.
+    @param *pValid - Bitmap of MAX_VIRTUAL_ADDR / 8 bytes, a bit is set for each
+    address holding data.
+    @return Amount of bytes holding data or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromReadAll(void *pBuffer, uint8_t *pValid)
+{
+    assert(m_init);
+
+    TRACE_BEGIN(op_read_all, 0u, MAX_VIRTUAL_ADDR, NULL);
+    ssize_t count = _emuEepromReadRange(0u, pBuffer, MAX_VIRTUAL_ADDR, pValid);
+    TRACE_END(op_read_all, 0u, MAX_VIRTUAL_ADDR, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read many ranges in one pass over the block. The ranges are sorted and
+    merged, a page is only read if it may hold one still missing, and each page is
+    read at most once.
+    @param *pReqs - Ranges to read, each with its own buffer and optional bitmap.
+    @param numReqs - Amount of requests.
+    @return Amount of bytes holding data over all requests or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromReadMulti(emueeprom_req_t const *pReqs, size_t numReqs)
+{
+    assert(m_init);
+
+    uint8_t found[VIRTUAL_ADDR_BITS] = {0};
+    multi_context_t multi = {.numReqs = numReqs, .pBitmap = found};
+    ssize_t count = (numReqs > 0u) ? -1 : 0;
+    TRACE_BEGIN(op_read_multi, 0u, 0u, ((void const *[2]){pReqs, &numReqs}));
+
+    if(numReqs > 0u)
+    {
+        multi.pReqs = malloc(numReqs * sizeof(emueeprom_req_t));
+        multi.pSpans = malloc(numReqs * sizeof(scan_range_t));
+        multi.pRanges = malloc(numReqs * sizeof(scan_range_t));
+        multi.pRemaining = malloc(numReqs * sizeof(uint16_t));
+    }
+
+    if((multi.pReqs != NULL) && (multi.pSpans != NULL) && (multi.pRanges != NULL) && (multi.pRemaining != NULL))
+    {
+        memcpy(multi.pReqs, pReqs, numReqs * sizeof(emueeprom_req_t));
+        qsort(multi.pReqs, numReqs, sizeof(emueeprom_req_t), _emuEepromReqCompare);
+
+        // overlapping and touching requests are merged into one span
+        for(size_t i = 0; i < numReqs; i++)
+        {
+            emueeprom_req_t const *pReq = &multi.pReqs[i];
+            scan_range_t *pLast = multi.numSpans ? &multi.pSpans[multi.numSpans - 1u] : NULL;
+
+            assert((pReq->len > 0) && ((pReq->vAddr + pReq->len) <= MAX_VIRTUAL_ADDR));
+            multi.maxLen = (pReq->len > multi.maxLen) ? pReq->len : multi.maxLen;
+            if(pReq->pValid != NULL)
+            {
+                memset(pReq->pValid, 0, (pReq->len + BITS_PER_BYTE - 1u) / BITS_PER_BYTE);
+            }
+
+            if((pLast != NULL) && (pReq->vAddr <= (pLast->vAddr + pLast->len)))
+            {
+                if((pReq->vAddr + pReq->len) > (pLast->vAddr + pLast->len))
+                {
+                    pLast->len = (pReq->vAddr + pReq->len) - pLast->vAddr;
+                }
+            }
+            else
+            {
+                multi.pSpans[multi.numSpans].vAddr = pReq->vAddr;
+                multi.pSpans[multi.numSpans].len = pReq->len;
+                multi.numSpans++;
+            }
+        }
+
+        for(uint16_t i = 0; i < multi.numSpans; i++)
+        {
+            multi.pRanges[i] = multi.pSpans[i];
+            multi.pRemaining[i] = multi.pSpans[i].len;
+        }
+
+        multi.openSpans = multi.numSpans;
+
+        _emuEepromAsyncDrain();
+        pthread_mutex_lock(&m_lock);
+        count = _emuEepromScan(multi.pRanges, multi.numSpans, _emuEepromMultiEntry, &multi);
+        pthread_mutex_unlock(&m_lock);
+        if(count >= 0)
+        {
+            count = multi.numRead;
+        }
+    }
+
+    free(multi.pReqs);
+    free(multi.pSpans);
+    free(multi.pRanges);
+    free(multi.pRemaining);
+    TRACE_END(op_read_multi, 0u, 0u, ((void const *[2]){pReqs, &numReqs}), count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Removes data related to virtual address from emulated EEPROM.
+    @param vAddr - Virtual address of data to be erased.
+    @param buffLen - Amount of data to erase.
+    @return INFO_SIZE if successful or negative if failed.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromErase(uint16_t vAddr, uint16_t dataLen)
+{
+    assert(m_init);
+    assert((vAddr + dataLen) <= MAX_VIRTUAL_ADDR);
+    ssize_t count = 0;
+    TRACE_BEGIN(op_erase, vAddr, dataLen, NULL);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    for(uint16_t i = vAddr; i < (vAddr + dataLen); i++)
+    {
+        if(m_tx.open)
+        {
+            count = _emuEepromTxAppend(i, NULL, 0);
+        }
+        else
+        {
+            count = _emuEepromBufferWrite(i, NULL, 0, 0u);
+            _emuEepromHeat(i, 1u);
+        }
+
+        if(count < 0)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_erase, vAddr, dataLen, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write the current page buffer to flash.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromFlush(void)
+{
+    assert(m_init);
+    TRACE_BEGIN(op_flush, 0u, 0u, NULL);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    ssize_t count = _emuEepromFlush();
+    if((count >= 0) && ((_emuEepromRingDrain() < 0) || (_emuEepromDurable(false) < 0)))
+    {
+        count = -1;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_flush, 0u, 0u, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start the background worker. Writes made with emuEepromWriteAsync are
+    queued and page programs, transfers and erases are done by the worker.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromAsyncStart(void)
+{
+    assert(m_init);
+
+    ssize_t result = -1;
+
+    pthread_mutex_lock(&m_async.lock);
+    if(!m_async.running)
+    {
+        m_async.running = true;
+        if(pthread_create(&m_async.worker, NULL, _emuEepromAsyncWorker, NULL) == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            m_async.running = false;
+        }
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Finish all queued requests and stop the background worker.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromAsyncStop(void)
+{
+    pthread_mutex_lock(&m_async.lock);
+    bool running = m_async.running;
+    m_async.running = false;
+    pthread_cond_broadcast(&m_async.changed);
+    pthread_mutex_unlock(&m_async.lock);
+
+    if(running)
+    {
+        pthread_join(m_async.worker, NULL);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Queue a write. Returns once the data is copied, reads see it right away.
+    @param vAddr - Virtual address associated with the data being written.
+    @param *pBuffer - Buffer of data to be written.
+    @param buffLen - Amount of bytes being written.
+    @param callback - Called from the worker with the result of the write, can be NULL.
+    Must not call any emuEeprom function other than emuEepromRead.
+    @param *pContext - Passed to the callback.
+    @return Ticket to wait on or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromWriteAsync(uint16_t vAddr, void const *pBuffer, uint16_t buffLen, emueeprom_callback_t callback, void *pContext)
+{
+    assert(m_init);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    TRACE_BEGIN(op_write_async, vAddr, buffLen, pBuffer);
+    ssize_t ticket = _emuEepromAsyncPush(async_write, vAddr, pBuffer, buffLen, callback, pContext);
+    TRACE_END(op_write_async, vAddr, buffLen, pBuffer, ticket);
+
+    return ticket;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait until a queued request has been done.
+    @param ticket - Ticket returned when the request was queued.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromWait(uint32_t ticket)
+{
+    pthread_mutex_lock(&m_async.lock);
+    while(m_async.doneTicket < ticket)
+    {
+        pthread_cond_wait(&m_async.changed, &m_async.lock);
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait for all queued writes, then flush the page buffer and program the
+    page ring to flash. Anything a group commit is still holding is synced as well.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromSync(void)
+{
+    assert(m_init);
+
+    ssize_t result = 0;
+    TRACE_BEGIN(op_sync, 0u, 0u, NULL);
+    ssize_t ticket = _emuEepromAsyncPush(async_flush, 0u, NULL, 0u, _emuEepromSyncDone, &result);
+    if(ticket > 0)
+    {
+        emuEepromWait(ticket);
+    }
+    else
+    {
+        pthread_mutex_lock(&m_lock);
+        result = _emuEepromFlush();
+        if((result >= 0) && ((_emuEepromRingDrain() < 0) || (_emuEepromDurable(true) < 0)))
+        {
+            result = -1;
+        }
+
+        pthread_mutex_unlock(&m_lock);
+    }
+
+    TRACE_END(op_sync, 0u, 0u, NULL, result);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set when flushed pages are made durable with fdatasync. Group commit syncs
+    once windowFlushes flushes or commits are waiting, or when the oldest waiting one
+    is windowUs old. The window is checked on each flush and by emuEepromIdle,
+    emuEepromSync closes it.
+    @param mode - Durability level.
+    @param windowUs - Longest a group commit waits, in microseconds.
+    @param windowFlushes - Most flushes and commits in one group commit.
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromDurability(emueeprom_durability_t mode, uint32_t windowUs, uint16_t windowFlushes)
+{
+    assert(m_init);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+
+    // nothing the old mode is holding may be lost by the switch
+    ssize_t result = _emuEepromDurable(true);
+    if((result >= 0) && ((mode == durable_dsync) != (m_durable.mode == durable_dsync)))
+    {
+        result = flashSetSyncWrites(mode == durable_dsync);
+    }
+
+    if(result >= 0)
+    {
+        m_durable.mode = mode;
+        m_durable.windowUs = windowUs;
+        m_durable.windowFlushes = windowFlushes;
+        m_durable.pending = 0;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set the RAM budget of the block cache. The active block is cached if the
+    budget holds one block, the whole partition if it holds all of them. Reads,
+    lookups and transfers then parse RAM, writes go to both.
+    @param budget - Bytes of RAM the cache may use, 0 turns it off.
+    @return Bytes of RAM used by the cache.
+*///-----------------------------------------------------------------------------
+uint32_t emuEepromCache(uint32_t budget)
+{
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+
+    m_cache.slots = ((budget / BLOCK_SIZE) < BLOCK_COUNT) ? (budget / BLOCK_SIZE) : BLOCK_COUNT;
+    if(m_init)
+    {
+        _emuEepromCacheMount();
+    }
+
+    uint32_t cacheBytes = m_cache.held * BLOCK_SIZE;
+    pthread_mutex_unlock(&m_lock);
+
+    return cacheBytes;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set how many flushed pages are held before they are programmed together.
+    Staging goes on in the next page while earlier ones wait, and a full ring is one
+    flash write. Held pages are programmed early by anything that has to follow them
+    on flash, by emuEepromFlush and by syncs.
+    @param count - Pages held, 1 to PAGE_BUFFER_COUNT. 1, the default, programs each
+    page on flush.
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromPageBuffers(uint16_t count)
+{
+    ssize_t result = -1;
+
+    if((count > 0u) && (count <= PAGE_BUFFER_COUNT))
+    {
+        _emuEepromAsyncDrain();
+        pthread_mutex_lock(&m_lock);
+        result = _emuEepromRingDrain();
+        if(result >= 0)
+        {
+            m_ring.depth = count;
+            result = 0;
+        }
+
+        pthread_mutex_unlock(&m_lock);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Turn erase-ahead on or off. When on, a block given up by a transfer is
+    retired instead of erased and emuEepromIdle, or the async worker while its queue
+    is empty, erases it before it is needed again. Turning it off erases what is owed.
+    @param enable - Non-zero to erase ahead.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromEraseAhead(int enable)
+{
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    m_erase.ahead = (enable != 0);
+    while(!m_erase.ahead && (_emuEepromIdleErase() > 0))
+    {
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Idle hook, syncs a group commit whose window ran out, or else erases one
+    block retired by erase-ahead, or else copies the pages the mirror lags behind by,
+    or else verifies what the scrub budget allows. Call it until it returns 0 to have
+    every reclaimed block blank before the next transfer and the mirror up to date.
+    @param None
+    @return 1 if a group was synced, a block erased, pages mirrored or verified, 0 if
+    nothing is owed, negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromIdle(void)
+{
+    assert(m_init);
+
+    pthread_mutex_lock(&m_lock);
+    ssize_t result = _emuEepromDurableDue();
+    if(result == 0)
+    {
+        result = _emuEepromIdleErase();
+    }
+
+    if((result == 0) && m_mirror.count)
+    {
+        result = (_emuEepromMirrorCopy() < 0) ? -1 : 1;
+    }
+
+    if((result == 0) && m_scrub.pagesPerSec)
+    {
+        result = _emuEepromScrubStep();
+        result = (result > 0) ? 1 : result;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Position right after the newest entry, queued writes included. Taken
+    before a full read, it is where emuEepromChangesSince picks up from.
+    @param *pCursor - Where to store the position.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromCursor(emueeprom_cursor_t *pCursor)
+{
+    assert(m_init);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    _emuEepromCursor(pCursor);
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pass each entry written after a cursor to a callback, oldest first, straight
+    from the log, then move the cursor past them. Transaction records are only passed
+    once committed. A cursor into the block the last transfer left is moved to the
+    start of the current block, so every value the transfer copied is passed again,
+    unless an entry written after the cursor was dropped or demoted to the cold block
+    by it. Any older cursor, and any
+    cursor after a restart, import or destroy, is stale: read everything again with
+    emuEepromReadAll after taking a new cursor with emuEepromCursor.
+    @param *pCursor - Cursor from emuEepromCursor or a previous call, updated.
+    @param change - Called with each entry under the engine lock, must not call the
+    engine, returns non-zero to stop. The cursor then points after that entry.
+    @param *pContext - Passed to the callback.
+    @return Amount of entries passed, CURSOR_STALE or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromChangesSince(emueeprom_cursor_t *pCursor, emueeprom_change_t change, void *pContext)
+{
+    assert(m_init);
+
+    emueeprom_cursor_t from = *pCursor;
+    emueeprom_cursor_t end;
+    ssize_t count = CURSOR_STALE;
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    _emuEepromCursor(&end);
+    if(m_feed.valid && (from.eraseCount == m_feed.last.eraseCount) && (from.transferCount == m_feed.last.transferCount) && 
+        (from.page > m_feed.droppedPage))
+    {
+        from = m_feed.first;
+    }
+
+    uint32_t fromPos = (from.page * PAGE_SIZE) + from.offset;
+    uint32_t endPos = (end.page * PAGE_SIZE) + end.offset;
+    if((from.eraseCount == end.eraseCount) && (from.transferCount == end.transferCount) && 
+        (from.page >= PAGE_START) && (fromPos <= endPos))
+    {
+        count = _emuEepromChanges(&from, &end, change, pContext);
+        if(count >= 0)
+        {
+            *pCursor = from;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy every page programmed, transfers included, to a mirror flash, in the
+    same call or held back by a few pages. Enabling it, and mounting while it is
+    enabled, first copies only the pages the mirror differs on. Disabling it copies
+    the pages held back. Called before emuEepromInit it only sets up mirroring for
+    the mount, so a new process brings back pages an earlier one held.
+    @param enable - Non-zero to mirror, 0 to stop.
+    @param lag - Pages the mirror may trail by, up to MIRROR_MAX_LAG. They are held
+    in RAM and copied together, emuEepromIdle catches the mirror up.
+    @return Amount of divergent pages copied or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromMirror(int enable, uint16_t lag)
+{
+    ssize_t count = 0;
+
+    if(lag > MIRROR_MAX_LAG)
+    {
+        return -1;
+    }
+
+    // nothing is mounted yet, emuEepromInit does the resync
+    if(!m_init)
+    {
+        if(enable && (flashMirrorInit() < 0))
+        {
+            return -1;
+        }
+
+        m_mirror.enabled = (enable != 0);
+        m_mirror.lag = lag;
+        m_mirror.count = 0;
+
+        return 0;
+    }
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    if(!enable)
+    {
+        count = _emuEepromMirrorCopy();
+        m_mirror.enabled = false;
+    }
+    else if(!m_mirror.enabled)
+    {
+        count = (flashMirrorInit() < 0) ? -1 : _emuEepromRingDrain();
+        if(count >= 0)
+        {
+            m_mirror.lag = lag;
+            count = _emuEepromMirrorSync();
+            m_mirror.enabled = (count >= 0);
+        }
+    }
+    else
+    {
+        m_mirror.lag = lag;
+        count = (m_mirror.count > lag) ? _emuEepromMirrorCopy() : 0;
+        count = (count < 0) ? count : 0;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set up the scrubber, which verifies the header and page CRCs of the blocks
+    in use, one block after the other, to catch corrupt pages before a transfer drops
+    them. It runs from emuEepromIdle or from its own thread, see emuEepromScrubStart,
+    and never verifies more pages than the budget allows.
+    @param pagesPerSec - Budget in pages verified per second, 0 turns it off.
+    @param relocate - Non-zero to move the live data off a block as soon as a corrupt
+    page is found in it, by a transfer or a compaction of the cold block.
+    @param corrupt - Called for each corrupt page under the engine lock, must not call
+    the engine, NULL for none. A page is reported again each pass until relocated.
+    @param *pContext - Passed to the callback.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromScrub(uint32_t pagesPerSec, int relocate, emueeprom_corrupt_t corrupt, void *pContext)
+{
+    assert(m_init);
+
+    pthread_mutex_lock(&m_lock);
+    m_scrub.pagesPerSec = pagesPerSec;
+    m_scrub.relocate = (relocate != 0);
+    m_scrub.corrupt = corrupt;
+    m_scrub.pContext = pContext;
+    m_scrub.credit = 0;
+    m_scrub.lastUs = _emuEepromNowUs();
+    pthread_mutex_unlock(&m_lock);
+
+    pthread_mutex_lock(&m_scrub.lock);
+    pthread_cond_broadcast(&m_scrub.changed);
+    pthread_mutex_unlock(&m_scrub.lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start the scrub worker, which verifies pages as the budget set with
+    emuEepromScrub builds up, a few per hold of the engine lock.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromScrubStart(void)
+{
+    assert(m_init);
+
+    ssize_t result = -1;
+
+    pthread_mutex_lock(&m_scrub.lock);
+    if(!m_scrub.running)
+    {
+        m_scrub.running = true;
+        if(pthread_create(&m_scrub.worker, NULL, _emuEepromScrubWorker, NULL) == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            m_scrub.running = false;
+        }
+    }
+
+    pthread_mutex_unlock(&m_scrub.lock);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Stop the scrub worker.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromScrubStop(void)
+{
+    pthread_mutex_lock(&m_scrub.lock);
+    bool running = m_scrub.running;
+    m_scrub.running = false;
+    pthread_cond_broadcast(&m_scrub.changed);
+    pthread_mutex_unlock(&m_scrub.lock);
+
+    if(running)
+    {
+        pthread_join(m_scrub.worker, NULL);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Take the writer role of an image shared with other processes, in place of
+    emuEepromInit. Only one process holds it, readers in other processes look values
+    up with emuEepromShareRead. Every change that reaches flash is published to them.
+    @param wait - Non-zero to wait for the current writer to let go.
+    @return 0 if successful or -1 if another process is the writer or an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromShareWriter(int wait)
+{
+    share_meta_t *pMeta = flashShared(sizeof(share_meta_t));
+
+    if((pMeta == NULL) || (flashLock(wait) < 0))
+    {
+        return -1;
+    }
+
+    // the previous writer may have changed anything, so mount only now
+    if(!m_init)
+    {
+        emuEepromInit();
+    }
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    _emuEepromRingDrain();
+    memset(m_share.programmed, 0, sizeof(m_share.programmed));
+    m_share.programmed[m_info.currBlock] = m_info.currPage;
+    if(m_cold.block < block_total)
+    {
+        m_share.programmed[m_cold.block] = m_cold.currPage;
+    }
+
+    m_share.pMeta = pMeta;
+    m_share.pImage = NULL;
+    m_share.writer = true;
+    m_share.depth = 0;
+    pMeta->magic = SHARE_MAGIC;
+    _emuEepromShareBegin();
+    _emuEepromShareEnd();
+    pthread_mutex_unlock(&m_lock);
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Flush and give up the writer role. The engine must not be used to write
+    again unless the role is taken back before any other process took it.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromShareRelease(void)
+{
+    if(!m_share.writer)
+    {
+        return -1;
+    }
+
+    ssize_t result = emuEepromFlush();
+
+    pthread_mutex_lock(&m_lock);
+    m_share.writer = false;
+    pthread_mutex_unlock(&m_lock);
+    flashUnlock();
+
+    return (result < 0) ? result : 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Attach to an image written by another process. The engine is not mounted,
+    values are read with emuEepromShareRead straight from the mapped image.
+    @param None
+    @return 0 if successful or -1 if no writer has published the image yet.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromShareAttach(void)
+{
+    share_meta_t *pMeta = flashShared(sizeof(share_meta_t));
+    uint8_t const *pImage = flashMap(0, FLASH_SIZE);
+
+    if((pMeta == NULL) || (pImage == NULL) || (__atomic_load_n(&pMeta->magic, __ATOMIC_ACQUIRE) != SHARE_MAGIC))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_share.pMeta = pMeta;
+    m_share.pImage = pImage;
+    m_share.writer = false;
+    pthread_mutex_unlock(&m_lock);
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read from a shared image without asking the writer. Values show up once
+    the writer has flushed them. If the writer publishes while the read is running,
+    which the generation tells, the read starts over.
+    @param vAddr - Virtual address of data to read.
+    @param *pBuffer - Buffer to store read data.
+    @param buffLen - Amount of bytes read.
+    @return Amount of bytes read or negative number if error occured or the writer
+    kept changing the image.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromShareRead(uint16_t vAddr, void *pBuffer, uint16_t buffLen)
+{
+    assert(m_share.pImage != NULL);
+    assert(buffLen > 0);
+    assert((vAddr + buffLen) <= MAX_VIRTUAL_ADDR);
+
+    uint8_t bitmap[VIRTUAL_ADDR_BITS];
+    share_meta_t *pMeta = m_share.pMeta;
+    read_context_t read = {.vAddr = vAddr, .buffLen = buffLen, .pBuffer = pBuffer, .pBitmap = bitmap, .pValid = NULL};
+    ssize_t count = -1;
+
+    pthread_mutex_lock(&m_lock);
+    for(uint32_t attempt = 0; attempt < SHARE_RETRIES; attempt++)
+    {
+        uint32_t generation = __atomic_load_n(&pMeta->generation, __ATOMIC_SEQ_CST);
+        if(generation & 1u)
+        {
+            m_stats.shareRetries++;
+            sched_yield();
+            continue;
+        }
+
+        blocks_t block = __atomic_load_n(&pMeta->currBlock, __ATOMIC_RELAXED);
+        uint16_t currPage = __atomic_load_n(&pMeta->currPage, __ATOMIC_RELAXED);
+        blocks_t coldBlock = __atomic_load_n(&pMeta->coldBlock, __ATOMIC_RELAXED);
+        uint16_t coldPage = __atomic_load_n(&pMeta->coldPage, __ATOMIC_RELAXED);
+        bool committed = false;
+        ssize_t result = 0;
+
+        memset(bitmap, 0, (buffLen + BITS_PER_BYTE - 1u) / BITS_PER_BYTE);
+        read.numFound = 0;
+        read.numRead = 0;
+        if((block < block_total) && (currPage > PAGE_START) && (currPage <= PAGES_PER_BLOCK))
+        {
+            result = _emuEepromBlockScan(block, currPage - 1u, false, NULL, 0u, &committed, _emuEepromReadEntry, &read);
+        }
+
+        if((result == 0) && (coldBlock < block_total) && (coldPage > PAGE_START) && (coldPage <= PAGES_PER_BLOCK))
+        {
+            committed = false;
+            result = _emuEepromBlockScan(coldBlock, coldPage - 1u, false, NULL, 0u, &committed, _emuEepromReadEntry, &read);
+        }
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&pMeta->generation, __ATOMIC_RELAXED) == generation)
+        {
+            count = (result < 0) ? result : read.numRead;
+            break;
+        }
+
+        m_stats.shareRetries++;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Generation of a shared image, it changes whenever the writer publishes.
+    Readers caching values can compare it to know when to read again.
+    @param None
+    @return The generation, 0 if not sharing.
+*///-----------------------------------------------------------------------------
+uint32_t emuEepromShareGeneration(void)
+{
+    if(m_share.pMeta == NULL)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&m_share.pMeta->generation, __ATOMIC_SEQ_CST);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Get the cache and flash read statistics.
+    @param *pStats - Where to store the statistics.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromStats(emueeprom_stats_t *pStats)
+{
+    pthread_mutex_lock(&m_lock);
+    *pStats = m_stats;
+    pStats->cacheBytes = m_cache.held * BLOCK_SIZE;
+    pStats->summaryBytes = sizeof(m_summary);
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Clear the statistics.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromStatsReset(void)
+{
+    pthread_mutex_lock(&m_lock);
+    memset(&m_stats, 0, sizeof(m_stats));
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+#ifdef EMUEEPROM_METRICS
+/*!------------------------------------------------------------------------------
+    @brief Latency histogram of an operation since the last reset.
+    @param op - The operation.
+    @param *pLatency - Where to copy the histogram.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromLatency(emueeprom_op_t op, emueeprom_latency_t *pLatency)
+{
+    assert(op < op_total);
+
+    pthread_mutex_lock(&m_metrics.lock);
+    *pLatency = m_metrics.latency[op];
+    pthread_mutex_unlock(&m_metrics.lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Latency under which a share of the calls completed, e.g. 990 for p99.
+    Resolution is the power of two bucket the quantile falls in, capped at the max.
+    @param *pLatency - Histogram from emuEepromLatency.
+    @param perMille - Share of the calls, 0 to 1000.
+    @return Latency in nanoseconds, 0 if there were no calls.
+*///-----------------------------------------------------------------------------
+uint64_t emuEepromLatencyQuantile(emueeprom_latency_t const *pLatency, uint16_t perMille)
+{
+    uint64_t rank = (((uint64_t)pLatency->count * perMille) + 999u) / 1000u;
+    uint64_t seen = 0;
+
+    for(uint16_t i = 0; (i < LATENCY_BUCKETS) && pLatency->count; i++)
+    {
+        seen += pLatency->buckets[i];
+        if((seen >= rank) && seen)
+        {
+            uint64_t bound = (i < (LATENCY_BUCKETS - 1u)) ? (2ull << i) : pLatency->maxNs;
+            return (bound < pLatency->maxNs) ? bound : pLatency->maxNs;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Clear the latency histograms.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromLatencyReset(void)
+{
+    pthread_mutex_lock(&m_metrics.lock);
+    memset(m_metrics.latency, 0, sizeof(m_metrics.latency));
+    pthread_mutex_unlock(&m_metrics.lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Print the latency of each operation, in microseconds.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromLatencyDump(void)
+{
+    char const *pNames[op_total] = {"write", "read", "erase", "flush", "update", "cas", "add", "tx begin", "tx commit",
+        "tx abort", "async", "sync", "range", "read all", "multi", "view", "import", "transfer"};
+
+    printf("%10s %10s %10s %10s %10s %10s %10s\n", "op", "calls", "mean us", "p50 us", "p99 us", "p999 us", "max us");
+    for(emueeprom_op_t op = op_write; op < op_total; op++)
+    {
+        emueeprom_latency_t latency;
+        emuEepromLatency(op, &latency);
+        printf("%10s %10u %10.2f %10.2f %10.2f %10.2f %10.2f\n", pNames[op], latency.count, 
+            latency.count ? ((latency.totalNs / 1000.0) / latency.count) : 0.0, 
+            emuEepromLatencyQuantile(&latency, 500u) / 1000.0, emuEepromLatencyQuantile(&latency, 990u) / 1000.0, 
+            emuEepromLatencyQuantile(&latency, 999u) / 1000.0, latency.maxNs / 1000.0);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set the trace hook, called at the start and end of every public call that
+    reads or changes the contents, and of every transfer. pData is the data of a
+    write, update or async write, a void const *[2] of the expected and desired value
+    for op_cas, and the int32_t delta for op_add. op_read_multi gets a void const *[2]
+    of the requests and their size_t count, op_import one of the image and validity
+    bitmap. It is NULL otherwise. Transfers are traced with the engine locked, so the
+    hook must not call back into the emulated EEPROM.
+    @param trace - The hook, NULL to stop tracing.
+    @param *pContext - Passed to the hook.
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromTrace(emueeprom_trace_t trace, void *pContext)
+{
+    pthread_mutex_lock(&m_metrics.lock);
+    m_metrics.trace = trace;
+    m_metrics.pTraceContext = pContext;
+    pthread_mutex_unlock(&m_metrics.lock);
+}
+#endif
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write the current page buffer to flash.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromFlush(void)
+{
+    assert(m_info.currBlock < block_total);
+    assert(m_info.currPage  < PAGES_PER_BLOCK);
+
+    ssize_t count = 0;
+
+    if(m_info.bufferPos != BUFFER_START)
+    {
+        // calculate the CRC for the page, store, then write to flash
+        _emuEepromPageSummary(m_info.pageBuffer, &m_summary[m_info.currPage]);
+        uint32_t currOffset = BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (m_info.currPage * PAGE_SIZE);
+        uint16_t calcCrc = _emuEepromPageCrc(m_info.pageBuffer);
+        memcpy(&m_info.pageBuffer[PAGE_CRC_OFFSET], &calcCrc, sizeof(calcCrc));
+        count = _emuEepromRingPush(currOffset, m_info.pageBuffer);
+        if(count > 0)
+        {
+            // reset info for page
+            m_info.bufferPos = BUFFER_START;
+            m_info.currPage++;
+            memset(m_info.pageBuffer, ERASED, PAGE_SIZE);
+            // if last page has been written to, initialize a block transfer
+            if(m_info.currPage >= PAGES_PER_BLOCK)
+            {
+                count = _emuEepromBlockTransfer();
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Make flushed pages durable as the durability mode asks. Called after each
+    flush or commit, force syncs anything a group commit is holding.
+    @param force - Sync now in both the flush and group commit modes.
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromDurable(bool force)
+{
+    ssize_t result = 0;
+    bool sync = false;
+
+    if(m_durable.mode == durable_flush)
+    {
+        sync = true;
+    }
+    else if(m_durable.mode == durable_group)
+    {
+        uint64_t now = _emuEepromNowUs();
+        if(m_durable.pending == 0)
+        {
+            m_durable.pendingSinceUs = now;
+        }
+
+        m_durable.pending++;
+        sync = (force || (m_durable.pending >= m_durable.windowFlushes) || 
+            ((now - m_durable.pendingSinceUs) >= m_durable.windowUs));
+    }
+
+    // pages still in the ring are not programmed yet, let alone durable
+    if(sync || (m_durable.mode == durable_dsync))
+    {
+        result = _emuEepromRingDrain();
+    }
+
+    if(sync && (result >= 0))
+    {
+        result = flashSync();
+        m_durable.pending = 0;
+        m_stats.syncs++;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Close a group commit whose window ran out with no flush or commit after
+    it to notice.
+    @param None
+    @return 1 if the group was synced, 0 if none is due, negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromDurableDue(void)
+{
+    ssize_t result = 0;
+
+    if((m_durable.mode == durable_group) && m_durable.pending && 
+        ((_emuEepromNowUs() - m_durable.pendingSinceUs) >= m_durable.windowUs))
+    {
+        result = _emuEepromRingDrain();
+        if(result >= 0)
+        {
+            result = flashSync();
+            m_durable.pending = 0;
+            m_stats.syncs++;
+            m_stats.windowSyncs++;
+        }
+
+        result = (result < 0) ? -1 : 1;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Monotonic time for the group commit window.
+    @param None
+    @return Time in microseconds.
+*///-----------------------------------------------------------------------------
+uint64_t _emuEepromNowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000u) + (now.tv_nsec / 1000u);
+}
+
+
+#ifdef EMUEEPROM_METRICS
+/*!------------------------------------------------------------------------------
+    @brief Monotonic time in nanoseconds.
+    @param None
+    @return Current time.
+*///-----------------------------------------------------------------------------
+uint64_t _emuEepromNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000u) + now.tv_nsec;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start timing a call and tell the trace hook.
+    @param op - The operation.
+    @param vAddr - Virtual address of the call, 0 if it has none.
+    @param len - Length of the call, 0 if it has none.
+    @param *pData - Data written, NULL for other calls.
+    @return Start time to hand to _emuEepromTraceEnd.
+*///-----------------------------------------------------------------------------
+uint64_t _emuEepromTraceBegin(emueeprom_op_t op, uint16_t vAddr, uint16_t len, void const *pData)
+{
+    pthread_mutex_lock(&m_metrics.lock);
+    emueeprom_trace_t trace = m_metrics.trace;
+    void *pContext = m_metrics.pTraceContext;
+    pthread_mutex_unlock(&m_metrics.lock);
+
+    if(trace != NULL)
+    {
+        trace(op, 0, vAddr, len, pData, 0, pContext);
+    }
+
+    return _emuEepromNowNs();
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Add the time a call took to its histogram and tell the trace hook.
+    @param op - The operation.
+    @param startNs - Time from _emuEepromTraceBegin.
+    @param vAddr - Virtual address of the call, 0 if it has none.
+    @param len - Length of the call, 0 if it has none.
+    @param *pData - Data written, NULL for other calls.
+    @param result - What the call returns.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromTraceEnd(emueeprom_op_t op, uint64_t startNs, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result)
+{
+    uint64_t elapsedNs = _emuEepromNowNs() - startNs;
+    uint16_t bucket = 0;
+
+    // log2 bucket, bucket i holds [2^i, 2^(i + 1)) ns
+    while(((elapsedNs >> 1u) >> bucket) && (bucket < (LATENCY_BUCKETS - 1u)))
+    {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&m_metrics.lock);
+    emueeprom_latency_t *pLatency = &m_metrics.latency[op];
+    pLatency->count++;
+    pLatency->totalNs += elapsedNs;
+    pLatency->buckets[bucket]++;
+    if(elapsedNs > pLatency->maxNs)
+    {
+        pLatency->maxNs = elapsedNs;
+    }
+
+    emueeprom_trace_t trace = m_metrics.trace;
+    void *pContext = m_metrics.pTraceContext;
+    pthread_mutex_unlock(&m_metrics.lock);
+
+    if(trace != NULL)
+    {
+        trace(op, 1, vAddr, len, pData, result, pContext);
+    }
+}
+#endif
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start a transaction. Writes and erases are held until committed.
+    @param None
+    @return 0 if successful or negative if a transaction is already open.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromTxBegin(void)
+{
+    assert(m_init);
+
+    ssize_t result = -1;
+    TRACE_BEGIN(op_tx_begin, 0u, 0u, NULL);
+
+    pthread_mutex_lock(&m_lock);
+    if(!m_tx.open)
+    {
+        m_tx.open = true;
+        m_tx.bufferPos = 0;
+        result = 0;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_tx_begin, 0u, 0u, NULL, result);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write all records of the transaction, made visible by a single commit entry.
+    @param None
+    @return Amount of bytes committed or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t emuEepromTxCommit(void)
+{
+    assert(m_init);
+    TRACE_BEGIN(op_tx_commit, 0u, 0u, NULL);
+
+    _emuEepromAsyncDrain();
+    pthread_mutex_lock(&m_lock);
+    ssize_t count = _emuEepromTxCommit();
+    if((count >= 0) && (_emuEepromDurable(false) < 0))
+    {
+        count = -1;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_tx_commit, 0u, 0u, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Drop all records of the open transaction.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void emuEepromTxAbort(void)
+{
+    TRACE_BEGIN(op_tx_abort, 0u, 0u, NULL);
+
+    pthread_mutex_lock(&m_lock);
+    m_tx.open = false;
+    m_tx.bufferPos = 0;
+    pthread_mutex_unlock(&m_lock);
+    TRACE_END(op_tx_abort, 0u, 0u, NULL, 0);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write the records of the open transaction between a begin and commit marker.
+    @param None
+    @return Amount of bytes committed or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromTxCommit(void)
+{
+    ssize_t count = 0;
+    uint16_t dataCount = 0;
+
+    if(!m_tx.open)
+    {
+        return -1;
+    }
+
+    m_tx.open = false;
+    if(m_tx.bufferPos == 0)
+    {
+        return 0;
+    }
+
+    // the whole group must land in the current block, a transfer in between would drop it
+    if(_emuEepromTxPages() > (PAGES_PER_BLOCK - m_info.currPage))
+    {
+        count = _emuEepromFlush();
+        if((count >= 0) && (_emuEepromTxPages() > (PAGES_PER_BLOCK - m_info.currPage)))
+        {
+            count = _emuEepromBlockTransfer();
+        }
+
+        if((count < 0) || (_emuEepromTxPages() > (PAGES_PER_BLOCK - m_info.currPage)))
+        {
+            return -1;
+        }
+    }
+
+    count = _emuEepromBufferWrite(MARKER_TX_BEGIN, NULL, 0, ENTRY_CONTROL);
+    for(uint16_t i = 0; (count >= 0) && (i < m_tx.bufferPos);)
+    {
+        uint16_t entryVAddr, entrySize;
+        memcpy(&entryVAddr, &m_tx.buffer[i + VADDR_OFFSET], sizeof(entryVAddr));
+        memcpy(&entrySize, &m_tx.buffer[i + SIZE_OFFSET], sizeof(entrySize));
+
+        count = _emuEepromBufferWrite(entryVAddr, &m_tx.buffer[i + DATA_OFFSET], entrySize, ENTRY_TX);
+        _emuEepromHeat(entryVAddr, (entrySize == 0) ? 1u : entrySize);
+        dataCount += entrySize;
+        i += (INFO_SIZE + entrySize);
+    }
+
+    if(count >= 0)
+    {
+        count = _emuEepromBufferWrite(MARKER_TX_COMMIT, NULL, 0, ENTRY_CONTROL);
+    }
+
+    if(count >= 0)
+    {
+        count = _emuEepromFlush();
+    }
+
+    m_tx.bufferPos = 0;
+
+    return (count < 0) ? count : dataCount;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Add a request to the async queue, waiting if it is full.
+    @param op - Type of request.
+    @param vAddr - Virtual address of the data.
+    @param *pBuffer - Data to copy into the request.
+    @param buffLen - Amount of data (in bytes).
+    @param callback - Called from the worker once done, can be NULL.
+    @param *pContext - Passed to the callback.
+    @return Ticket of the request or negative if the worker is not running.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromAsyncPush(async_op_t op, uint16_t vAddr, void const *pBuffer, uint16_t buffLen, emueeprom_callback_t callback, void *pContext)
+{
+    ssize_t ticket = -1;
+    uint8_t *pData = NULL;
+
+    if(buffLen)
+    {
+        pData = malloc(buffLen);
+        if(pData == NULL)
+        {
+            return -1;
+        }
+
+        memcpy(pData, pBuffer, buffLen);
+    }
+
+    pthread_mutex_lock(&m_async.lock);
+    while(m_async.running && (m_async.count == ASYNC_QUEUE_DEPTH))
+    {
+        pthread_cond_wait(&m_async.changed, &m_async.lock);
+    }
+
+    if(m_async.running)
+    {
+        async_request_t *pRequest = &m_async.queue[(m_async.head + m_async.count) % ASYNC_QUEUE_DEPTH];
+        pRequest->op = op;
+        pRequest->vAddr = vAddr;
+        pRequest->buffLen = buffLen;
+        pRequest->pData = pData;
+        pRequest->callback = callback;
+        pRequest->pContext = pContext;
+        pRequest->ticket = m_async.nextTicket++;
+        ticket = pRequest->ticket;
+        m_async.count++;
+        pthread_cond_broadcast(&m_async.changed);
+    }
+    else
+    {
+        free(pData);
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+
+    return ticket;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait until every queued request has been done.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromAsyncDrain(void)
+{
+    pthread_mutex_lock(&m_async.lock);
+    while(m_async.doneTicket != (m_async.nextTicket - 1u))
+    {
+        pthread_cond_wait(&m_async.changed, &m_async.lock);
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read from writes still in the async queue, newest first. m_lock must be held.
+    @param *pRead - The read in progress.
+    @return True once every byte of the read has been found.
+*///-----------------------------------------------------------------------------
+bool _emuEepromAsyncRead(read_context_t *pRead)
+{
+    bool done = false;
+
+    pthread_mutex_lock(&m_async.lock);
+    for(int i = (m_async.count - 1); (i >= 0) && !done; i--)
+    {
+        async_request_t *pRequest = &m_async.queue[(m_async.head + i) % ASYNC_QUEUE_DEPTH];
+        if(pRequest->op == async_write)
+        {
+            done = _emuEepromReadEntry(pRequest->vAddr, pRequest->buffLen, pRequest->pData, pRead);
+        }
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+
+    return done;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Background worker, does queued requests in order.
+    @param *pArg - Unused.
+    @return NULL
+*///-----------------------------------------------------------------------------
+void *_emuEepromAsyncWorker(void *pArg)
+{
+    pthread_mutex_lock(&m_async.lock);
+    while(m_async.running || m_async.count)
+    {
+        if(m_async.count == 0)
+        {
+            if(m_async.idleWork)
+            {
+                // erase ahead while nothing is queued, one block per hold of the engine lock
+                m_async.idleWork = false;
+                pthread_mutex_unlock(&m_async.lock);
+                pthread_mutex_lock(&m_lock);
+                ssize_t erased = _emuEepromIdleErase();
+                pthread_mutex_unlock(&m_lock);
+                pthread_mutex_lock(&m_async.lock);
+                m_async.idleWork = (m_async.idleWork || (erased > 0));
+            }
+            else
+            {
+                pthread_cond_wait(&m_async.changed, &m_async.lock);
+            }
+
+            continue;
+        }
+
+        async_request_t request = m_async.queue[m_async.head];
+        ssize_t result = 0;
+        pthread_mutex_unlock(&m_async.lock);
+
+        // the request stays queued until it is in the page buffer, so reads always find it
+        pthread_mutex_lock(&m_lock);
+        if(request.op == async_flush)
+        {
+            result = _emuEepromFlush();
+            if((result >= 0) && ((_emuEepromRingDrain() < 0) || (_emuEepromDurable(true) < 0)))
+            {
+                result = -1;
+            }
+        }
+        else
+        {
+            result = _emuEepromBufferWrite(request.vAddr, request.pData, request.buffLen, 0u);
+            _emuEepromHeat(request.vAddr, request.buffLen);
+        }
+
+        pthread_mutex_lock(&m_async.lock);
+        m_async.head = (m_async.head + 1u) % ASYNC_QUEUE_DEPTH;
+        m_async.count--;
+        pthread_mutex_unlock(&m_async.lock);
+        pthread_mutex_unlock(&m_lock);
+
+        if(request.callback != NULL)
+        {
+            request.callback(result, request.pContext);
+        }
+
+        free(request.pData);
+
+        pthread_mutex_lock(&m_async.lock);
+        m_async.doneTicket = request.ticket;
+        pthread_cond_broadcast(&m_async.changed);
+    }
+
+    pthread_mutex_unlock(&m_async.lock);
+
+    return pArg;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Completion of the flush queued by emuEepromSync.
+    @param result - Result of the flush.
+    @param *pContext - Where to store the result.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromSyncDone(ssize_t result, void *pContext)
+{
+    *(ssize_t *)pContext = result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write data to buffer. 
+    @param vAddr - Virtual address of data to be written.
+    @param *pBUffer - Buffer containing the data to be written.
+    @param buffLen - Amount of data (in bytes) to be written.
+    @param flags - Entry flags stored with the size.
+    @return Amount of data written or negative value if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromBufferWrite(uint16_t vAddr, void const *pBuffer, uint16_t buffLen, uint16_t flags)
+{
+    ssize_t count = 0;
+    uint16_t remainingSpace = ((PAGE_SIZE - CRC_SIZE) - m_info.bufferPos);
+
+    if(remainingSpace >= (INFO_SIZE + buffLen)) 
+    {
+        uint16_t entrySize = buffLen | flags;
+        memcpy(&m_info.pageBuffer[m_info.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
+        memcpy(&m_info.pageBuffer[m_info.bufferPos + SIZE_OFFSET], &entrySize, sizeof(entrySize));
+        if(buffLen)
+        {
+            memcpy(&m_info.pageBuffer[m_info.bufferPos + DATA_OFFSET], pBuffer, buffLen);
+        }
+
+        m_info.bufferPos += (INFO_SIZE + buffLen);
+        count += buffLen;
+    }
+    else 
+    {
+        uint16_t writeCount = 0;
+
+        // split the data across pages, each piece is its own entry
+        while(buffLen)
+        {
+            // whole pages starting on an empty buffer skip it and are programmed together
+            uint16_t pages = buffLen / MAX_DATA_PER_PAGE;
+            if(pages > (PAGES_PER_BLOCK - m_info.currPage))
+            {
+                pages = PAGES_PER_BLOCK - m_info.currPage;
+            }
+
+            if((m_info.bufferPos == BUFFER_START) && (pages >= DIRECT_MIN_PAGES))
+            {
+                ssize_t directCount = _emuEepromDirectWrite(vAddr, (uint8_t const *)pBuffer + writeCount, pages, flags);
+                if(directCount < 0)
+                {
+                    count = -1;
+                    break;
+                }
+
+                writeCount += directCount;
+                vAddr += directCount;
+                buffLen -= directCount;
+                count = writeCount;
+                continue;
+            }
+
+            remainingSpace = (PAGE_CRC_OFFSET - m_info.bufferPos) - INFO_SIZE;
+            if(remainingSpace > buffLen)
+            {
+                remainingSpace = buffLen;
+            }
+
+            // a flush may have started a transfer, so always use the current buffer position
+            uint16_t entrySize = remainingSpace | flags;
+            memcpy(&m_info.pageBuffer[m_info.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
+            memcpy(&m_info.pageBuffer[m_info.bufferPos + SIZE_OFFSET], &entrySize, sizeof(entrySize)); 
+            memcpy(&m_info.pageBuffer[m_info.bufferPos + DATA_OFFSET], (uint8_t const *)pBuffer + writeCount, remainingSpace); 
+            m_info.bufferPos += (remainingSpace + INFO_SIZE);
+            writeCount += remainingSpace;
+            vAddr += remainingSpace;
+            buffLen -= remainingSpace;
+            count = writeCount;
+
+            if((m_info.bufferPos + INFO_SIZE) >= PAGE_CRC_OFFSET)
+            {
+                if(_emuEepromFlush() < 0)
+                {
+                    count = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // check if min. entry can fit in current buffer
+    if((m_info.bufferPos + INFO_SIZE) >= PAGE_CRC_OFFSET) 
+    {
+        ssize_t flushCount = _emuEepromFlush();
+        if(flushCount <= 0)
+        {
+            count = -1;
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Find the current value of a range for an update, noting the entry holding
+    each byte.
+    @param vAddr - Virtual address of the value.
+    @param buffLen - Amount of bytes.
+    @return 0 or more if successful, negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromUpdateScan(uint16_t vAddr, uint16_t buffLen)
+{
+    scan_range_t range = {.vAddr = vAddr, .len = buffLen};
+
+    m_update.vAddr = vAddr;
+    m_update.buffLen = buffLen;
+    m_update.numFound = 0;
+    m_update.entries = 0;
+    memset(m_update.found, 0, (buffLen + BITS_PER_BYTE - 1u) / BITS_PER_BYTE);
+    memset(m_update.piece, 0, buffLen * sizeof(m_update.piece[0]));
+
+    uint32_t pagesVisited = m_stats.pagesVisited;
+    ssize_t result = _emuEepromScan(&range, 1u, _emuEepromUpdateEntry, &m_update);
+    m_update.pages = m_stats.pagesVisited - pagesVisited;
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write the runs of bytes that differ from the value found by the scan, each
+    as its own entry. A gap of up to INFO_SIZE unchanged bytes is written with the
+    run, it costs no more than the header of another entry. All of it is written if
+    the runs would leave the value in more pieces than a whole write, one more per
+    UPDATE_PIECE_BYTES, or if finding it took more than UPDATE_MAX_PAGES pages.
+    @param *pData - New data, m_update.buffLen bytes.
+    @return Amount of bytes written or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromUpdateRuns(uint8_t const *pData)
+{
+    uint16_t buffLen = m_update.buffLen;
+    uint16_t numRuns = 0;
+    uint32_t logged = 0;
+    ssize_t count = 0;
+
+    for(uint16_t start = 0; start < buffLen; )
+    {
+        if(m_update.piece[start] && (m_update.current[start] == pData[start]))
+        {
+            start++;
+            continue;
+        }
+
+        uint16_t end = start + 1u;
+        for(uint16_t i = end; (i < buffLen) && (i <= (end + INFO_SIZE)); i++)
+        {
+            if(!m_update.piece[i] || (m_update.current[i] != pData[i]))
+            {
+                end = i + 1u;
+            }
+        }
+
+        m_update.runs[numRuns][0] = start;
+        m_update.runs[numRuns][1] = end;
+        numRuns++;
+        start = end;
+    }
+
+    // pieces left, each run becomes one
+    uint16_t pieces = 0;
+    for(uint16_t run = 0; run < numRuns; run++)
+    {
+        memset(&m_update.piece[m_update.runs[run][0]], 0, (m_update.runs[run][1] - m_update.runs[run][0]) * sizeof(m_update.piece[0]));
+    }
+
+    for(uint16_t i = 0; i < buffLen; i++)
+    {
+        pieces += ((i == 0u) || (m_update.piece[i] != m_update.piece[i - 1u]));
+    }
+
+    // a whole write is split at page ends too, and brings every byte to the front of
+    // the log for the next lookup
+    if((pieces > (2u + (buffLen / MAX_DATA_PER_PAGE) + (buffLen / UPDATE_PIECE_BYTES))) || 
+        ((numRuns != 0u) && (m_update.pages > UPDATE_MAX_PAGES)))
+    {
+        m_update.runs[0][0] = 0;
+        m_update.runs[0][1] = buffLen;
+        numRuns = 1;
+    }
+
+    for(uint16_t run = 0; run < numRuns; run++)
+    {
+        uint16_t start = m_update.runs[run][0];
+        uint16_t len = m_update.runs[run][1] - start;
+        ssize_t written = _emuEepromBufferWrite(m_update.vAddr + start, &pData[start], len, 0u);
+        if(written < 0)
+        {
+            count = written;
+            break;
+        }
+
+        _emuEepromHeat(m_update.vAddr + start, len);
+        logged += INFO_SIZE + len;
+        count += written;
+    }
+
+    m_stats.updates++;
+    m_stats.updateBytesSaved += (INFO_SIZE + buffLen) - logged;
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy the newest data of an update range and note the entry holding each
+    byte.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Amount of data in the entry, 0 if the address was erased.
+    @param *pData - Data of the entry.
+    @param *pContext - The update_info_t of the update.
+    @return True once every byte of the range is found.
+*///-----------------------------------------------------------------------------
+bool _emuEepromUpdateEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    update_info_t *pUpdate = (update_info_t *)pContext;
+    uint16_t span = (entrySize == 0) ? 1u : entrySize; // erased entry covers its address
+    uint16_t start = (entryVAddr > pUpdate->vAddr) ? entryVAddr : pUpdate->vAddr;
+    uint16_t end = ((entryVAddr + span) < (pUpdate->vAddr + pUpdate->buffLen)) ? (entryVAddr + span) : (pUpdate->vAddr + pUpdate->buffLen);
+
+    pUpdate->entries++;
+    for(uint16_t addr = start; addr < end; addr++)
+    {
+        if(_emuEepromReadBit(pUpdate->vAddr, addr, pUpdate->found) == 0)
+        {
+            _emuEepromSetBit(pUpdate->vAddr, addr, pUpdate->found);
+            pUpdate->numFound++;
+            if(entrySize)
+            {
+                pUpdate->current[addr - pUpdate->vAddr] = pData[addr - entryVAddr];
+                pUpdate->piece[addr - pUpdate->vAddr] = pUpdate->entries;
+            }
+        }
+    }
+
+    return (pUpdate->numFound == pUpdate->buffLen);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Build whole pages of a large write in place and program them in one write,
+    each page holds one full entry, the same layout the page buffer would give.
+    @param vAddr - Virtual address of the first page.
+    @param *pData - Data for the pages, pages * MAX_DATA_PER_PAGE bytes.
+    @param pages - Pages to build, must fit in the current block.
+    @param flags - Entry flags stored with the size.
+    @return Amount of data written or negative value if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromDirectWrite(uint16_t vAddr, uint8_t const *pData, uint16_t pages, uint16_t flags)
+{
+    assert(m_info.bufferPos == BUFFER_START);
+    assert(pages <= DIRECT_MAX_PAGES);
+    assert((m_info.currPage + pages) <= PAGES_PER_BLOCK);
+
+    uint8_t run[DIRECT_MAX_PAGES * PAGE_SIZE];
+    uint16_t entrySize = MAX_DATA_PER_PAGE | flags;
+
+    for(uint16_t i = 0; i < pages; i++)
+    {
+        uint8_t *pPage = &run[i * PAGE_SIZE];
+        uint16_t entryVAddr = vAddr + (i * MAX_DATA_PER_PAGE);
+
+        memcpy(&pPage[VADDR_OFFSET], &entryVAddr, sizeof(entryVAddr));
+        memcpy(&pPage[SIZE_OFFSET], &entrySize, sizeof(entrySize));
+        memcpy(&pPage[DATA_OFFSET], &pData[i * MAX_DATA_PER_PAGE], MAX_DATA_PER_PAGE);
+        uint16_t calcCrc = _emuEepromPageCrc(pPage);
+        memcpy(&pPage[PAGE_CRC_OFFSET], &calcCrc, sizeof(calcCrc));
+        _emuEepromPageSummary(pPage, &m_summary[m_info.currPage + i]);
+    }
+
+    uint32_t currOffset = BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (m_info.currPage * PAGE_SIZE);
+    ssize_t count = _emuEepromFlashWrite(currOffset, run, pages * PAGE_SIZE);
+    if(count != (pages * PAGE_SIZE))
+    {
+        return -1;
+    }
+
+    m_stats.pagesProgrammed += pages;
+    m_stats.programCalls++;
+    m_info.currPage += pages;
+    count = pages * MAX_DATA_PER_PAGE;
+
+    // if last page has been written to, initialize a block transfer
+    if((m_info.currPage >= PAGES_PER_BLOCK) && (_emuEepromBlockTransfer() < 0))
+    {
+        count = -1;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Amount of pages a write will fill, following the same layout as _emuEepromBufferWrite.
+    @param *pBufferPos - Position in the page buffer, updated to where the write ends.
+    @param buffLen - Amount of data (in bytes) to be written.
+    @return Number of pages that will be flushed.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromPagesNeeded(uint16_t *pBufferPos, uint16_t buffLen)
+{
+    uint16_t pages = 0;
+
+    if(((PAGE_SIZE - CRC_SIZE) - *pBufferPos) >= (INFO_SIZE + buffLen))
+    {
+        *pBufferPos += (INFO_SIZE + buffLen);
+    }
+    else
+    {
+        while(buffLen)
+        {
+            uint16_t remainingSpace = (PAGE_CRC_OFFSET - *pBufferPos) - INFO_SIZE;
+            if(remainingSpace > buffLen)
+            {
+                remainingSpace = buffLen;
+            }
+
+            *pBufferPos += (INFO_SIZE + remainingSpace);
+            buffLen -= remainingSpace;
+            if((*pBufferPos + INFO_SIZE) >= PAGE_CRC_OFFSET)
+            {
+                *pBufferPos = BUFFER_START;
+                pages++;
+            }
+        }
+    }
+
+    if((*pBufferPos + INFO_SIZE) >= PAGE_CRC_OFFSET)
+    {
+        *pBufferPos = BUFFER_START;
+        pages++;
+    }
+
+    return pages;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Add a record to the open transaction.
+    @param vAddr - Virtual address of data to be written.
+    @param *pBuffer - Buffer containing the data, NULL to erase.
+    @param buffLen - Amount of data (in bytes) to be written.
+    @return Amount of data added or negative if the transaction is full.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromTxAppend(uint16_t vAddr, void const *pBuffer, uint16_t buffLen)
+{
+    if((m_tx.bufferPos + INFO_SIZE + buffLen) > TX_BUFFER_SIZE)
+    {
+        return -1;
+    }
+
+    memcpy(&m_tx.buffer[m_tx.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
+    memcpy(&m_tx.buffer[m_tx.bufferPos + SIZE_OFFSET], &buffLen, sizeof(buffLen));
+    if(buffLen)
+    {
+        memcpy(&m_tx.buffer[m_tx.bufferPos + DATA_OFFSET], pBuffer, buffLen);
+    }
+
+    m_tx.bufferPos += (INFO_SIZE + buffLen);
+
+    return buffLen;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Amount of pages needed to write the open transaction with its markers.
+    @param None
+    @return Number of pages, including the last partial page.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromTxPages(void)
+{
+    uint16_t bufferPos = m_info.bufferPos;
+    uint16_t pages = _emuEepromPagesNeeded(&bufferPos, 0u);
+
+    for(uint16_t i = 0; i < m_tx.bufferPos;)
+    {
+        uint16_t entrySize;
+        memcpy(&entrySize, &m_tx.buffer[i + SIZE_OFFSET], sizeof(entrySize));
+        pages += _emuEepromPagesNeeded(&bufferPos, entrySize);
+        i += (INFO_SIZE + entrySize);
+    }
+
+    pages += _emuEepromPagesNeeded(&bufferPos, 0u);
+    if(bufferPos != BUFFER_START)
+    {
+        pages++;
+    }
+
+    return pages;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Find all entries in a page.
+    @param *pPage - Page to be searched.
+    @param *pEntries - Offset of each entry in the page, oldest first.
+    @return Number of entries found.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromPageEntries(uint8_t const *pPage, uint16_t *pEntries)
+{
+    uint16_t numEntries = 0;
+
+    for(uint16_t i = 0; (i + INFO_SIZE) <= PAGE_CRC_OFFSET;)
+    {
+        uint16_t entryAddr = 0;
+        uint16_t entrySize = 0;
+        memcpy(&entryAddr, &pPage[i + VADDR_OFFSET], sizeof(entryAddr));
+        memcpy(&entrySize, &pPage[i + SIZE_OFFSET], sizeof(entrySize));
+        if((entryAddr == ERASED_WORD) && (entrySize == ERASED_WORD))
+        {
+            break; // rest of the page was left erased
+        }
+
+        // anything that runs off the page or the address space is not a valid entry
+        uint16_t dataSize = (entrySize & ENTRY_CONTROL) ? 0u : (entrySize & ENTRY_SIZE_MASK);
+        uint16_t span = (dataSize == 0) ? 1u : dataSize; // erased entry covers its address
+        if(((i + INFO_SIZE + dataSize) > PAGE_CRC_OFFSET) || 
+            (!(entrySize & ENTRY_CONTROL) && ((entryAddr + span) > MAX_VIRTUAL_ADDR)))
+        {
+            break;
+        }
+
+        pEntries[numEntries++] = i;
+        i += (INFO_SIZE + dataSize);
+    }
+
+    return numEntries;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pass each visible entry of a page to the visitor, newest first.
+    @param *pPage - Page to be searched.
+    @param *pCommitted - Transaction state, carried from newer pages.
+    @param visitor - Called with each entry until it returns true.
+    @param *pContext - Passed to the visitor.
+    @return True if the visitor is done.
+*///-----------------------------------------------------------------------------
+bool _emuEepromPageScan(uint8_t const *pPage, bool *pCommitted, entry_visitor_t visitor, void *pContext)
+{
+    uint16_t entries[MAX_ENTRIES_PER_PAGE];
+    uint16_t numEntries = _emuEepromPageEntries(pPage, entries);
+
+    for(int i = (numEntries - 1); i >= 0; i--)
+    {
+        uint16_t entryVAddr, entrySize;
+        memcpy(&entryVAddr, &pPage[entries[i] + VADDR_OFFSET], sizeof(entryVAddr));
+        memcpy(&entrySize, &pPage[entries[i] + SIZE_OFFSET], sizeof(entrySize));
+
+        if(entrySize & ENTRY_CONTROL)
+        {
+            // going backwards, a commit marker is seen before the records it covers
+            if(entryVAddr == MARKER_TX_COMMIT)
+            {
+                *pCommitted = true;
+            }
+            else if(entryVAddr == MARKER_TX_BEGIN)
+            {
+                *pCommitted = false;
+            }
+        }
+        else if(!(entrySize & ENTRY_TX) || *pCommitted)
+        {
+            if(visitor(entryVAddr, entrySize & ENTRY_SIZE_MASK, &pPage[entries[i] + DATA_OFFSET], pContext))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Calculate pages needed to import an image, one entry per run of addresses.
+    @param *pValid - Bitmap of the addresses to import.
+    @return Amount of pages.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromImportPages(uint8_t const *pValid)
+{
+    uint16_t bufferPos = BUFFER_START;
+    uint16_t pages = 0;
+
+    for(uint16_t addr = 0; addr < MAX_VIRTUAL_ADDR;)
+    {
+        uint16_t runLen = 0;
+        while(((addr + runLen) < MAX_VIRTUAL_ADDR) && _emuEepromReadBit(0u, addr + runLen, pValid))
+        {
+            runLen++;
+        }
+
+        if(runLen)
+        {
+            pages += _emuEepromPagesNeeded(&bufferPos, runLen);
+            addr += runLen;
+        }
+        else
+        {
+            addr++;
+        }
+    }
+
+    if(bufferPos != BUFFER_START)
+    {
+        pages++;
+    }
+
+    return pages;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write an image into the next block as if transferring to it, then erase
+    every other block. A store with nothing written yet is filled in place.
+    @param *pImage - Image of MAX_VIRTUAL_ADDR bytes.
+    @param *pValid - Bitmap of the addresses to import.
+    @return Amount of bytes imported or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromImport(uint8_t const *pImage, uint8_t const *pValid)
+{
+    blocks_t lastBlock = m_info.currBlock;
+    bool inPlace = ((m_info.currPage == PAGE_START) && (m_info.bufferPos == BUFFER_START) && (m_cold.block == block_error));
+    header_info_t header;
+
+    ssize_t count = _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * lastBlock), &header, sizeof(header));
+    if(count < 0)
+    {
+        return count;
+    }
+
+    // a fresh store, typically provisioning, does not need to spend an erase
+    if(!inPlace)
+    {
+        m_info.currBlock = _emuEepromNextBlock(lastBlock);
+        if(m_info.currBlock == block_error)
+        {
+            m_info.currBlock = lastBlock;
+            return -1;
+        }
+
+        _emuEepromBlockPrepare(m_info.currBlock);
+
+        _emuEepromCacheHold(m_info.currBlock);
+        header.transferCount = (header.transferCount >= TRANSFER_END) ? TRANSFER_START : (header.transferCount + 1u);
+        header.blockNum = m_info.currBlock;
+        m_info.bufferPos = BUFFER_START;
+        m_info.currPage = PAGE_START;
+    }
+
+    memset(m_info.pageBuffer, ERASED, PAGE_SIZE);
+
+    // each run of valid addresses becomes one entry, split only at page ends
+    ssize_t dataCount = 0;
+    for(uint16_t addr = 0; (addr < MAX_VIRTUAL_ADDR) && (count >= 0);)
+    {
+        uint16_t runLen = 0;
+        while(((addr + runLen) < MAX_VIRTUAL_ADDR) && _emuEepromReadBit(0u, addr + runLen, pValid))
+        {
+            runLen++;
+        }
+
+        if(runLen)
+        {
+            count = _emuEepromBufferWrite(addr, &pImage[addr], runLen, 0u);
+            dataCount += runLen;
+            addr += runLen;
+        }
+        else
+        {
+            addr++;
+        }
+    }
+
+    if(count >= 0)
+    {
+        count = _emuEepromFlush();
+    }
+
+    if(count >= 0)
+    {
+        count = _emuEepromRingDrain();
+    }
+
+    if((count < 0) || inPlace)
+    {
+        return (count < 0) ? count : dataCount;
+    }
+
+    // same order as a transfer, the old block is only erased once the new header is durable
+    if((_emuEepromDurable(true) >= 0) && (_emuEepromBlockFormat(m_info.currBlock, header) > 0) && 
+        (_emuEepromDurable(true) >= 0))
+    {
+        for(blocks_t block = block_start; block < block_total; block++)
+        {
+            if((block != m_info.currBlock) && !m_erase.blank[block] && !_emuEepromBlockBlank(block))
+            {
+                _emuEepromBlockReclaim(block);
+            }
+        }
+
+        m_cold.block = block_error;
+    }
+    else
+    {
+        dataCount = -1;
+    }
+
+    return dataCount;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pass each visible entry of a block to the visitor, newest first.
+    @param block - The block to search.
+    @param lastPage - Newest page to start from.
+    @param verify - Skip pages that fail their CRC, the legacy constant is accepted
+    in blocks of the legacy format.
+    @param *pRanges - Ranges looked up, pages of the current block whose summary
+    rules out all of them are skipped. Read again before each page.
+    @param numRanges - Amount of ranges, 0 visits every page.
+    @param *pCommitted - Transaction state, carried from newer pages.
+    @param visitor - Called with each entry until it returns true.
+    @param *pContext - Passed to the visitor.
+    @return 1 if the visitor is done, 0 if not or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromBlockScan(blocks_t block, uint16_t lastPage, bool verify, scan_range_t const *pRanges, uint16_t numRanges, bool *pCommitted, entry_visitor_t visitor, void *pContext)
+{
+    assert((numRanges == 0) || (block == m_info.currBlock));
+
+    uint8_t pageBuffer[PAGE_SIZE];
+    bool legacy = (verify && _emuEepromBlockLegacy(block));
+
+    for(int i = lastPage; i >= (int)PAGE_START; i--)
+    {
+        if(numRanges)
+        {
+            bool mayHold = false;
+            for(uint16_t r = 0; (r < numRanges) && !mayHold; r++)
+            {
+                mayHold = (pRanges[r].len && _emuEepromPageMayHold(&m_summary[i], pRanges[r].vAddr, pRanges[r].len));
+            }
+
+            if(!mayHold)
+            {
+                m_stats.pagesSkipped++;
+                continue;
+            }
+
+            m_stats.pagesVisited++;
+        }
+
+        uint32_t currOffset = (BLOCK_START_ADDR + (block * BLOCK_SIZE) + (i * PAGE_SIZE));
+        ssize_t count = _emuEepromFlashRead(currOffset, pageBuffer, PAGE_SIZE);
+        if(count < 0)
+        {
+            return count;
+        }
+
+        if(verify && !_emuEepromPageCrcValid(pageBuffer, legacy))
+        {
+            continue;
+        }
+
+        m_scanPage.offset = currOffset;
+        m_scanPage.pPage = pageBuffer;
+        bool stop = _emuEepromPageScan(pageBuffer, pCommitted, visitor, pContext);
+        m_scanPage.offset = SCAN_IN_RAM;
+        if(stop)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pass each visible entry to the visitor, from the page buffer back through the current block.
+    @param *pRanges - Ranges looked up, see _emuEepromBlockScan.
+    @param numRanges - Amount of ranges, 0 visits every page.
+    @param visitor - Called with each entry until it returns true.
+    @param *pContext - Passed to the visitor.
+    @return 1 if the visitor is done, 0 if not or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromScan(scan_range_t const *pRanges, uint16_t numRanges, entry_visitor_t visitor, void *pContext)
+{
+    bool committed = false;
+
+    if(m_info.bufferPos != BUFFER_START)
+    {
+        if(_emuEepromPageScan(m_info.pageBuffer, &committed, visitor, pContext))
+        {
+            return 1;
+        }
+    }
+
+    if(m_info.currPage > PAGE_START)
+    {
+        ssize_t result = _emuEepromBlockScan(m_info.currBlock, m_info.currPage - 1u, false, pRanges, numRanges, &committed, visitor, pContext);
+        if(result != 0)
+        {
+            return result;
+        }
+    }
+
+    // everything in the cold block is older than the current block
+    if((m_cold.block != block_error) && (m_cold.currPage > PAGE_START))
+    {
+        committed = false;
+        return _emuEepromBlockScan(m_cold.block, m_cold.currPage - 1u, false, NULL, 0u, &committed, visitor, pContext);
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Position right after the newest entry of the current block.
+    @param *pCursor - Where to store the position.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromCursor(emueeprom_cursor_t *pCursor)
+{
+    header_info_t header = {.transferCount = TRANSFER_START};
+
+    _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * m_info.currBlock), &header, sizeof(header));
+    pCursor->eraseCount = m_eraseCount[m_info.currBlock];
+    pCursor->transferCount = header.transferCount;
+    pCursor->page = m_info.currPage;
+    pCursor->offset = m_info.bufferPos;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Get a page of the current block, the page being staged included.
+    @param page - The page.
+    @param *pPage - Where to copy it, PAGE_SIZE bytes.
+    @return Amount of bytes copied or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromLogPage(uint16_t page, uint8_t *pPage)
+{
+    if(page == m_info.currPage)
+    {
+        memcpy(pPage, m_info.pageBuffer, PAGE_SIZE);
+        return PAGE_SIZE;
+    }
+
+    return _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * m_info.currBlock) + (page * PAGE_SIZE), pPage, PAGE_SIZE);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pass the entries between two positions of the current block to a callback.
+    Entries are gathered first, going back over them tells which records belong to
+    a committed transaction, as a scan would.
+    @param *pCursor - Where to start, moved past the entries passed.
+    @param *pEnd - Where the log ends.
+    @param change - The callback, see emuEepromChangesSince.
+    @param *pContext - Passed to the callback.
+    @return Amount of entries passed or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromChanges(emueeprom_cursor_t *pCursor, emueeprom_cursor_t const *pEnd, emueeprom_change_t change, void *pContext)
+{
+    change_entry_t *pEntries = malloc(PAGES_PER_BLOCK * MAX_ENTRIES_PER_PAGE * sizeof(change_entry_t));
+    uint8_t pageBuffer[PAGE_SIZE];
+    uint16_t numEntries = 0;
+    ssize_t result = 0;
+    ssize_t count = 0;
+
+    if(pEntries == NULL)
+    {
+        return -1;
+    }
+
+    for(uint16_t page = pCursor->page; (page <= pEnd->page) && (page < PAGES_PER_BLOCK) && (result >= 0); page++)
+    {
+        uint16_t offsets[MAX_ENTRIES_PER_PAGE];
+        result = _emuEepromLogPage(page, pageBuffer);
+        uint16_t pageEntries = (result >= 0) ? _emuEepromPageEntries(pageBuffer, offsets) : 0u;
+        for(uint16_t i = 0; i < pageEntries; i++)
+        {
+            if(((page == pCursor->page) && (offsets[i] < pCursor->offset)) || ((page == pEnd->page) && (offsets[i] >= pEnd->offset)))
+            {
+                continue;
+            }
+
+            change_entry_t *pEntry = &pEntries[numEntries++];
+            memcpy(&pEntry->vAddr, &pageBuffer[offsets[i] + VADDR_OFFSET], sizeof(pEntry->vAddr));
+            memcpy(&pEntry->size, &pageBuffer[offsets[i] + SIZE_OFFSET], sizeof(pEntry->size));
+            pEntry->page = page;
+            pEntry->offset = offsets[i];
+        }
+    }
+
+    // going backwards, a commit marker is seen before the records it covers
+    bool committed = false;
+    for(int i = (numEntries - 1); i >= 0; i--)
+    {
+        change_entry_t *pEntry = &pEntries[i];
+        if(pEntry->size & ENTRY_CONTROL)
+        {
+            committed = (pEntry->vAddr == MARKER_TX_COMMIT) ? true : ((pEntry->vAddr == MARKER_TX_BEGIN) ? false : committed);
+            pEntry->visible = false;
+        }
+        else
+        {
+            pEntry->visible = (!(pEntry->size & ENTRY_TX) || committed);
+        }
+    }
+
+    uint16_t loaded = 0; // the header page is never loaded
+    bool stop = false;
+    for(uint16_t i = 0; (i < numEntries) && (result >= 0) && !stop; i++)
+    {
+        change_entry_t const *pEntry = &pEntries[i];
+        uint16_t dataSize = (pEntry->size & ENTRY_CONTROL) ? 0u : (pEntry->size & ENTRY_SIZE_MASK);
+        if(pEntry->visible && (pEntry->page != loaded))
+        {
+            result = _emuEepromLogPage(pEntry->page, pageBuffer);
+            loaded = pEntry->page;
+        }
+
+        if(pEntry->visible && (result >= 0))
+        {
+            stop = (change(pEntry->vAddr, dataSize, dataSize ? &pageBuffer[pEntry->offset + DATA_OFFSET] : NULL, pContext) != 0);
+            count++;
+        }
+
+        pCursor->page = pEntry->page;
+        pCursor->offset = pEntry->offset + INFO_SIZE + dataSize;
+    }
+
+    if((result >= 0) && !stop)
+    {
+        *pCursor = *pEnd;
+    }
+
+    free(pEntries);
+
+    return (result < 0) ? result : count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy the part of an entry that overlaps a read. Bytes already found are skipped.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Amount of data in the entry, 0 if the address was erased.
+    @param *pData - Data of the entry.
+    @param *pContext - The read_context_t of the read.
+    @return True once every byte of the read has been found.
+*///-----------------------------------------------------------------------------
+bool _emuEepromReadEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    read_context_t *pRead = (read_context_t *)pContext;
+    uint8_t *pBuff = (uint8_t *)pRead->pBuffer;
+    uint16_t span = (entrySize == 0) ? 1u : entrySize; // erased entry covers its address
+    uint16_t start = (entryVAddr > pRead->vAddr) ? entryVAddr : pRead->vAddr;
+    uint16_t end = ((entryVAddr + span) < (pRead->vAddr + pRead->buffLen)) ? (entryVAddr + span) : (pRead->vAddr + pRead->buffLen);
+
+    for(uint16_t addr = start; addr < end; addr++)
+    {
+        if(_emuEepromReadBit(pRead->vAddr, addr, pRead->pBitmap) == 0)
+        {
+            _emuEepromSetBit(pRead->vAddr, addr, pRead->pBitmap);
+            pRead->numFound++;
+            if(entrySize)
+            {
+                pBuff[addr - pRead->vAddr] = pData[addr - entryVAddr];
+                pRead->numRead++;
+                if(pRead->pValid != NULL)
+                {
+                    _emuEepromSetBit(pRead->vAddr, addr, pRead->pValid);
+                }
+            }
+        }
+    }
+
+    return (pRead->numFound == pRead->buffLen);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Find where the newest data of a view range is stored on flash.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Amount of data in the entry, 0 if the address was erased.
+    @param *pData - Data of the entry.
+    @param *pContext - The view_context_t of the view.
+    @return True once the newest entry touching the range is found.
+*///-----------------------------------------------------------------------------
+bool _emuEepromViewEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    view_context_t *pFind = (view_context_t *)pContext;
+    uint16_t span = (entrySize == 0) ? 1u : entrySize;
+
+    if((entryVAddr >= (pFind->vAddr + pFind->len)) || ((entryVAddr + span) <= pFind->vAddr))
+    {
+        return false;
+    }
+
+    // it only works in place if this entry holds the whole range
+    if(entrySize && (entryVAddr <= pFind->vAddr) && ((entryVAddr + entrySize) >= (pFind->vAddr + pFind->len)) && 
+        (m_scanPage.offset != SCAN_IN_RAM))
+    {
+        pFind->offset = m_scanPage.offset + (uint32_t)(pData - m_scanPage.pPage) + (pFind->vAddr - entryVAddr);
+    }
+
+    return true;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy the newest data of an entry into every request it overlaps.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Amount of data in the entry, 0 if the address was erased.
+    @param *pData - Data of the entry.
+    @param *pContext - The multi_context_t of the read.
+    @return True once every byte of every request has been found.
+*///-----------------------------------------------------------------------------
+bool _emuEepromMultiEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    multi_context_t *pMulti = (multi_context_t *)pContext;
+    uint16_t span = (entrySize == 0) ? 1u : entrySize; // erased entry covers its address
+    uint16_t entryEnd = entryVAddr + span;
+    bool fresh[MAX_DATA_PER_PAGE] = {false}; // bytes of the entry found for the first time
+    bool found = false;
+    uint16_t first = 0;
+    uint16_t last = pMulti->numSpans;
+
+    // an entry never crosses a page
+    assert(span <= MAX_DATA_PER_PAGE);
+
+    // first span ending after the start of the entry
+    while(first < last)
+    {
+        uint16_t mid = (first + last) / 2u;
+        if((pMulti->pSpans[mid].vAddr + pMulti->pSpans[mid].len) <= entryVAddr)
+        {
+            first = mid + 1u;
+        }
+        else
+        {
+            last = mid;
+        }
+    }
+
+    for(uint16_t s = first; (s < pMulti->numSpans) && (pMulti->pSpans[s].vAddr < entryEnd); s++)
+    {
+        scan_range_t const *pSpan = &pMulti->pSpans[s];
+        uint16_t start = (entryVAddr > pSpan->vAddr) ? entryVAddr : pSpan->vAddr;
+        uint16_t end = (entryEnd < (pSpan->vAddr + pSpan->len)) ? entryEnd : (pSpan->vAddr + pSpan->len);
+
+        for(uint16_t addr = start; addr < end; addr++)
+        {
+            if(!_emuEepromReadBit(0u, addr, pMulti->pBitmap))
+            {
+                _emuEepromSetBit(0u, addr, pMulti->pBitmap);
+                fresh[addr - entryVAddr] = true;
+                found = true;
+                if(--pMulti->pRemaining[s] == 0)
+                {
+                    // no more pages are needed for this span
+                    pMulti->pRanges[s].len = 0;
+                    pMulti->openSpans--;
+                }
+            }
+        }
+    }
+
+    if(entrySize && found)
+    {
+        // requests are sorted, none starting before entryVAddr - maxLen can overlap
+        uint16_t lowest = (entryVAddr >= pMulti->maxLen) ? (entryVAddr - pMulti->maxLen + 1u) : 0u;
+        size_t firstReq = 0;
+        size_t lastReq = pMulti->numReqs;
+        while(firstReq < lastReq)
+        {
+            size_t mid = (firstReq + lastReq) / 2u;
+            if(pMulti->pReqs[mid].vAddr < lowest)
+            {
+                firstReq = mid + 1u;
+            }
+            else
+            {
+                lastReq = mid;
+            }
+        }
+
+        for(size_t i = firstReq; (i < pMulti->numReqs) && (pMulti->pReqs[i].vAddr < entryEnd); i++)
+        {
+            emueeprom_req_t const *pReq = &pMulti->pReqs[i];
+            uint16_t start = (entryVAddr > pReq->vAddr) ? entryVAddr : pReq->vAddr;
+            uint16_t end = (entryEnd < (pReq->vAddr + pReq->len)) ? entryEnd : (pReq->vAddr + pReq->len);
+
+            for(uint16_t addr = start; addr < end; addr++)
+            {
+                if(fresh[addr - entryVAddr])
+                {
+                    ((uint8_t *)pReq->pBuffer)[addr - pReq->vAddr] = pData[addr - entryVAddr];
+                    if(pReq->pValid != NULL)
+                    {
+                        _emuEepromSetBit(pReq->vAddr, addr, pReq->pValid);
+                    }
+
+                    pMulti->numRead++;
+                }
+            }
+        }
+    }
+
+    return (pMulti->openSpans == 0);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Order requests by virtual address for qsort.
+    @param *pLeft - First request.
+    @param *pRight - Second request.
+    @return Negative, 0 or positive as for qsort.
+*///-----------------------------------------------------------------------------
+int _emuEepromReqCompare(void const *pLeft, void const *pRight)
+{
+    return (int)((emueeprom_req_t const *)pLeft)->vAddr - (int)((emueeprom_req_t const *)pRight)->vAddr;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy the newest data of an entry that has not been transferred yet.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Amount of data in the entry, 0 if the address was erased.
+    @param *pData - Data of the entry.
+    @param *pContext - The transfer_context_t of the transfer.
+    @return True if an error occured.
+*///-----------------------------------------------------------------------------
+bool _emuEepromTransferEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    transfer_context_t *pTransfer = (transfer_context_t *)pContext;
+    uint16_t streak = 0;
+
+    if(entrySize == 0)
+    {
+        // erased, so older data of this address must not be transferred
+        if(!_emuEepromReadBit(0u, entryVAddr, pTransfer->pBitmap))
+        {
+            _emuEepromSetBit(0u, entryVAddr, pTransfer->pBitmap);
+            if(!pTransfer->keepErased)
+            {
+                _emuEepromTransferDropped(pTransfer);
+            }
+            else if(pTransfer->cold && _emuEepromIsCold(entryVAddr, 1u) && _emuEepromColdAppend(entryVAddr, NULL, 0u))
+            {
+                _emuEepromTransferDropped(pTransfer);
+            }
+            else if(_emuEepromBufferWrite(entryVAddr, NULL, 0u, 0u) < 0)
+            {
+                pTransfer->count = -1;
+            }
+        }
+
+        return (pTransfer->count < 0);
+    }
+
+    // write each streak of data that has not been transferred yet
+    for(uint16_t i = 0; i <= entrySize; i++)
+    {
+        if((i < entrySize) && !_emuEepromReadBit(0u, entryVAddr + i, pTransfer->pBitmap))
+        {
+            streak++;
+        }
+        else if(streak)
+        {
+            uint16_t streakVAddr = entryVAddr + i - streak;
+            m_stats.copyBytes += streak;
+            m_stats.transferEntries++;
+            if(pTransfer->cold && _emuEepromIsCold(streakVAddr, streak) && 
+                _emuEepromColdAppend(streakVAddr, &pData[i - streak], streak))
+            {
+                _emuEepromTransferDropped(pTransfer);
+            }
+            else
+            {
+                pTransfer->count = _emuEepromBufferWrite(streakVAddr, &pData[i - streak], streak, 0u);
+                if(pTransfer->count <= 0)
+                {
+                    return true;
+                }
+            }
+
+            for(uint16_t w = 0; w < streak; w++)
+            {
+                _emuEepromSetBit(0u, streakVAddr + w, pTransfer->pBitmap);
+            }
+
+            streak = 0;
+        }
+    }
+
+    return false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Note that the entry being transferred is left out of the new block, erased
+    for good or demoted to the cold block. Pages are scanned newest first, so the
+    first one noted is the newest.
+    @param *pTransfer - The transfer.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromTransferDropped(transfer_context_t *pTransfer)
+{
+    if((pTransfer->droppedPage == 0u) && (m_scanPage.offset != SCAN_IN_RAM))
+    {
+        pTransfer->droppedPage = ((m_scanPage.offset - BLOCK_START_ADDR) % BLOCK_SIZE) / PAGE_SIZE;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Transfer latest data to next block.
+    @param None
+    @return Last amount of data written to buffer or negative value if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromBlockTransfer(void)
+{
+    uint8_t AddrBitMap[VIRTUAL_ADDR_BITS];
+    uint32_t offset = (BLOCK_START_ADDR + (BLOCK_SIZE * m_info.currBlock));
+    blocks_t lastBlock = m_info.currBlock;
+    uint16_t lastPage = m_info.currPage - 1u;
+    header_info_t header;
+    transfer_context_t transfer;
+    bool committed = false;
+    emueeprom_cursor_t last;
+    TRACE_BEGIN(op_transfer, 0u, 0u, NULL);
+
+    memset(AddrBitMap, 0, VIRTUAL_ADDR_BITS);
+    _emuEepromShareBegin();
+    _emuEepromCursor(&last);
+
+    // make room for demoted data first, while only the current and cold blocks are in use
+    bool cold = (m_cold.hotGenerations > 0u);
+    bool merge = (!cold && (m_cold.block != block_error));
+    ssize_t count = cold ? _emuEepromColdPrepare() : 0;
+    if(count >= 0)
+    {
+        count = _emuEepromFlashRead(offset, &header, sizeof(header));
+    }
+
+    // every other block may be held by views
+    if((count > 0) && (_emuEepromNextBlock(lastBlock) == block_error))
+    {
+        count = -1;
+    }
+
+    if(count > 0)
+    {
+        m_info.currBlock = _emuEepromNextBlock(lastBlock);
+        _emuEepromBlockPrepare(m_info.currBlock);
+
+        // with room for two blocks the copy is made in RAM as well
+        _emuEepromCacheHold(m_info.currBlock);
+
+        if(header.transferCount >= TRANSFER_END)
+        {
+            header.transferCount = TRANSFER_START;
+        }
+        else
+        {
+            header.transferCount++;
+        }
+
+        header.blockNum = m_info.currBlock;
+        m_info.bufferPos = 0; 
+        m_info.currPage = PAGE_START;
+
+        transfer.cold = cold && (m_cold.block != block_error);
+        transfer.keepErased = transfer.cold;
+        transfer.pBitmap = AddrBitMap;
+        transfer.count = count;
+        transfer.droppedPage = 0;
+        count = _emuEepromBlockScan(lastBlock, lastPage, true, NULL, 0u, &committed, _emuEepromTransferEntry, &transfer);
+        m_stats.transferPages += (lastPage + 1u - PAGE_START);
+        uint16_t droppedPage = transfer.droppedPage;
+        if(merge && (count >= 0) && (transfer.count > 0))
+        {
+            // hot/cold was turned off, fold the cold block back in behind the newer data
+            committed = false;
+            m_stats.transferPages += (m_cold.currPage - PAGE_START);
+            count = _emuEepromBlockScan(m_cold.block, m_cold.currPage - 1u, true, NULL, 0u, &committed, _emuEepromTransferEntry, &transfer);
+        }
+
+        // demoted data and its block header must be durable before the old block goes
+        if(transfer.cold && (count >= 0) && (transfer.count > 0) && 
+            ((_emuEepromColdFlush() < 0) || (!m_cold.formatted && (_emuEepromColdFormat() < 0))))
+        {
+            count = -1;
+        }
+
+        if((count >= 0) && (transfer.count > 0))
+        {
+            // header is written last so an interrupted transfer leaves the old block active,
+            // the copy has to be durable before the header and the header before the erase
+            if(_emuEepromDurable(true) < 0)
+            {
+                count = -1;
+            }
+            else
+            {
+                count = _emuEepromBlockFormat(m_info.currBlock, header);
+                if((count < 0) || (_emuEepromDurable(true) < 0))
+                {
+                    count = -1;
+                }
+                else
+                {
+                    _emuEepromBlockReclaim(lastBlock);
+                    if(merge)
+                    {
+                        _emuEepromBlockReclaim(m_cold.block);
+                        m_cold.block = block_error;
+                    }
+
+                    _emuEepromCacheHold(m_info.currBlock);
+                    _emuEepromAge();
+                    m_stats.transfers++;
+
+                    // what was copied is replayed to cursors left in the old block
+                    m_feed.valid = true;
+                    m_feed.last = last;
+                    m_feed.droppedPage = droppedPage;
+                    _emuEepromCursor(&m_feed.first);
+                    m_feed.first.page = PAGE_START;
+                    m_feed.first.offset = BUFFER_START;
+                }
+            }
+        }
+        else
+        {
+            count = -1;
+        }
+    }
+
+    _emuEepromShareEnd();
+    TRACE_END(op_transfer, 0u, 0u, NULL, count);
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set bits in bitmap.
+    @param vAddr - The virtual address to check.
+    @param *pBitmap - The bitmap to read from.
+    @param amount - Amount of bits to set.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromSetBit(uint16_t startAddr, uint16_t vAddr, uint8_t *pBitmap)
+{
+    assert(startAddr <= vAddr);
+    uint16_t index = (vAddr - startAddr) / BITS_PER_BYTE;
+    uint16_t bit = (vAddr - startAddr) % BITS_PER_BYTE;
+
+    pBitmap[index] |= (1 << bit);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read bit in bitmap.
+    @param vAddr - The virtual address to check.
+    @param *pBitmap - The bitmap to read from.
+    @return The value of the virtual address bit.
+*///-----------------------------------------------------------------------------
+uint8_t _emuEepromReadBit(uint16_t startAddr, uint16_t vAddr, uint8_t const *pBitmap)
+{
+    assert(startAddr <= vAddr);
+    uint8_t mask = 0x1;
+    uint16_t index = (vAddr - startAddr) / BITS_PER_BYTE;
+    uint16_t bit = (vAddr - startAddr) % BITS_PER_BYTE;
+
+    return ((pBitmap[index] >> bit) & mask);
+
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Formats block by erasing entire block and writing header.
+    @param block - The block to format.
+    @param header - Header information about the block and emulated EEPROM, the
+    format, CRC and erase count are filled in.
+    @return Amount of bytes written to flash or negative value if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromBlockFormat(blocks_t block, header_info_t header)
+{
+    // a header copied from a block of the legacy format is upgraded here
+    header.format = HEADER_FORMAT;
+    header.reserved = ERASED_WORD;
+    header.crc = _emuEepromHeaderCrc(header);
+    header.eraseCount = m_eraseCount[block];
+
+    return _emuEepromFlashWrite(BLOCK_START_ADDR + (BLOCK_SIZE * block), &header, sizeof(header));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erases a block and stores its new erase count in the header.
+    @param block - The block to erase.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromBlockErase(blocks_t block)
+{
+    // views still point into the block
+    if(m_view.pins[block])
+    {
+        m_view.stale[block] = true;
+        return;
+    }
+
+    _emuEepromRingDrain();
+    flashBlockErase(block, 1u);
+    _emuEepromBlockErased(block);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Bring the cache and erase count up to date after a block was erased.
+    @param block - The erased block.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromBlockErased(blocks_t block)
+{
+    uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block) + offsetof(header_info_t, eraseCount);
+
+    if(m_cache.pBlock[block] != NULL)
+    {
+        if((m_cache.slots < BLOCK_COUNT) && (block != m_info.currBlock))
+        {
+            // only the active block is kept when the whole partition does not fit
+            free(m_cache.pBlock[block]);
+            m_cache.pBlock[block] = NULL;
+            m_cache.held--;
+        }
+        else
+        {
+            memset(m_cache.pBlock[block], ERASED, BLOCK_SIZE);
+        }
+    }
+
+    _emuEepromMirrorErased(block);
+    m_eraseCount[block]++;
+    m_share.programmed[block] = 0;
+    _emuEepromFlashWrite(offset, &m_eraseCount[block], sizeof(m_eraseCount[block]));
+    m_erase.blank[block] = true;
+    m_erase.reclaimed[block] = false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Make sure a block is erased before it is used. A block known to be blank,
+    typically erased ahead, is not checked or erased again.
+    @param block - The block to use.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromBlockPrepare(blocks_t block)
+{
+    if(!m_erase.blank[block] && !_emuEepromBlockBlank(block))
+    {
+        _emuEepromBlockErase(block);
+        m_stats.inlineErases++;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Give up a block that is no longer in use. With erase-ahead its unique ID is
+    cleared so it is never taken as active again, and the erase is left for idle time.
+    @param block - The block to give up.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromBlockReclaim(blocks_t block)
+{
+    uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block) + offsetof(header_info_t, uniqueId);
+    uint16_t retiredId = RETIRED_ID;
+
+    if(m_erase.reclaimed[block])
+    {
+        return;
+    }
+
+    // a block held by views waits for them anyway
+    if(m_erase.ahead && !m_view.pins[block] && (_emuEepromFlashWrite(offset, &retiredId, sizeof(retiredId)) > 0))
+    {
+        m_erase.reclaimed[block] = true;
+        pthread_mutex_lock(&m_async.lock);
+        m_async.idleWork = true;
+        pthread_cond_broadcast(&m_async.changed);
+        pthread_mutex_unlock(&m_async.lock);
+    }
+    else
+    {
+        _emuEepromBlockErase(block);
+        m_stats.inlineErases++;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase one reclaimed block, skipping any that turned out to be blank already.
+    @param None
+    @return 1 if a block was erased, 0 if none is owed.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromIdleErase(void)
+{
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        if(m_erase.reclaimed[block] && !m_view.pins[block])
+        {
+            if(m_erase.blank[block] || _emuEepromBlockBlank(block))
+            {
+                m_erase.reclaimed[block] = false;
+                continue;
+            }
+
+            _emuEepromBlockErase(block);
+            m_stats.idleErases++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a block is free to be formatted.
+    @param block - The block to check.
+    @return True if the block has no header and no data.
+*///-----------------------------------------------------------------------------
+bool _emuEepromBlockBlank(blocks_t block)
+{
+    header_info_t header;
+    
+    ssize_t count = _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * block), &header, sizeof(header));
+    if((count < 0) || (header.uniqueId != ERASED_WORD))
+    {
+        return false;
+    }
+
+    // pages are programmed in order, so an interrupted transfer always leaves the first data page
+    return _emuEepromPageErased(block, PAGE_START);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pick the least worn block to transfer to.
+    @param currBlock - The block currently in use, or block_error if none.
+    @return The block to use next.
+*///-----------------------------------------------------------------------------
+blocks_t _emuEepromNextBlock(blocks_t currBlock)
+{
+    blocks_t nextBlock = block_error;
+    uint16_t start = (currBlock == block_error) ? block_start : (currBlock + 1u);
+
+    // search in ping-pong order so equally worn blocks are used round robin
+    for(uint16_t i = 0; i < block_total; i++)
+    {
+        blocks_t block = (start + i) % block_total;
+        if((block != currBlock) && (block != m_cold.block) && !m_view.pins[block])
+        {
+            if((nextBlock == block_error) || (m_eraseCount[block] < m_eraseCount[nextBlock]))
+            {
+                nextBlock = block;
+            }
+        }
+    }
+
+    return nextBlock;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Load the erase count of each block from its header.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromLoadWear(void)
+{
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block) + offsetof(header_info_t, eraseCount);
+        uint32_t eraseCount = ERASED_COUNT;
+
+        ssize_t count = _emuEepromFlashRead(offset, &eraseCount, sizeof(eraseCount));
+        if((count < 0) || (eraseCount == ERASED_COUNT))
+        {
+            // never erased, or power was lost before the count was stored
+            eraseCount = 0u;
+        }
+
+        m_eraseCount[block] = eraseCount;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Find which block is the current block of a kind.
+    @param *pHeader - Header information about the active block.
+    @param kind - BLOCK_KIND_HOT for the current block, BLOCK_KIND_COLD for the cold block.
+    @return Which block is currently active.
+*///-----------------------------------------------------------------------------
+blocks_t _emuEepromActiveBlock(header_info_t *pHeader, uint16_t kind)
+{
+    blocks_t foundBlock = block_error;
+    uint16_t foundCount = 0u;
+
+    for(blocks_t block = block_1; block < block_total; block++)
+    {
+        ssize_t count = _emuEepromFlashRead((BLOCK_START_ADDR + (BLOCK_SIZE * block)), pHeader, sizeof(*pHeader));
+        if(count >= 0)
+        {
+            if((pHeader->uniqueId == UNIQUE_ID) && (pHeader->kind == kind))
+            {
+                if(foundBlock == block_error)
+                {
+                    foundBlock = block;
+                    foundCount = pHeader->transferCount;
+                }
+                else
+                {
+                    if(foundCount == TRANSFER_END)
+                    {
+                        if(pHeader->transferCount == TRANSFER_START)
+                        {
+                            foundBlock = block;
+                            foundCount = pHeader->transferCount;
+                        }
+                    }
+                    else if((foundCount < pHeader->transferCount) && (pHeader->transferCount != TRANSFER_END))
+                    {
+                        foundBlock = block;
+                        foundCount = pHeader->transferCount;
+                    }
+                }                            
+            }
+        }
+        else
+        {
+            return block_error;
+        }
+    }
+    
+    return foundBlock;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Find the current page.
+    @param block - The block to search.
+    @return The page number of the next avaiable page.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromCurrentPage(blocks_t block)
+{
+    uint16_t low = PAGE_START;
+    uint16_t high = PAGES_PER_BLOCK;
+
+    // pages are programmed in order, so search for the first erased page
+    while(low < high)
+    {
+        uint16_t mid = low + ((high - low) / 2u);
+        if(_emuEepromPageErased(block, mid))
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1u;
+        }
+    }
+
+    return low;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a page has been programmed.
+    @param block - The block the page is in.
+    @param page - The page to check.
+    @return True if the page is erased.
+*///-----------------------------------------------------------------------------
+bool _emuEepromPageErased(blocks_t block, uint16_t page)
+{
+    uint16_t tempVAddr = 0;
+
+    ssize_t count = _emuEepromFlashRead(BLOCK_START_ADDR + (BLOCK_SIZE * block) + (PAGE_SIZE * page), &tempVAddr, sizeof(tempVAddr));
+
+    return ((count > 0) && (tempVAddr == ERASED_WORD));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Summarize the addresses a page covers. Pages holding transaction markers
+    match every lookup, since skipping one would lose the commit state.
+    @param *pPage - The page to summarize.
+    @param *pSummary - Where to store the summary.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromPageSummary(uint8_t const *pPage, page_summary_t *pSummary)
+{
+    uint16_t entries[MAX_ENTRIES_PER_PAGE];
+    uint16_t numEntries = _emuEepromPageEntries(pPage, entries);
+
+    pSummary->minVAddr = ERASED_WORD;
+    pSummary->maxVAddr = 0u;
+    pSummary->filter = 0u;
+
+    for(uint16_t i = 0; i < numEntries; i++)
+    {
+        uint16_t entryVAddr, entrySize;
+        memcpy(&entryVAddr, &pPage[entries[i] + VADDR_OFFSET], sizeof(entryVAddr));
+        memcpy(&entrySize, &pPage[entries[i] + SIZE_OFFSET], sizeof(entrySize));
+
+        if(entrySize & ENTRY_CONTROL)
+        {
+            pSummary->minVAddr = 0u;
+            pSummary->maxVAddr = ERASED_WORD;
+            pSummary->filter = ~0u;
+            break;
+        }
+
+        uint16_t span = (entrySize & ENTRY_SIZE_MASK) ? (entrySize & ENTRY_SIZE_MASK) : 1u; // erased entry covers its address
+        uint16_t lastVAddr = entryVAddr + span - 1u;
+        if(entryVAddr < pSummary->minVAddr)
+        {
+            pSummary->minVAddr = entryVAddr;
+        }
+
+        if(lastVAddr > pSummary->maxVAddr)
+        {
+            pSummary->maxVAddr = lastVAddr;
+        }
+
+        for(uint16_t granule = (entryVAddr / SUMMARY_GRANULE); granule <= (lastVAddr / SUMMARY_GRANULE); granule++)
+        {
+            pSummary->filter |= _emuEepromSummaryBits(granule);
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a page can hold any part of a range.
+    @param *pSummary - Summary of the page.
+    @param vAddr - Start of the range.
+    @param len - Length of the range.
+    @return False if the page surely has nothing in the range.
+*///-----------------------------------------------------------------------------
+bool _emuEepromPageMayHold(page_summary_t const *pSummary, uint16_t vAddr, uint16_t len)
+{
+    uint16_t lastVAddr = vAddr + len - 1u;
+
+    if((lastVAddr < pSummary->minVAddr) || (vAddr > pSummary->maxVAddr))
+    {
+        return false;
+    }
+
+    if(((lastVAddr / SUMMARY_GRANULE) - (vAddr / SUMMARY_GRANULE)) >= SUMMARY_MAX_GRANULES)
+    {
+        return true;
+    }
+
+    for(uint16_t granule = (vAddr / SUMMARY_GRANULE); granule <= (lastVAddr / SUMMARY_GRANULE); granule++)
+    {
+        uint32_t bits = _emuEepromSummaryBits(granule);
+        if((pSummary->filter & bits) == bits)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Bloom filter bits of an address granule, two hashes.
+    @param granule - Virtual address divided by SUMMARY_GRANULE.
+    @return Filter bits.
+*///-----------------------------------------------------------------------------
+uint32_t _emuEepromSummaryBits(uint16_t granule)
+{
+    uint32_t hash = granule * 2654435761u; // Knuth multiplicative hash
+
+    return (1u << (granule % SUMMARY_BITS)) | (1u << (hash >> 27));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Summarize every programmed page of the current block.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromSummaryBuild(void)
+{
+    uint8_t pageBuffer[PAGE_SIZE];
+
+    for(uint16_t page = PAGE_START; page < m_info.currPage; page++)
+    {
+        uint32_t offset = BLOCK_START_ADDR + (m_info.currBlock * BLOCK_SIZE) + (page * PAGE_SIZE);
+        if(_emuEepromFlashRead(offset, pageBuffer, PAGE_SIZE) == PAGE_SIZE)
+        {
+            _emuEepromPageSummary(pageBuffer, &m_summary[page]);
+        }
+        else
+        {
+            // unreadable pages are never skipped
+            m_summary[page].minVAddr = 0u;
+            m_summary[page].maxVAddr = ERASED_WORD;
+            m_summary[page].filter = ~0u;
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Record a write by the application for hot/cold separation.
+    @param vAddr - Virtual address written.
+    @param len - Amount of bytes written.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromHeat(uint16_t vAddr, uint16_t len)
+{
+    for(uint16_t granule = (vAddr / HEAT_GRANULE); granule <= ((vAddr + len - 1u) / HEAT_GRANULE); granule++)
+    {
+        m_cold.lastWrite[granule] = m_cold.generation;
+    }
+
+    m_stats.userBytes += len;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a range has gone hotGenerations transfers without a write.
+    @param vAddr - Start of the range.
+    @param len - Length of the range.
+    @return True if every granule of the range is cold.
+*///-----------------------------------------------------------------------------
+bool _emuEepromIsCold(uint16_t vAddr, uint16_t len)
+{
+    for(uint16_t granule = (vAddr / HEAT_GRANULE); granule <= ((vAddr + len - 1u) / HEAT_GRANULE); granule++)
+    {
+        if((uint8_t)(m_cold.generation - m_cold.lastWrite[granule]) < m_cold.hotGenerations)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start the next generation after a transfer. Ages are held at the cold
+    threshold so the 8 bit generation can wrap.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromAge(void)
+{
+    m_cold.generation++;
+    for(uint16_t granule = 0; granule < HEAT_GRANULES; granule++)
+    {
+        if((uint8_t)(m_cold.generation - m_cold.lastWrite[granule]) > m_cold.hotGenerations)
+        {
+            m_cold.lastWrite[granule] = m_cold.generation - m_cold.hotGenerations;
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Before a transfer, open a cold block if anything is cold, or compact the
+    cold block if it is low on pages.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromColdPrepare(void)
+{
+    ssize_t result = 0;
+
+    if(m_cold.block != block_error)
+    {
+        if((PAGES_PER_BLOCK - m_cold.currPage) < COLD_MIN_FREE)
+        {
+            result = _emuEepromColdCompact();
+        }
+    }
+    else
+    {
+        for(uint16_t granule = 0; granule < HEAT_GRANULES; granule++)
+        {
+            if(_emuEepromIsCold(granule * HEAT_GRANULE, HEAT_GRANULE))
+            {
+                result = _emuEepromColdOpen();
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Take a blank block for cold data. Its header is written once its data is.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromColdOpen(void)
+{
+    blocks_t block = _emuEepromNextBlock(m_info.currBlock);
+    if(block == block_error)
+    {
+        return -1;
+    }
+
+    _emuEepromBlockPrepare(block);
+    m_cold.block = block;
+    m_cold.currPage = PAGE_START;
+    m_cold.bufferPos = BUFFER_START;
+    m_cold.formatted = false;
+    memset(m_cold.pageBuffer, ERASED, PAGE_SIZE);
+    _emuEepromCacheHold(block);
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy the live data of the cold block to a new cold block. Erased entries
+    are dropped, nothing older than the cold block is left to hide.
+    @param None
+    @return 0 if successful or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromColdCompact(void)
+{
+    uint8_t AddrBitMap[VIRTUAL_ADDR_BITS];
+    transfer_context_t transfer;
+    blocks_t lastBlock = m_cold.block;
+    uint16_t lastPage = m_cold.currPage - 1u;
+    bool committed = false;
+
+    memset(AddrBitMap, 0, VIRTUAL_ADDR_BITS);
+
+    // the old block is excluded by the pick since it is still the cold block
+    ssize_t result = _emuEepromColdOpen();
+    if(result < 0)
+    {
+        m_cold.block = lastBlock;
+        return result;
+    }
+
+    transfer.pBitmap = AddrBitMap;
+    transfer.count = 0;
+    m_cold.compactCount = (m_cold.compactCount >= TRANSFER_END) ? TRANSFER_START : (m_cold.compactCount + 1u);
+    result = _emuEepromBlockScan(lastBlock, lastPage, true, NULL, 0u, &committed, _emuEepromColdCopyEntry, &transfer);
+
+    // same order as a transfer: data, header, then the old block
+    if((result >= 0) && (transfer.count >= 0) && (_emuEepromColdFlush() >= 0) && (_emuEepromDurable(true) >= 0) && 
+        (_emuEepromColdFormat() >= 0) && (_emuEepromDurable(true) >= 0))
+    {
+        _emuEepromBlockReclaim(lastBlock);
+        result = 0;
+    }
+    else
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Visitor copying the newest data of each address into the new cold block.
+    @param entryVAddr - Virtual address of the entry.
+    @param entrySize - Size of the entry data, 0 if erased.
+    @param *pData - Entry data.
+    @param *pContext - Transfer context.
+    @return True to stop the scan on error.
+*///-----------------------------------------------------------------------------
+bool _emuEepromColdCopyEntry(uint16_t entryVAddr, uint16_t entrySize, uint8_t const *pData, void *pContext)
+{
+    transfer_context_t *pTransfer = (transfer_context_t *)pContext;
+    uint16_t streak = 0;
+
+    if(entrySize == 0)
+    {
+        _emuEepromSetBit(0u, entryVAddr, pTransfer->pBitmap);
+        return false;
+    }
+
+    for(uint16_t i = 0; i <= entrySize; i++)
+    {
+        if((i < entrySize) && !_emuEepromReadBit(0u, entryVAddr + i, pTransfer->pBitmap))
+        {
+            _emuEepromSetBit(0u, entryVAddr + i, pTransfer->pBitmap);
+            streak++;
+        }
+        else if(streak)
+        {
+            m_stats.copyBytes += streak;
+            if(!_emuEepromColdAppend(entryVAddr + i - streak, &pData[i - streak], streak))
+            {
+                pTransfer->count = -1;
+                return true;
+            }
+
+            streak = 0;
+        }
+    }
+
+    return false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Append an entry to the cold page buffer, programming it when full.
+    @param vAddr - Virtual address of the data.
+    @param *pData - Data, NULL if len is 0.
+    @param len - Amount of bytes, at most MAX_DATA_PER_PAGE, 0 for an erased entry.
+    @return False if the cold block is full.
+*///-----------------------------------------------------------------------------
+bool _emuEepromColdAppend(uint16_t vAddr, uint8_t const *pData, uint16_t len)
+{
+    assert(len <= MAX_DATA_PER_PAGE);
+
+    if(((m_cold.bufferPos + INFO_SIZE + len) > PAGE_CRC_OFFSET) && (_emuEepromColdFlush() < 0))
+    {
+        return false;
+    }
+
+    if(m_cold.currPage >= PAGES_PER_BLOCK)
+    {
+        return false;
+    }
+
+    memcpy(&m_cold.pageBuffer[m_cold.bufferPos + VADDR_OFFSET], &vAddr, sizeof(vAddr));
+    memcpy(&m_cold.pageBuffer[m_cold.bufferPos + SIZE_OFFSET], &len, sizeof(len));
+    if(len)
+    {
+        memcpy(&m_cold.pageBuffer[m_cold.bufferPos + DATA_OFFSET], pData, len);
+    }
+
+    m_cold.bufferPos += (INFO_SIZE + len);
+
+    return true;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Program the cold page buffer.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromColdFlush(void)
+{
+    ssize_t count = 0;
+
+    if(m_cold.bufferPos != BUFFER_START)
+    {
+        uint32_t offset = BLOCK_START_ADDR + (m_cold.block * BLOCK_SIZE) + (m_cold.currPage * PAGE_SIZE);
+        uint16_t calcCrc = _emuEepromPageCrc(m_cold.pageBuffer);
+        memcpy(&m_cold.pageBuffer[PAGE_CRC_OFFSET], &calcCrc, sizeof(calcCrc));
+        count = _emuEepromFlashWrite(offset, m_cold.pageBuffer, PAGE_SIZE);
+        if(count > 0)
+        {
+            m_cold.bufferPos = BUFFER_START;
+            m_cold.currPage++;
+            memset(m_cold.pageBuffer, ERASED, PAGE_SIZE);
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write the header of the cold block.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromColdFormat(void)
+{
+    header_info_t header;
+
+    header.uniqueId = UNIQUE_ID;
+    header.blockNum = m_cold.block;
+    header.blockTotal = block_total;
+    header.transferCount = m_cold.compactCount;
+    header.kind = BLOCK_KIND_COLD;
+
+    ssize_t count = _emuEepromBlockFormat(m_cold.block, header);
+    if(count > 0)
+    {
+        m_cold.formatted = true;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read from flash, or from RAM if the block is cached.
+    @param offset - Offset from start of flash to read from.
+    @param *pBuff - Buffer to store read data.
+    @param numBytes - Number of byte to be read.
+    @return Number of bytes read or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromFlashRead(uint32_t offset, void *pBuff, size_t numBytes)
+{
+    ssize_t count = 0;
+    uint32_t block = (offset - BLOCK_START_ADDR) / BLOCK_SIZE;
+    uint32_t blockOffset = (offset - BLOCK_START_ADDR) % BLOCK_SIZE;
+
+    if(m_share.pImage != NULL)
+    {
+        // readers of a shared image go straight to the mapping, the writer holds the rest
+        memcpy(pBuff, &m_share.pImage[offset], numBytes);
+        count = numBytes;
+        m_stats.flashBytesRead += numBytes;
+    }
+    else if((block < BLOCK_COUNT) && (m_cache.pBlock[block] != NULL) && ((blockOffset + numBytes) <= BLOCK_SIZE))
+    {
+        memcpy(pBuff, &m_cache.pBlock[block][blockOffset], numBytes);
+        count = numBytes;
+        m_stats.cacheHits++;
+        m_stats.flashBytesSaved += numBytes;
+    }
+    else
+    {
+        count = flashRead(offset, pBuff, numBytes);
+        m_stats.cacheMisses++;
+        m_stats.flashBytesRead += numBytes;
+
+        // pages in the ring are newer than flash
+        uint32_t ringEnd = m_ring.offset + (m_ring.count * PAGE_SIZE);
+        if((count > 0) && m_ring.count && (offset < ringEnd) && ((offset + numBytes) > m_ring.offset))
+        {
+            uint32_t start = (offset > m_ring.offset) ? offset : m_ring.offset;
+            uint32_t end = ((offset + numBytes) < ringEnd) ? (offset + numBytes) : ringEnd;
+            memcpy((uint8_t *)pBuff + (start - offset), &m_ring.pages[start - m_ring.offset], end - start);
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write to flash and to the cached copy of the block.
+    @param offset - Offset from start of flash to write to.
+    @param *pBuff - Buffer with the data to be written.
+    @param numBytes - Number of byte to be written.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromFlashWrite(uint32_t offset, void const *pBuff, size_t numBytes)
+{
+    uint32_t block = (offset - BLOCK_START_ADDR) / BLOCK_SIZE;
+    uint32_t blockOffset = (offset - BLOCK_START_ADDR) % BLOCK_SIZE;
+
+    if(block < BLOCK_COUNT)
+    {
+        m_erase.blank[block] = false;
+    }
+
+    // keep program order, the ring holds older pages
+    ssize_t count = _emuEepromRingDrain();
+    if(count >= 0)
+    {
+        count = flashWrite(offset, pBuff, numBytes);
+    }
+
+    if((count > 0) && (block < BLOCK_COUNT) && (m_cache.pBlock[block] != NULL))
+    {
+        memcpy(&m_cache.pBlock[block][blockOffset], pBuff, count);
+    }
+
+    if(count > 0)
+    {
+        _emuEepromShareProgrammed(offset, count);
+        _emuEepromMirrorProgrammed(offset, pBuff, count);
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Hold a flushed page of the current block in the ring, so the next pages
+    can be staged before it is programmed. A full ring is programmed in one write.
+    @param offset - Flash offset of the page.
+    @param *pPage - The page, with its CRC.
+    @return Amount of bytes taken or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromRingPush(uint32_t offset, uint8_t const *pPage)
+{
+    uint32_t block = (offset - BLOCK_START_ADDR) / BLOCK_SIZE;
+    uint32_t blockOffset = (offset - BLOCK_START_ADDR) % BLOCK_SIZE;
+
+    // only the page right after the ring joins it
+    if(m_ring.count && (offset != (m_ring.offset + (m_ring.count * PAGE_SIZE))) && (_emuEepromRingDrain() < 0))
+    {
+        return -1;
+    }
+
+    if(m_ring.count == 0)
+    {
+        m_ring.offset = offset;
+    }
+
+    if(block < BLOCK_COUNT)
+    {
+        m_erase.blank[block] = false;
+    }
+
+    memcpy(&m_ring.pages[m_ring.count * PAGE_SIZE], pPage, PAGE_SIZE);
+    m_ring.count++;
+    if((block < BLOCK_COUNT) && (m_cache.pBlock[block] != NULL))
+    {
+        memcpy(&m_cache.pBlock[block][blockOffset], pPage, PAGE_SIZE);
+    }
+
+    // the flush and dsync modes expect a flushed page on flash
+    bool program = ((m_ring.count >= m_ring.depth) || (m_durable.mode == durable_flush) || (m_durable.mode == durable_dsync));
+    if(program && (_emuEepromRingDrain() < 0))
+    {
+        return -1;
+    }
+
+    return PAGE_SIZE;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Program every page held in the ring.
+    @param None
+    @return Amount of bytes written to flash or negative number if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromRingDrain(void)
+{
+    ssize_t count = 0;
+
+    if(m_ring.count)
+    {
+        count = flashWrite(m_ring.offset, m_ring.pages, m_ring.count * PAGE_SIZE);
+        if(count > 0)
+        {
+            m_stats.pagesProgrammed += m_ring.count;
+            m_stats.programCalls++;
+            m_ring.count = 0;
+            _emuEepromShareProgrammed(m_ring.offset, count);
+            _emuEepromMirrorProgrammed(m_ring.offset, m_ring.pages, count);
+        }
+        else
+        {
+            count = -1;
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Start a change readers of a shared image must not see half done, such as
+    a transfer. Changes nest, readers retry until the outermost one ends.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromShareBegin(void)
+{
+    if(m_share.writer && (m_share.depth++ == 0u))
+    {
+        // left odd if a writer died mid change
+        uint32_t generation = __atomic_load_n(&m_share.pMeta->generation, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_share.pMeta->generation, generation | 1u, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief End a change and publish the blocks and programmed pages readers scan.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromShareEnd(void)
+{
+    if(m_share.writer && (--m_share.depth == 0u))
+    {
+        share_meta_t *pMeta = m_share.pMeta;
+        bool cold = (m_cold.block < block_total) && m_cold.formatted;
+
+        __atomic_store_n(&pMeta->currBlock, m_info.currBlock, __ATOMIC_RELAXED);
+        __atomic_store_n(&pMeta->currPage, (m_info.currBlock < block_total) ? m_share.programmed[m_info.currBlock] : 0u, __ATOMIC_RELAXED);
+        __atomic_store_n(&pMeta->coldBlock, cold ? m_cold.block : block_error, __ATOMIC_RELAXED);
+        __atomic_store_n(&pMeta->coldPage, cold ? m_share.programmed[m_cold.block] : 0u, __ATOMIC_RELAXED);
+        __atomic_store_n(&pMeta->generation, __atomic_load_n(&pMeta->generation, __ATOMIC_RELAXED) + 1u, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Note pages that reached flash and, outside a change, publish them. Queued
+    writes are waited for first, readers only see what landed.
+    @param offset - Offset from start of flash that was written.
+    @param numBytes - Number of bytes written.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromShareProgrammed(uint32_t offset, size_t numBytes)
+{
+    uint32_t block = (offset - BLOCK_START_ADDR) / BLOCK_SIZE;
+    uint16_t endPage = ((((offset - BLOCK_START_ADDR) % BLOCK_SIZE) + numBytes) + (PAGE_SIZE - 1u)) / PAGE_SIZE;
+
+    if(!m_share.writer || (block >= BLOCK_COUNT))
+    {
+        return;
+    }
+
+    flashMap(offset, numBytes);
+    if(endPage > m_share.programmed[block])
+    {
+        m_share.programmed[block] = endPage;
+    }
+
+    _emuEepromShareBegin();
+    _emuEepromShareEnd();
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy what was just programmed to the mirror, or hold its pages back and
+    copy them all once a page past the lag comes. Only whole pages are held, a write to part
+    of a page updates its held copy or else goes to the mirror right away.
+    @param offset - Offset from start of flash that was written.
+    @param *pBuff - The bytes written.
+    @param numBytes - Number of bytes written.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromMirrorProgrammed(uint32_t offset, void const *pBuff, size_t numBytes)
+{
+    uint8_t const *pBytes = pBuff;
+
+    if(!m_mirror.enabled)
+    {
+        return;
+    }
+
+    for(uint32_t page = offset - (offset % PAGE_SIZE); page < (offset + numBytes); page += PAGE_SIZE)
+    {
+        uint32_t start = (page > offset) ? page : offset;
+        uint32_t end = ((page + PAGE_SIZE) < (offset + numBytes)) ? (page + PAGE_SIZE) : (offset + numBytes);
+        uint16_t held = 0;
+        while((held < m_mirror.count) && (m_mirror.offsets[held] != page))
+        {
+            held++;
+        }
+
+        if(held < m_mirror.count)
+        {
+            memcpy(&m_mirror.pages[held][start - page], &pBytes[start - offset], end - start);
+        }
+        else if(!m_mirror.lag || ((end - start) < PAGE_SIZE))
+        {
+            if(flashMirrorWrite(start, &pBytes[start - offset], end - start) == (ssize_t)(end - start))
+            {
+                m_stats.mirrorPages++;
+            }
+        }
+        else
+        {
+            if(m_mirror.count >= m_mirror.lag)
+            {
+                _emuEepromMirrorCopy();
+            }
+
+            m_mirror.offsets[m_mirror.count] = page;
+            memcpy(m_mirror.pages[m_mirror.count], &pBytes[start - offset], PAGE_SIZE);
+            m_mirror.count++;
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase a block of the mirror along with the flash. Pages of it still held
+    back are dropped, they are blank now.
+    @param block - The erased block.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromMirrorErased(blocks_t block)
+{
+    uint16_t kept = 0;
+
+    if(!m_mirror.enabled)
+    {
+        return;
+    }
+
+    for(uint16_t i = 0; i < m_mirror.count; i++)
+    {
+        if(((m_mirror.offsets[i] - BLOCK_START_ADDR) / BLOCK_SIZE) != block)
+        {
+            m_mirror.offsets[kept] = m_mirror.offsets[i];
+            memcpy(m_mirror.pages[kept], m_mirror.pages[i], PAGE_SIZE);
+            kept++;
+        }
+    }
+
+    m_mirror.count = kept;
+    flashMirrorErase(block, 1);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy every page held back to the mirror, pages that follow each other in
+    flash in one write.
+    @param None
+    @return Amount of pages copied or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromMirrorCopy(void)
+{
+    ssize_t count = 0;
+
+    for(uint16_t i = 0; i < m_mirror.count;)
+    {
+        uint16_t run = 1;
+        while(((i + run) < m_mirror.count) && (m_mirror.offsets[i + run] == (m_mirror.offsets[i] + (run * PAGE_SIZE))))
+        {
+            run++;
+        }
+
+        if(flashMirrorWrite(m_mirror.offsets[i], m_mirror.pages[i], run * PAGE_SIZE) != (ssize_t)(run * PAGE_SIZE))
+        {
+            count = -1;
+            break;
+        }
+
+        count += run;
+        i += run;
+    }
+
+    if(count > 0)
+    {
+        m_stats.mirrorPages += count;
+    }
+
+    m_mirror.count = 0;
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Bring the mirror up to date by comparing it with flash page by page. Only
+    divergent pages are copied, a block is erased first if one of them cannot be
+    programmed over, since pages of flash are only programmed once.
+    @param None
+    @return Amount of pages copied or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromMirrorSync(void)
+{
+    static uint8_t flash[BLOCK_SIZE];
+    static uint8_t mirror[BLOCK_SIZE];
+    ssize_t count = 0;
+
+    m_mirror.count = 0;
+    for(blocks_t block = block_start; (block < block_total) && (count >= 0); block++)
+    {
+        uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block);
+        bool erase = false;
+        if((flashRead(offset, flash, BLOCK_SIZE) != BLOCK_SIZE) || (flashMirrorRead(offset, mirror, BLOCK_SIZE) != BLOCK_SIZE))
+        {
+            count = -1;
+            break;
+        }
+
+        for(uint32_t i = 0; (i < BLOCK_SIZE) && !erase; i++)
+        {
+            erase = ((mirror[i] != flash[i]) && (mirror[i] != ERASED));
+        }
+
+        if(erase)
+        {
+            flashMirrorErase(block, 1);
+            memset(mirror, ERASED, BLOCK_SIZE);
+        }
+
+        for(uint32_t i = 0; (i < BLOCK_SIZE) && (count >= 0); i += PAGE_SIZE)
+        {
+            if(memcmp(&flash[i], &mirror[i], PAGE_SIZE))
+            {
+                count = (flashMirrorWrite(offset + i, &flash[i], PAGE_SIZE) == PAGE_SIZE) ? (count + 1) : -1;
+            }
+        }
+    }
+
+    if(count > 0)
+    {
+        m_stats.mirrorResyncPages += count;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Verify as many pages as the scrub budget has built up, at most SCRUB_BATCH,
+    then relocate the live data of a block found with a corrupt page if asked to.
+    @param None
+    @return Amount of pages verified or negative if error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _emuEepromScrubStep(void)
+{
+    uint64_t nowUs = _emuEepromNowUs();
+    blocks_t corruptBlock = block_error;
+    ssize_t count = 0;
+
+    m_scrub.credit += (nowUs - m_scrub.lastUs) * m_scrub.pagesPerSec;
+    m_scrub.credit = (m_scrub.credit > (SCRUB_BURST * (uint64_t)US_PER_SEC)) ? (SCRUB_BURST * (uint64_t)US_PER_SEC) : m_scrub.credit;
+    m_scrub.lastUs = nowUs;
+
+    for(uint16_t skipped = 0; (count < SCRUB_BATCH) && (m_scrub.credit >= US_PER_SEC) && (skipped <= block_total); )
+    {
+        // blocks not in use and pages past the last programmed one are not read
+        if((m_scrub.block >= block_total) || (m_scrub.page >= _emuEepromScrubLimit(m_scrub.block)))
+        {
+            m_scrub.page = 0;
+            m_scrub.block = (m_scrub.block >= block_total) ? block_start : (m_scrub.block + 1u);
+            if(m_scrub.block >= block_total)
+            {
+                m_stats.scrubPasses++;
+            }
+
+            skipped++;
+            continue;
+        }
+
+        int verified = _emuEepromScrubPage(m_scrub.block, m_scrub.page);
+        if(verified < 0)
+        {
+            m_stats.scrubCorrupt++;
+            corruptBlock = m_scrub.block;
+            if(m_scrub.corrupt != NULL)
+            {
+                m_scrub.corrupt(m_scrub.block, m_scrub.page, m_scrub.pContext);
+            }
+        }
+
+        if(verified != 0)
+        {
+            m_scrub.credit -= US_PER_SEC;
+            m_stats.scrubPages++;
+            count++;
+            skipped = 0;
+        }
+
+        m_scrub.page++;
+    }
+
+    if(m_scrub.relocate && (corruptBlock != block_error))
+    {
+        ssize_t result = 0;
+        if(corruptBlock == m_info.currBlock)
+        {
+            result = _emuEepromFlush();
+            if((result >= 0) && (m_info.currBlock == corruptBlock))
+            {
+                result = _emuEepromBlockTransfer();
+            }
+        }
+        else if(corruptBlock == m_cold.block)
+        {
+            result = _emuEepromColdCompact();
+        }
+
+        m_stats.scrubRelocations++;
+        count = (result < 0) ? result : count;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Verify the CRC of a header or page straight from flash, the block cache
+    could hide a change.
+    @param block - The block.
+    @param page - The page, 0 for the header.
+    @return 1 if it matches, 0 if the page was not read, -1 if it is corrupt.
+*///-----------------------------------------------------------------------------
+int _emuEepromScrubPage(blocks_t block, uint16_t page)
+{
+    uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block) + (page * PAGE_SIZE);
+    uint8_t pageBuffer[PAGE_SIZE];
+
+    // pages still in the ring are checked once programmed
+    if(m_ring.count && (offset >= m_ring.offset) && (offset < (m_ring.offset + (m_ring.count * PAGE_SIZE))))
+    {
+        return 0;
+    }
+
+    if(flashRead(offset, pageBuffer, PAGE_SIZE) != PAGE_SIZE)
+    {
+        return -1;
+    }
+
+    m_stats.flashBytesRead += PAGE_SIZE;
+    if(page == 0u)
+    {
+        header_info_t header;
+        memcpy(&header, pageBuffer, sizeof(header));
+        bool legacy = (header.format == ERASED_WORD);
+        return ((header.crc == _emuEepromHeaderCrc(header)) || (legacy && (header.crc == LEGACY_HEADER_CRC))) ? 1 : -1;
+    }
+
+    return _emuEepromPageCrcValid(pageBuffer, _emuEepromBlockLegacy(block)) ? 1 : -1;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Pages of a block the scrubber verifies.
+    @param block - The block.
+    @return First page past the programmed ones, header included, 0 if not in use.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromScrubLimit(blocks_t block)
+{
+    if(block == m_info.currBlock)
+    {
+        return m_info.currPage;
+    }
+
+    if((block == m_cold.block) && m_cold.formatted)
+    {
+        return m_cold.currPage;
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Scrub worker, verifies a batch per hold of the engine lock and sleeps
+    until the budget allows the next page.
+    @param *pArg - Unused.
+    @return NULL
+*///-----------------------------------------------------------------------------
+void *_emuEepromScrubWorker(void *pArg)
+{
+    pthread_mutex_lock(&m_scrub.lock);
+    while(m_scrub.running)
+    {
+        pthread_mutex_unlock(&m_scrub.lock);
+        pthread_mutex_lock(&m_lock);
+        uint64_t waitUs = SCRUB_MAX_WAIT_US;
+        if(m_scrub.pagesPerSec && (_emuEepromScrubStep() >= 0))
+        {
+            waitUs = (US_PER_SEC - (m_scrub.credit % US_PER_SEC)) / m_scrub.pagesPerSec;
+            waitUs = (m_scrub.credit >= US_PER_SEC) ? 0u : ((waitUs < SCRUB_MAX_WAIT_US) ? (waitUs + 1u) : SCRUB_MAX_WAIT_US);
+        }
+
+        pthread_mutex_unlock(&m_lock);
+        pthread_mutex_lock(&m_scrub.lock);
+        if(!waitUs)
+        {
+            // let callers waiting on the engine lock in between batches
+            pthread_mutex_unlock(&m_scrub.lock);
+            sched_yield();
+            pthread_mutex_lock(&m_scrub.lock);
+        }
+        else if(m_scrub.running)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            uint64_t ns = until.tv_nsec + (waitUs * 1000u);
+            until.tv_sec += ns / 1000000000u;
+            until.tv_nsec = ns % 1000000000u;
+            pthread_cond_timedwait(&m_scrub.changed, &m_scrub.lock, &until);
+        }
+    }
+
+    pthread_mutex_unlock(&m_scrub.lock);
+
+    return pArg;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Copy a block into RAM if the budget has a free slot.
+    @param block - The block to cache.
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromCacheHold(blocks_t block)
+{
+    if((block < block_total) && (m_cache.pBlock[block] == NULL) && (m_cache.held < m_cache.slots))
+    {
+        uint8_t *pBlock = malloc(BLOCK_SIZE);
+        if(pBlock != NULL)
+        {
+            _emuEepromRingDrain();
+            if(flashRead(BLOCK_START_ADDR + (BLOCK_SIZE * block), pBlock, BLOCK_SIZE) == BLOCK_SIZE)
+            {
+                m_cache.pBlock[block] = pBlock;
+                m_cache.held++;
+            }
+            else
+            {
+                free(pBlock);
+            }
+
+            m_stats.cacheMisses++;
+            m_stats.flashBytesRead += BLOCK_SIZE;
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Drop the cache and fill it again with the current block, then with the
+    other blocks if the budget holds the whole partition.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _emuEepromCacheMount(void)
+{
+    for(blocks_t block = block_start; block < block_total; block++)
+    {
+        free(m_cache.pBlock[block]);
+        m_cache.pBlock[block] = NULL;
+    }
+
+    m_cache.held = 0;
+    _emuEepromCacheHold(m_info.currBlock);
+    if(m_cache.slots >= BLOCK_COUNT)
+    {
+        for(blocks_t block = block_start; block < block_total; block++)
+        {
+            _emuEepromCacheHold(block);
+        }
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Calculate CRC for header.
+    @param info - Header struct to calculate CRC from.
+    @return CRC value.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromHeaderCrc(header_info_t info)
+{
+    // the erase count is programmed on its own before the rest
+    info.crc = ERASED_WORD;
+    info.eraseCount = ERASED_COUNT;
+
+    return _emuEepromCrc(INIT_CRC, &info, sizeof(info));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Calculate CRC for page.
+    @param *pBuffer - Buffer to page data to calculate CRC from.
+    @return CRC value.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromPageCrc(uint8_t const *pBuffer)
+{
+    return _emuEepromCrc(INIT_CRC, pBuffer, PAGE_CRC_OFFSET);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check the CRC stored in a page.
+    @param *pBuffer - The page.
+    @param legacy - The page is in a block of the legacy format, where the constant
+    CRC is accepted too. Pages added to such a block since have a real one.
+    @return True if the CRC matches.
+*///-----------------------------------------------------------------------------
+bool _emuEepromPageCrcValid(uint8_t const *pBuffer, bool legacy)
+{
+    uint16_t pageCrc;
+    memcpy(&pageCrc, &pBuffer[PAGE_CRC_OFFSET], sizeof(pageCrc));
+
+    return ((pageCrc == _emuEepromPageCrc(pBuffer)) || (legacy && (pageCrc == LEGACY_PAGE_CRC)));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a block was formatted before page CRCs were computed. Its pages
+    are rewritten with real CRCs when the next transfer or compaction copies them.
+    @param block - The block to check.
+    @return True if the header has no format.
+*///-----------------------------------------------------------------------------
+bool _emuEepromBlockLegacy(blocks_t block)
+{
+    uint32_t offset = BLOCK_START_ADDR + (BLOCK_SIZE * block) + offsetof(header_info_t, format);
+    uint16_t format = HEADER_FORMAT;
+
+    return ((_emuEepromFlashRead(offset, &format, sizeof(format)) >= 0) && (format == ERASED_WORD));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief CRC-16/CCITT, polynomial 0x1021, a nibble at a time.
+    @param crc - Starting value, INIT_CRC or the CRC of the bytes before.
+    @param *pData - Bytes to add.
+    @param numBytes - Amount of bytes.
+    @return CRC value.
+*///-----------------------------------------------------------------------------
+uint16_t _emuEepromCrc(uint16_t crc, void const *pData, size_t numBytes)
+{
+    static uint16_t const table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+    uint8_t const *pBytes = pData;
+
+    for(size_t i = 0; i < numBytes; i++)
+    {
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (pBytes[i] >> 4)];
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (pBytes[i] & 0x0F)];
+    }
+
+    return crc;
 }
\ No newline at end of file
@@ -1,208 +1,605 @@
-/*
-* flash.c
-*/
-
-#include <assert.h>
-#include <fcntl.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include <flash.h>
-
-#define BYTES_PER_LINE 8u
-
-static int m_fd = 0;
-
-/*!------------------------------------------------------------------------------
-    @brief Initializes flash by setting bin file to all 0xFF.
-    @return File descriptor or -1 if an error occured.
-*///-----------------------------------------------------------------------------
-int flashInit(void)
-{
-    assert(!m_fd);
-
-    if(access("flash.bin", F_OK) != -1)
-    {
-        m_fd = open("flash.bin", O_RDWR);
-    }
-    else
-    {
-        printf("Creating file..\n");
-        m_fd = open("flash.bin", O_RDWR | O_CREAT);
-        if(m_fd >= 0)
-        {
-            for(int i = 0; i < (FLASH_SIZE / BLOCK_SIZE); i++)
-            {
-                for(int u = 0; u < (BLOCK_SIZE / PAGE_SIZE); u++)
-                {
-                    uint8_t buffer[PAGE_SIZE];
-                    memset(buffer, 0xFF, sizeof(buffer));
-
-                    off_t loc = ((i * BLOCK_SIZE) + (u * PAGE_SIZE));
-                    
-                    off_t pos = lseek(m_fd, loc, SEEK_SET);
-                    if(pos == loc)
-                    {
-                        int count = write(m_fd, buffer, sizeof(buffer));
-                        if(count < 0)
-                        {
-                            printf("Error initializing file.\n");
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    return m_fd;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Write buffer to binary file.
-    @param offset - Offset from start of file to write to.
-    @param *pBuffer - Buffer with the data to be written.
-    @param numBytes - Number of byte to be written.
-    @return Number of bytes written or -1 if an error occured.
-*///-----------------------------------------------------------------------------
-ssize_t flashWrite(off_t offset, void const *pBuff, size_t numBytes)
-{
-    assert(m_fd);
-    assert(numBytes);
-
-    ssize_t count;
-    off_t pos = lseek(m_fd, offset, SEEK_SET);
-    if(pos == offset)
-    {
-        count = write(m_fd, pBuff, numBytes);
-        if(count < 0)
-        {
-            printf("Error writing to file.\n");
-        }
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Read binary file to buffer.
-    @param offset - Offset from start of file to read from.
-    @param *pBuffer - Buffer to store read data.
-    @param numBytes - Number of byte to be read.
-    @return Number of bytes written or -1 if an error occured.
-*///-----------------------------------------------------------------------------
-ssize_t flashRead(off_t offset, void *pBuff, size_t numBytes)
-{
-    assert(m_fd);
-    assert(numBytes);
-
-    ssize_t count = 0;
-
-    off_t pos = lseek(m_fd, offset, SEEK_SET);
-    if(pos == offset)
-    {
-        count = read(m_fd, pBuff, numBytes);
-        if(count < 0)
-        {
-            printf("Error reading from file.\n");
-        }
-    }
-
-    return count;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Erase a block by writting all 0xFF.
-    @param blockNum - Which block to start erasing.
-    @param blockCount - Amount of blocks from blockNum to erase.
-    @return None.
-*///-----------------------------------------------------------------------------
-void flashBlockErase(int blockNum, int blockCount)
-{
-    assert(m_fd);
-    assert(((blockNum * BLOCK_SIZE) + (blockCount * BLOCK_SIZE)) <= (FLASH_SIZE - BLOCK_SIZE));
-    
-    for(int i = 0; i < blockCount; i++)
-    {
-        for(int u = 0; u < (BLOCK_SIZE / PAGE_SIZE); u++)
-        {
-            uint8_t buffer[PAGE_SIZE];
-            memset(buffer, 0xFF, PAGE_SIZE);
-
-            off_t loc = ((blockNum * BLOCK_SIZE) + (i * BLOCK_SIZE) + (u * PAGE_SIZE));
-            
-            off_t pos = lseek(m_fd, loc, SEEK_SET);
-            if(pos == loc)
-            {
-                int count = write(m_fd, buffer, PAGE_SIZE);
-                if(count < 0)
-                {
-                    printf("Error erasing block.\n");
-                }
-            }
-            else
-            {
-                printf("Error erasing block.\n");
-            }
-            
-        }
-    }
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Dumps flash values.
-    @param start - Starting location in flash.
-    @param bytes - Amount of bytes to display
-    @return None.
-*///-----------------------------------------------------------------------------
-void flashDump(uint32_t address, uint32_t bytes)
-{
-    // will display aligned
-    uint32_t startAddr = address - (address % BYTES_PER_LINE);
-    uint8_t lines = bytes / BYTES_PER_LINE;
-    uint8_t buffer[BYTES_PER_LINE] = {0};
-
-    if((bytes % BYTES_PER_LINE) != 0)
-    {
-        lines++;
-    }
-
-    if((address + bytes) > (lines * BYTES_PER_LINE))
-    {
-        lines++;
-    }
-
-    for(int i = 0; i < lines; i++)
-    {
-        printf("0x%08x |", (startAddr + (i * BYTES_PER_LINE)));
-        ssize_t amount = flashRead(startAddr + (i * BYTES_PER_LINE), buffer, BYTES_PER_LINE);
-        if(amount == BYTES_PER_LINE)
-        {
-            for(int u = 0; u < BYTES_PER_LINE; u++)
-            {
-                if((startAddr + (i * BYTES_PER_LINE) + u) == address)
-                {
-                    printf("[%02x ", buffer[u]);
-                }
-                else if(((i * BYTES_PER_LINE) + u) == (bytes + address - 1))
-                {
-                    printf(" %02x]", buffer[u]);
-                }
-                else
-                {
-                    printf(" %02x ", buffer[u]);
-                }
-            }
-
-            printf("| %c%c%c%c%c%c%c%c\n", (char)buffer[0], \
-                (char)buffer[1], (char)buffer[2], (char)buffer[3], \
-                (char)buffer[4], (char)buffer[5], (char)buffer[6], (char)buffer[7]);
-        }
-    }
+/*
+* flash.c
+*/
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <flash.h>
+#ifdef FLASH_URING
+    #include <flash_uring.h>
+#endif
+
+#define BYTES_PER_LINE 8u
+#define FILL_BLOCKS 64u // erased blocks programmed by one writev
+#define SHARED_FILE "flash.shm" // state shared by the processes using flash.bin
+#define MIRROR_FILE "mirror.bin" // secondary copy of flash.bin
+
+static int m_fd = 0;
+static uint32_t m_queueDepth = 0; // 0 uses blocking writes
+static uint8_t const *m_pMap = NULL; // read only view of the whole file, mapped on first use
+static int m_sharedFd = 0;
+static void *m_pShared = NULL;
+static size_t m_sharedSize = 0;
+static int m_mirrorFd = 0;
+
+ssize_t _flashFill(int fd, off_t offset, size_t numBytes);
+
+/*!------------------------------------------------------------------------------
+    @brief Initializes flash by setting bin file to all 0xFF.
+    @return File descriptor or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+int flashInit(void)
+{
+    assert(!m_fd);
+
+    if(access("flash.bin", F_OK) != -1)
+    {
+        m_fd = open("flash.bin", O_RDWR);
+    }
+    else
+    {
+        printf("Creating file..\n");
+        m_fd = open("flash.bin", O_RDWR | O_CREAT, 0644);
+        if((m_fd >= 0) && (_flashFill(m_fd, 0, FLASH_SIZE) < 0))
+        {
+            printf("Error initializing file.\n");
+        }
+    }
+
+    return m_fd;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write buffer to binary file.
+    @param offset - Offset from start of file to write to.
+    @param *pBuffer - Buffer with the data to be written.
+    @param numBytes - Number of byte to be written.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashWrite(off_t offset, void const *pBuff, size_t numBytes)
+{
+    assert(m_fd);
+    assert(numBytes);
+
+#ifdef FLASH_URING
+    if(m_queueDepth)
+    {
+        return uringWrite(offset, pBuff, numBytes, 0);
+    }
+#endif
+
+    ssize_t count = pwrite(m_fd, pBuff, numBytes, offset);
+    if(count < 0)
+    {
+        printf("Error writing to file.\n");
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read binary file to buffer.
+    @param offset - Offset from start of file to read from.
+    @param *pBuffer - Buffer to store read data.
+    @param numBytes - Number of byte to be read.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashRead(off_t offset, void *pBuff, size_t numBytes)
+{
+    assert(m_fd);
+    assert(numBytes);
+
+    ssize_t count = 0;
+
+#ifdef FLASH_URING
+    // writes still in flight to this range must land first
+    if(m_queueDepth && (uringWaitRange(offset, numBytes) < 0))
+    {
+        printf("Error writing to file.\n");
+    }
+#endif
+
+    off_t pos = lseek(m_fd, offset, SEEK_SET);
+    if(pos == offset)
+    {
+        count = read(m_fd, pBuff, numBytes);
+        if(count < 0)
+        {
+            printf("Error reading from file.\n");
+        }
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Map flash for reading in place, as memory mapped flash would be read.
+    @param offset - Offset from start of file.
+    @param numBytes - Number of bytes that will be read.
+    @return Pointer to the bytes at offset or NULL if an error occured. Stays valid
+    until flashClose, and shows later writes.
+*///-----------------------------------------------------------------------------
+void const *flashMap(off_t offset, size_t numBytes)
+{
+    assert(m_fd);
+    assert((offset + numBytes) <= FLASH_SIZE);
+
+    if(m_pMap == NULL)
+    {
+        void *pMap = mmap(NULL, FLASH_SIZE, PROT_READ, MAP_SHARED, m_fd, 0);
+        if(pMap == MAP_FAILED)
+        {
+            printf("Error mapping file.\n");
+            return NULL;
+        }
+
+        m_pMap = pMap;
+    }
+
+#ifdef FLASH_URING
+    // writes still in flight to this range must land first
+    if(m_queueDepth && (uringWaitRange(offset, numBytes) < 0))
+    {
+        return NULL;
+    }
+#endif
+
+    return &m_pMap[offset];
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Map memory shared by every process using the flash file, backed by a
+    file next to it. Created zeroed by the first process.
+    @param numBytes - Size of the shared memory, the same in every process.
+    @return Pointer to the shared memory or NULL if an error occured. Stays valid
+    until flashClose.
+*///-----------------------------------------------------------------------------
+void *flashShared(size_t numBytes)
+{
+    assert(m_fd);
+
+    if(m_pShared != NULL)
+    {
+        assert(numBytes == m_sharedSize);
+        return m_pShared;
+    }
+
+    struct stat info;
+    int fd = open(SHARED_FILE, O_RDWR | O_CREAT, 0644);
+    if((fd < 0) || (fstat(fd, &info) < 0) || ((info.st_size < (off_t)numBytes) && (ftruncate(fd, numBytes) < 0)))
+    {
+        printf("Error opening shared file.\n");
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    void *pShared = mmap(NULL, numBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(pShared == MAP_FAILED)
+    {
+        printf("Error mapping shared file.\n");
+        close(fd);
+        return NULL;
+    }
+
+    m_sharedFd = fd;
+    m_pShared = pShared;
+    m_sharedSize = numBytes;
+
+    return m_pShared;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Take the lock writers of the flash file share, it is let go if the
+    process exits. Needs flashShared first.
+    @param wait - Non-zero to wait for it, 0 to fail if another process holds it.
+    @return 0 if successful or -1 if the lock is held or an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashLock(int wait)
+{
+    assert(m_sharedFd);
+
+    return (flock(m_sharedFd, LOCK_EX | (wait ? 0 : LOCK_NB)) < 0) ? -1 : 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Let go of the writer lock.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void flashUnlock(void)
+{
+    assert(m_sharedFd);
+
+    flock(m_sharedFd, LOCK_UN);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase blocks by writting all 0xFF, any amount of blocks in one call.
+    @param blockNum - Which block to start erasing.
+    @param blockCount - Amount of blocks from blockNum to erase.
+    @return None.
+*///-----------------------------------------------------------------------------
+void flashBlockErase(int blockNum, int blockCount)
+{
+    assert(m_fd);
+    assert(((blockNum * BLOCK_SIZE) + (blockCount * BLOCK_SIZE)) <= FLASH_SIZE);
+
+#ifdef FLASH_URING
+    if(m_queueDepth)
+    {
+        if(uringFill(blockNum * BLOCK_SIZE, blockCount * BLOCK_SIZE) < 0)
+        {
+            printf("Error erasing block.\n");
+        }
+
+        return;
+    }
+#endif
+
+    if(_flashFill(m_fd, (off_t)blockNum * BLOCK_SIZE, (size_t)blockCount * BLOCK_SIZE) < 0)
+    {
+        printf("Error erasing block.\n");
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write buffer to binary file and wait until it is durable.
+    @param offset - Offset from start of file to write to.
+    @param *pBuffer - Buffer with the data to be written.
+    @param numBytes - Number of byte to be written.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashWriteSync(off_t offset, void const *pBuff, size_t numBytes)
+{
+    assert(m_fd);
+    assert(numBytes);
+
+#ifdef FLASH_URING
+    if(m_queueDepth)
+    {
+        // the fdatasync is linked to the write, one submission for both
+        return uringWrite(offset, pBuff, numBytes, 1);
+    }
+#endif
+
+    ssize_t count = flashWrite(offset, pBuff, numBytes);
+    if((count > 0) && (flashSync() < 0))
+    {
+        count = -1;
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait until everything written so far is durable.
+    @param None
+    @return 0 if successful or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashSync(void)
+{
+    assert(m_fd);
+
+    ssize_t result = 0;
+
+#ifdef FLASH_URING
+    if(m_queueDepth)
+    {
+        result = uringSync();
+    }
+    else
+#endif
+    {
+        result = fdatasync(m_fd);
+    }
+
+    if(result < 0)
+    {
+        printf("Error syncing file.\n");
+        result = -1;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set how many writes and erases can be in flight. Queued writes return
+    once copied and are submitted through io_uring, a depth of 0 uses blocking writes.
+    @param depth - Amount of requests in flight.
+    @return Depth in use, which is 0 if io_uring is not available.
+*///-----------------------------------------------------------------------------
+uint32_t flashSetQueueDepth(uint32_t depth)
+{
+    assert(m_fd);
+
+#ifdef FLASH_URING
+    if(depth != m_queueDepth)
+    {
+        uringExit();
+        m_queueDepth = 0;
+        if(depth && (uringInit(m_fd, depth) == 0))
+        {
+            m_queueDepth = depth;
+        }
+    }
+#endif
+
+    return m_queueDepth;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reopen the binary file with or without O_DSYNC, so every write returns
+    only once it is durable.
+    @param enable - Non-zero to open with O_DSYNC.
+    @return 0 if successful or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashSetSyncWrites(int enable)
+{
+    assert(m_fd);
+
+    ssize_t result = 0;
+    uint32_t depth = m_queueDepth;
+
+    // the ring holds the old descriptor, finish with it first
+    flashSetQueueDepth(0);
+    int fd = open("flash.bin", O_RDWR | (enable ? O_DSYNC : 0));
+    if(fd >= 0)
+    {
+        close(m_fd);
+        m_fd = fd;
+    }
+    else
+    {
+        printf("Error opening file.\n");
+        result = -1;
+    }
+
+    flashSetQueueDepth(depth);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Open the mirror file, a second flash of the same size, creating it erased.
+    @param None
+    @return File descriptor or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+int flashMirrorInit(void)
+{
+    if(m_mirrorFd > 0)
+    {
+        return m_mirrorFd;
+    }
+
+    bool created = (access(MIRROR_FILE, F_OK) == -1);
+    int fd = open(MIRROR_FILE, O_RDWR | O_CREAT, 0644);
+    if((fd >= 0) && created && (_flashFill(fd, 0, FLASH_SIZE) < 0))
+    {
+        printf("Error initializing mirror file.\n");
+        close(fd);
+        fd = -1;
+    }
+
+    m_mirrorFd = (fd >= 0) ? fd : 0;
+
+    return fd;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write buffer to the mirror file.
+    @param offset - Offset from start of file to write to.
+    @param *pBuffer - Buffer with the data to be written.
+    @param numBytes - Number of byte to be written.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashMirrorWrite(off_t offset, void const *pBuff, size_t numBytes)
+{
+    assert(m_mirrorFd);
+    assert(numBytes);
+
+    ssize_t count = pwrite(m_mirrorFd, pBuff, numBytes, offset);
+    if(count < 0)
+    {
+        printf("Error writing to mirror file.\n");
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read the mirror file to buffer.
+    @param offset - Offset from start of file to read from.
+    @param *pBuffer - Buffer to store read data.
+    @param numBytes - Number of byte to be read.
+    @return Number of bytes read or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t flashMirrorRead(off_t offset, void *pBuff, size_t numBytes)
+{
+    assert(m_mirrorFd);
+    assert(numBytes);
+
+    ssize_t count = pread(m_mirrorFd, pBuff, numBytes, offset);
+    if(count < 0)
+    {
+        printf("Error reading from mirror file.\n");
+    }
+
+    return count;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase blocks of the mirror file.
+    @param blockNum - Which block to start erasing.
+    @param blockCount - Amount of blocks from blockNum to erase.
+    @return None.
+*///-----------------------------------------------------------------------------
+void flashMirrorErase(int blockNum, int blockCount)
+{
+    assert(m_mirrorFd);
+    assert(((blockNum * BLOCK_SIZE) + (blockCount * BLOCK_SIZE)) <= FLASH_SIZE);
+
+    if(_flashFill(m_mirrorFd, (off_t)blockNum * BLOCK_SIZE, (size_t)blockCount * BLOCK_SIZE) < 0)
+    {
+        printf("Error erasing mirror block.\n");
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Finish all writes and close the binary file.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void flashClose(void)
+{
+    if(m_pMap != NULL)
+    {
+        munmap((void *)m_pMap, FLASH_SIZE);
+        m_pMap = NULL;
+    }
+
+    // closing the file lets go of the writer lock
+    if(m_pShared != NULL)
+    {
+        munmap(m_pShared, m_sharedSize);
+        close(m_sharedFd);
+        m_pShared = NULL;
+        m_sharedFd = 0;
+    }
+
+    if(m_mirrorFd > 0)
+    {
+        close(m_mirrorFd);
+        m_mirrorFd = 0;
+    }
+
+    if(m_fd > 0)
+    {
+        flashSetQueueDepth(0);
+        close(m_fd);
+        m_fd = 0;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Fill a range with 0xFF. Every iovec points at the same erased block, so
+    up to FILL_BLOCKS blocks go out in one writev.
+    @param fd - The file.
+    @param offset - Offset from start of file.
+    @param numBytes - Number of bytes to fill.
+    @return Number of bytes written or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+ssize_t _flashFill(int fd, off_t offset, size_t numBytes)
+{
+    uint8_t erased[BLOCK_SIZE];
+    struct iovec iov[FILL_BLOCKS];
+    ssize_t total = 0;
+
+    memset(erased, 0xFF, sizeof(erased));
+    while(numBytes)
+    {
+        size_t len = 0;
+        int count = 0;
+        while((len < numBytes) && (count < (int)FILL_BLOCKS))
+        {
+            iov[count].iov_base = erased;
+            iov[count].iov_len = ((numBytes - len) < BLOCK_SIZE) ? (numBytes - len) : BLOCK_SIZE;
+            len += iov[count].iov_len;
+            count++;
+        }
+
+        if(pwritev(fd, iov, count, offset) != (ssize_t)len)
+        {
+            return -1;
+        }
+
+        offset += len;
+        numBytes -= len;
+        total += len;
+    }
+
+    return total;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Dumps flash values.
+    @param start - Starting location in flash.
+    @param bytes - Amount of bytes to display
+    @return None.
+*///-----------------------------------------------------------------------------
+void flashDump(uint32_t address, uint32_t bytes)
+{
+    // will display aligned
+    uint32_t startAddr = address - (address % BYTES_PER_LINE);
+    uint8_t lines = bytes / BYTES_PER_LINE;
+    uint8_t buffer[BYTES_PER_LINE] = {0};
+
+    if((bytes % BYTES_PER_LINE) != 0)
+    {
+        lines++;
+    }
+
+    if((address + bytes) > (lines * BYTES_PER_LINE))
+    {
+        lines++;
+    }
+
+    for(int i = 0; i < lines; i++)
+    {
+        printf("0x%08x |", (startAddr + (i * BYTES_PER_LINE)));
+        ssize_t amount = flashRead(startAddr + (i * BYTES_PER_LINE), buffer, BYTES_PER_LINE);
+        if(amount == BYTES_PER_LINE)
+        {
+            for(uint16_t u = 0; u < BYTES_PER_LINE; u++)
+            {
+                if((startAddr + (i * BYTES_PER_LINE) + u) == address)
+                {
+                    printf("[%02x ", buffer[u]);
+                }
+                else if(((i * BYTES_PER_LINE) + u) == (bytes + address - 1))
+                {
+                    printf(" %02x]", buffer[u]);
+                }
+                else
+                {
+                    printf(" %02x ", buffer[u]);
+                }
+            }
+
+            printf("| %c%c%c%c%c%c%c%c\n", (char)buffer[0], \
+                (char)buffer[1], (char)buffer[2], (char)buffer[3], \
+                (char)buffer[4], (char)buffer[5], (char)buffer[6], (char)buffer[7]);
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,547 @@
+/*
+* flash_uring.c
+*
+* Notes:
+* - io_uring queue for the flash file, using the raw system calls.
+* - Every request holds a slot until it completes, so the rings can never overflow.
+* - Data is copied into registered slot buffers, erases use one registered buffer of 0xFF.
+* - A request that overlaps one still in flight is drained so order is kept.
+*
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <flash_uring.h>
+
+#define SLOT_SIZE 4096u // one flash block, the largest single request
+#define ERASED 0xFF
+
+typedef struct {
+    off_t offset;
+    size_t numBytes;
+    bool busy;
+} uring_slot_t;
+
+typedef struct {
+    int ringFd;
+    int fd;
+    uint32_t depth;
+    uint32_t *pSqHead;
+    uint32_t *pSqTail;
+    uint32_t *pSqMask;
+    uint32_t *pSqArray;
+    uint32_t *pCqHead;
+    uint32_t *pCqTail;
+    uint32_t *pCqMask;
+    struct io_uring_sqe *pSqes;
+    struct io_uring_cqe *pCqes;
+    void *pSqRing;
+    void *pCqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    uint8_t *pBuffers; // depth slot buffers followed by the erase buffer
+    uring_slot_t *pSlots;
+    uint32_t pending; // queued but not submitted
+    uint32_t inFlight; // queued and not completed
+    int error; // first error since last reported
+} uring_info_t;
+
+int _uringEnter(uint32_t toSubmit, uint32_t minComplete);
+void _uringReap(void);
+ssize_t _uringSlot(void);
+bool _uringOverlaps(off_t offset, size_t numBytes);
+void _uringQueue(uint8_t opcode, uint32_t slot, off_t offset, size_t numBytes, void *pAddr, uint16_t bufIndex, uint8_t flags);
+ssize_t _uringDrain(void);
+void _uringUnlink(void);
+
+static uring_info_t m_uring = {.ringFd = -1};
+
+
+/*!------------------------------------------------------------------------------
+    @brief Set up the ring and register the slot and erase buffers.
+    @param fd - File descriptor of the flash file.
+    @param depth - Amount of requests that can be in flight.
+    @return 0 if successful or negative if io_uring is not available.
+*///-----------------------------------------------------------------------------
+int uringInit(int fd, uint32_t depth)
+{
+    assert(m_uring.ringFd < 0);
+    assert(depth);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_uring.ringFd = syscall(__NR_io_uring_setup, depth, &params);
+    if(m_uring.ringFd < 0)
+    {
+        return -1;
+    }
+
+    m_uring.fd = fd;
+    m_uring.depth = params.sq_entries;
+    m_uring.sqRingSize = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    m_uring.cqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    m_uring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(m_uring.cqRingSize > m_uring.sqRingSize)
+        {
+            m_uring.sqRingSize = m_uring.cqRingSize;
+        }
+
+        m_uring.cqRingSize = m_uring.sqRingSize;
+    }
+
+    m_uring.pSqRing = mmap(NULL, m_uring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_uring.ringFd, IORING_OFF_SQ_RING);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_uring.pCqRing = m_uring.pSqRing;
+    }
+    else
+    {
+        m_uring.pCqRing = mmap(NULL, m_uring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_uring.ringFd, IORING_OFF_CQ_RING);
+    }
+
+    m_uring.pSqes = mmap(NULL, m_uring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_uring.ringFd, IORING_OFF_SQES);
+    m_uring.pBuffers = aligned_alloc(SLOT_SIZE, (m_uring.depth + 1u) * SLOT_SIZE);
+    m_uring.pSlots = calloc(m_uring.depth, sizeof(uring_slot_t));
+    if((m_uring.pSqRing == MAP_FAILED) || (m_uring.pCqRing == MAP_FAILED) || (m_uring.pSqes == MAP_FAILED) || 
+        (m_uring.pBuffers == NULL) || (m_uring.pSlots == NULL))
+    {
+        uringExit();
+        return -1;
+    }
+
+    uint8_t *pSq = m_uring.pSqRing;
+    uint8_t *pCq = m_uring.pCqRing;
+    m_uring.pSqHead = (uint32_t *)(pSq + params.sq_off.head);
+    m_uring.pSqTail = (uint32_t *)(pSq + params.sq_off.tail);
+    m_uring.pSqMask = (uint32_t *)(pSq + params.sq_off.ring_mask);
+    m_uring.pSqArray = (uint32_t *)(pSq + params.sq_off.array);
+    m_uring.pCqHead = (uint32_t *)(pCq + params.cq_off.head);
+    m_uring.pCqTail = (uint32_t *)(pCq + params.cq_off.tail);
+    m_uring.pCqMask = (uint32_t *)(pCq + params.cq_off.ring_mask);
+    m_uring.pCqes = (struct io_uring_cqe *)(pCq + params.cq_off.cqes);
+
+    // one registered buffer per slot, the last one holds erased data
+    struct iovec *pIovecs = calloc(m_uring.depth + 1u, sizeof(struct iovec));
+    if(pIovecs == NULL)
+    {
+        uringExit();
+        return -1;
+    }
+
+    for(uint32_t i = 0; i <= m_uring.depth; i++)
+    {
+        pIovecs[i].iov_base = &m_uring.pBuffers[i * SLOT_SIZE];
+        pIovecs[i].iov_len = SLOT_SIZE;
+    }
+
+    memset(&m_uring.pBuffers[m_uring.depth * SLOT_SIZE], ERASED, SLOT_SIZE);
+    int result = syscall(__NR_io_uring_register, m_uring.ringFd, IORING_REGISTER_BUFFERS, pIovecs, m_uring.depth + 1u);
+    free(pIovecs);
+    if(result < 0)
+    {
+        uringExit();
+        return -1;
+    }
+
+    m_uring.pending = 0;
+    m_uring.inFlight = 0;
+    m_uring.error = 0;
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait for everything in flight and tear down the ring.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void uringExit(void)
+{
+    if(m_uring.ringFd < 0)
+    {
+        return;
+    }
+
+    if(m_uring.pSlots != NULL)
+    {
+        _uringDrain();
+    }
+
+    if((m_uring.pSqes != NULL) && (m_uring.pSqes != MAP_FAILED))
+    {
+        munmap(m_uring.pSqes, m_uring.sqesSize);
+    }
+
+    if((m_uring.pCqRing != NULL) && (m_uring.pCqRing != MAP_FAILED) && (m_uring.pCqRing != m_uring.pSqRing))
+    {
+        munmap(m_uring.pCqRing, m_uring.cqRingSize);
+    }
+
+    if((m_uring.pSqRing != NULL) && (m_uring.pSqRing != MAP_FAILED))
+    {
+        munmap(m_uring.pSqRing, m_uring.sqRingSize);
+    }
+
+    close(m_uring.ringFd);
+    free(m_uring.pBuffers);
+    free(m_uring.pSlots);
+    memset(&m_uring, 0, sizeof(m_uring));
+    m_uring.ringFd = -1;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Queue a write and submit it without waiting.
+    @param offset - Offset from start of file to write to.
+    @param *pBuff - Buffer with the data to be written, copied before returning.
+    @param numBytes - Number of byte to be written.
+    @param durable - Link an fdatasync to the write and wait for it.
+    @return Number of bytes queued or negative if an earlier request failed.
+*///-----------------------------------------------------------------------------
+ssize_t uringWrite(off_t offset, void const *pBuff, size_t numBytes, int durable)
+{
+    uint8_t const *pData = pBuff;
+    size_t queued = 0;
+
+    while(queued < numBytes)
+    {
+        size_t chunk = numBytes - queued;
+        if(chunk > SLOT_SIZE)
+        {
+            chunk = SLOT_SIZE;
+        }
+
+        ssize_t slot = _uringSlot();
+        if(slot < 0)
+        {
+            _uringUnlink();
+            return slot;
+        }
+
+        uint8_t flags = _uringOverlaps(offset + queued, chunk) ? IOSQE_IO_DRAIN : 0u;
+        if(durable)
+        {
+            flags |= IOSQE_IO_LINK;
+        }
+
+        uint8_t *pSlotBuff = &m_uring.pBuffers[slot * SLOT_SIZE];
+        memcpy(pSlotBuff, &pData[queued], chunk);
+        _uringQueue(IORING_OP_WRITE_FIXED, slot, offset + queued, chunk, pSlotBuff, slot, flags);
+        queued += chunk;
+    }
+
+    if(durable)
+    {
+        // fsync ends the link chain so it only runs after the write succeeded
+        ssize_t slot = _uringSlot();
+        if(slot < 0)
+        {
+            // without the fsync the chain must not reach the next request queued
+            _uringUnlink();
+            return slot;
+        }
+
+        _uringQueue(IORING_OP_FSYNC, slot, 0, 0, NULL, 0, 0u);
+        m_uring.pSqes[(*m_uring.pSqTail - 1u) & *m_uring.pSqMask].fsync_flags = IORING_FSYNC_DATASYNC;
+        ssize_t result = _uringDrain();
+        if(result < 0)
+        {
+            return result;
+        }
+    }
+    else
+    {
+        _uringEnter(m_uring.pending, 0u);
+    }
+
+    return queued;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Queue writes of erased data, all submitted in one batch.
+    @param offset - Offset from start of file to erase.
+    @param numBytes - Number of byte to erase.
+    @return Number of bytes queued or negative if an earlier request failed.
+*///-----------------------------------------------------------------------------
+ssize_t uringFill(off_t offset, size_t numBytes)
+{
+    size_t queued = 0;
+
+    while(queued < numBytes)
+    {
+        size_t chunk = numBytes - queued;
+        if(chunk > SLOT_SIZE)
+        {
+            chunk = SLOT_SIZE;
+        }
+
+        ssize_t slot = _uringSlot();
+        if(slot < 0)
+        {
+            return slot;
+        }
+
+        uint8_t flags = _uringOverlaps(offset + queued, chunk) ? IOSQE_IO_DRAIN : 0u;
+        _uringQueue(IORING_OP_WRITE_FIXED, slot, offset + queued, chunk, &m_uring.pBuffers[m_uring.depth * SLOT_SIZE], m_uring.depth, flags);
+        queued += chunk;
+    }
+
+    _uringEnter(m_uring.pending, 0u);
+
+    return queued;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Make everything queued so far durable.
+    @param None
+    @return 0 if successful or negative if a request failed.
+*///-----------------------------------------------------------------------------
+ssize_t uringSync(void)
+{
+    ssize_t slot = _uringSlot();
+    if(slot < 0)
+    {
+        return slot;
+    }
+
+    // drain orders the fsync after every request before it
+    _uringQueue(IORING_OP_FSYNC, slot, 0, 0, NULL, 0, IOSQE_IO_DRAIN);
+    m_uring.pSqes[(*m_uring.pSqTail - 1u) & *m_uring.pSqMask].fsync_flags = IORING_FSYNC_DATASYNC;
+
+    return _uringDrain();
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Wait until nothing in flight overlaps a range, before reading it.
+    @param offset - Offset from start of file.
+    @param numBytes - Number of bytes.
+    @return 0 if successful or negative if a request failed.
+*///-----------------------------------------------------------------------------
+ssize_t uringWaitRange(off_t offset, size_t numBytes)
+{
+    ssize_t result = 0;
+
+    if(_uringOverlaps(offset, numBytes))
+    {
+        result = _uringDrain();
+    }
+    else if(m_uring.error)
+    {
+        result = m_uring.error;
+        m_uring.error = 0;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Submit queued requests and optionally wait for completions.
+    @param toSubmit - Amount of requests to submit.
+    @param minComplete - Amount of completions to wait for.
+    @return Result of io_uring_enter.
+*///-----------------------------------------------------------------------------
+int _uringEnter(uint32_t toSubmit, uint32_t minComplete)
+{
+    int result = 0;
+
+    if(toSubmit || minComplete)
+    {
+        uint32_t flags = minComplete ? IORING_ENTER_GETEVENTS : 0u;
+        do
+        {
+            result = syscall(__NR_io_uring_enter, m_uring.ringFd, toSubmit, minComplete, flags, NULL, 0);
+        } while((result < 0) && (errno == EINTR));
+
+        if(result > 0)
+        {
+            m_uring.pending -= ((uint32_t)result < m_uring.pending) ? (uint32_t)result : m_uring.pending;
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Free the slots of all completed requests.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _uringReap(void)
+{
+    uint32_t head = *m_uring.pCqHead;
+    uint32_t tail = __atomic_load_n(m_uring.pCqTail, __ATOMIC_ACQUIRE);
+
+    while(head != tail)
+    {
+        struct io_uring_cqe *pCqe = &m_uring.pCqes[head & *m_uring.pCqMask];
+        uring_slot_t *pSlot = &m_uring.pSlots[pCqe->user_data];
+        
+        // short writes are errors, fsyncs have no length
+        if((pCqe->res < 0) || ((size_t)pCqe->res < pSlot->numBytes))
+        {
+            if(m_uring.error == 0)
+            {
+                m_uring.error = (pCqe->res < 0) ? pCqe->res : -EIO;
+            }
+        }
+
+        pSlot->busy = false;
+        m_uring.inFlight--;
+        head++;
+    }
+
+    __atomic_store_n(m_uring.pCqHead, head, __ATOMIC_RELEASE);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Get a free slot, waiting for a completion if all are in use.
+    @param None
+    @return Slot index or negative if an earlier request failed.
+*///-----------------------------------------------------------------------------
+ssize_t _uringSlot(void)
+{
+    _uringReap();
+    while(m_uring.inFlight == m_uring.depth)
+    {
+        _uringEnter(m_uring.pending, 1u);
+        _uringReap();
+    }
+
+    if(m_uring.error)
+    {
+        ssize_t result = m_uring.error;
+        m_uring.error = 0;
+        return result;
+    }
+
+    for(uint32_t i = 0; i < m_uring.depth; i++)
+    {
+        if(!m_uring.pSlots[i].busy)
+        {
+            return i;
+        }
+    }
+
+    return -EBUSY;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check if a range overlaps a request that is still in flight.
+    @param offset - Offset from start of file.
+    @param numBytes - Number of bytes.
+    @return True if it overlaps.
+*///-----------------------------------------------------------------------------
+bool _uringOverlaps(off_t offset, size_t numBytes)
+{
+    _uringReap();
+
+    for(uint32_t i = 0; i < m_uring.depth; i++)
+    {
+        uring_slot_t *pSlot = &m_uring.pSlots[i];
+        if(pSlot->busy && pSlot->numBytes && (pSlot->offset < (off_t)(offset + numBytes)) && (offset < (off_t)(pSlot->offset + pSlot->numBytes)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Fill in the next submission entry.
+    @param opcode - io_uring operation.
+    @param slot - Slot the request holds until it completes.
+    @param offset - Offset from start of file.
+    @param numBytes - Number of bytes.
+    @param *pAddr - Buffer of the request.
+    @param bufIndex - Registered buffer index.
+    @param flags - Submission flags.
+    @return None
+*///-----------------------------------------------------------------------------
+void _uringQueue(uint8_t opcode, uint32_t slot, off_t offset, size_t numBytes, void *pAddr, uint16_t bufIndex, uint8_t flags)
+{
+    uint32_t tail = *m_uring.pSqTail;
+    uint32_t index = tail & *m_uring.pSqMask;
+    struct io_uring_sqe *pSqe = &m_uring.pSqes[index];
+
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = opcode;
+    pSqe->flags = flags;
+    pSqe->fd = m_uring.fd;
+    pSqe->off = offset;
+    pSqe->addr = (uintptr_t)pAddr;
+    pSqe->len = numBytes;
+    pSqe->buf_index = bufIndex;
+    pSqe->user_data = slot;
+
+    m_uring.pSlots[slot].offset = offset;
+    m_uring.pSlots[slot].numBytes = numBytes;
+    m_uring.pSlots[slot].busy = true;
+    m_uring.pSqArray[index] = index;
+    m_uring.pending++;
+    m_uring.inFlight++;
+    __atomic_store_n(m_uring.pSqTail, tail + 1u, __ATOMIC_RELEASE);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Submit everything and wait until nothing is in flight.
+    @param None
+    @return 0 if successful or negative if a request failed.
+*///-----------------------------------------------------------------------------
+ssize_t _uringDrain(void)
+{
+    ssize_t result = 0;
+
+    _uringReap();
+    while(m_uring.inFlight)
+    {
+        _uringEnter(m_uring.pending, 1u);
+        _uringReap();
+    }
+
+    if(m_uring.error)
+    {
+        result = m_uring.error;
+        m_uring.error = 0;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief End a link chain left open, clears IOSQE_IO_LINK on the newest request if
+    it has not been submitted yet.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void _uringUnlink(void)
+{
+    if(m_uring.pending)
+    {
+        m_uring.pSqes[(*m_uring.pSqTail - 1u) & *m_uring.pSqMask].flags &= ~IOSQE_IO_LINK;
+    }
+}
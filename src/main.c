@@ -1,165 +1,252 @@
-/*
-* main.c
-*/
-
-#include <stdio.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-
-#include <emueeprom.h>
-#include <flash.h>
-#include <test.h>
-
-#define INPUT_MAX_SIZE 32u
-
-int main()
-{
-    char str[INPUT_MAX_SIZE];
-    int iVAddr = 0;
-    int iValue = 0;
-    ssize_t count = 0;
-
-    int fd = flashInit();
-    if(fd < 0)
-    {
-        printf("fd: %d\n", fd);
-        return -1;
-    }  
-
-    emuEepromInit();
-    printf("Limited functionality.\n");
-
-    while(1)
-    {
-        printf("> ");
-        fgets(str, INPUT_MAX_SIZE, stdin);
-
-        if(!strcmp(str, "?\n") || !strcmp(str, "help\n"))
-        {
-            printf("'write'             - write decimal value to virtual address\n"
-                    "'read'              - read decimal value stored at virtual address\n"
-                    "'erase'             - erase data at virtual address\n"
-                    "'flush'             - write current buffer to flash\n"
-                    "'destroy'           - erases emulated eeprom from flash\n"
-                    "'view'              - view areas of flash\n"
-                    "'test'              - run emueeprom tests (warning: erases existing emulated eeprom)\n"
-                    "'exit' or 'quit'    - exits program\n");
-        }
-        else if(!strcmp(str, "write\n"))
-        {
-            printf("Virtual address: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iVAddr = atoi(str);
-            printf("Value: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iValue = atoi(str);
-            count = emuEepromWrite(iVAddr, &iValue, sizeof(iValue));
-            if(count <= 0)
-            {
-                printf("Error writting.\n");
-            }
-            else
-            {
-                printf("Wrote %d to %d.\n", iValue, iVAddr);
-            }
-            
-        }
-        else if(!strcmp(str, "read\n"))
-        {
-            printf("Virtual address: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iVAddr = atoi(str);
-            printf("Amount: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iValue = atoi(str);
-            count = emuEepromRead(iVAddr, &iValue, iValue);
-            if(count < 0)
-            {
-                printf("Error reading.\n");
-            }        
-            else if(count == 0)
-            {
-                printf("Not found.\n");
-            }    
-            else if(count > 0)
-            {
-                printf("Value: %d\n", iValue);
-            }
-        }
-        else if(!strcmp(str, "erase\n"))
-        {
-            printf("Virtual address: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iVAddr = atoi(str);
-            count = emuEepromErase(iVAddr, sizeof(iValue));
-            if(count < 0)
-            {
-                printf("Error erasing.\n");
-            }          
-            else
-            {
-                printf("%d erased.", iVAddr);
-            }
-              
-        }
-        else if(!strcmp(str, "flush\n"))
-        {
-            count = emuEepromFlush();
-            if(count > 0)
-            {
-                printf("Flushed.\n");
-            }
-            else
-            {
-                printf("Nothing to flush..\n");
-            }
-        }
-        else if(!strcmp(str, "view\n"))
-        {
-            printf("Flash Offset: ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iVAddr = atoi(str);
-            printf("Amount (Bytes): ");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            iValue = atoi(str);
-
-            flashDump(iVAddr, iValue);
-        }    
-        else if(!strcmp(str, "destroy\n"))
-        {
-            printf("Are you sure? [y/n]\n");
-            fgets(str, INPUT_MAX_SIZE, stdin);
-            if(!strcmp(str, "y\n") || !strcmp(str, "Y\n"))
-            {
-                emuEepromDestroy();
-                printf("Shell commands will no longer work.\n");
-            }
-            else
-            {
-                printf("Input unknown.\n");
-            }
-            
-        }
-        else if(!strcmp(str, "test\n"))
-        {
-            int result = testSuiteEmuEeprom();
-            if(result >= 0)
-            {
-                printf("Test Passed!\n");
-            }
-            else
-            {
-                printf("Test Failed.\n");
-            }
-            
-        }
-        else if((!strcmp(str, "exit\n")) || (!strcmp(str, "quit\n")))
-        {
-            break;
-        }
-    }
-
-    return 0;
+/*
+* main.c
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bench.h>
+#include <emueeprom.h>
+#include <flash.h>
+#include <test.h>
+#include <trace.h>
+
+#define INPUT_MAX_SIZE 32u
+#define TRACE_FILE "trace.bin"
+
+int main()
+{
+    char str[INPUT_MAX_SIZE];
+    int iVAddr = 0;
+    int iValue = 0;
+    ssize_t count = 0;
+#ifdef EMUEEPROM_METRICS
+    int recording = 0;
+#endif
+
+    int fd = flashInit();
+    if(fd < 0)
+    {
+        printf("fd: %d\n", fd);
+        return -1;
+    }  
+
+    emuEepromInit();
+    printf("Limited functionality.\n");
+
+    while(1)
+    {
+        printf("> ");
+        fgets(str, INPUT_MAX_SIZE, stdin);
+
+        if(!strcmp(str, "?\n") || !strcmp(str, "help\n"))
+        {
+            printf("'write'             - write decimal value to virtual address\n"
+                    "'read'              - read decimal value stored at virtual address\n"
+                    "'erase'             - erase data at virtual address\n"
+                    "'flush'             - write current buffer to flash\n"
+                    "'destroy'           - erases emulated eeprom from flash\n"
+                    "'view'              - view areas of flash\n"
+                    "'wear'              - view erase count of each block\n"
+                    "'stats'             - view cache and flash read statistics\n"
+                    "'latency'           - view latency of writes, reads, erases, flushes and transfers\n"
+                    "'record'            - start or stop recording calls to trace.bin, see replay\n"
+                    "'test'              - run emueeprom tests (warning: erases existing emulated eeprom)\n"
+                    "'bench'             - run emueeprom benchmarks (warning: erases existing emulated eeprom)\n"
+                    "'exit' or 'quit'    - exits program\n");
+        }
+        else if(!strcmp(str, "write\n"))
+        {
+            printf("Virtual address: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iVAddr = atoi(str);
+            printf("Value: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iValue = atoi(str);
+            count = emuEepromWrite(iVAddr, &iValue, sizeof(iValue));
+            if(count <= 0)
+            {
+                printf("Error writting.\n");
+            }
+            else
+            {
+                printf("Wrote %d to %d.\n", iValue, iVAddr);
+            }
+            
+        }
+        else if(!strcmp(str, "read\n"))
+        {
+            printf("Virtual address: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iVAddr = atoi(str);
+            printf("Amount: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iValue = atoi(str);
+            count = emuEepromRead(iVAddr, &iValue, iValue);
+            if(count < 0)
+            {
+                printf("Error reading.\n");
+            }        
+            else if(count == 0)
+            {
+                printf("Not found.\n");
+            }    
+            else if(count > 0)
+            {
+                printf("Value: %d\n", iValue);
+            }
+        }
+        else if(!strcmp(str, "erase\n"))
+        {
+            printf("Virtual address: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iVAddr = atoi(str);
+            count = emuEepromErase(iVAddr, sizeof(iValue));
+            if(count < 0)
+            {
+                printf("Error erasing.\n");
+            }          
+            else
+            {
+                printf("%d erased.", iVAddr);
+            }
+              
+        }
+        else if(!strcmp(str, "flush\n"))
+        {
+            count = emuEepromFlush();
+            if(count > 0)
+            {
+                printf("Flushed.\n");
+            }
+            else
+            {
+                printf("Nothing to flush..\n");
+            }
+        }
+        else if(!strcmp(str, "view\n"))
+        {
+            printf("Flash Offset: ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iVAddr = atoi(str);
+            printf("Amount (Bytes): ");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            iValue = atoi(str);
+
+            flashDump(iVAddr, iValue);
+        }    
+        else if(!strcmp(str, "wear\n"))
+        {
+            emueeprom_wear_t wear;
+            emuEepromWear(&wear);
+            for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+            {
+                printf("Block %u: %u erases\n", i + 1u, wear.eraseCount[i]);
+            }
+
+            printf("Min: %u Max: %u\n", wear.minCount, wear.maxCount);
+        }
+        else if(!strcmp(str, "stats\n"))
+        {
+            emueeprom_stats_t stats;
+            emuEepromStats(&stats);
+            printf("Cache: %u bytes, %u hits, %u misses\n", stats.cacheBytes, stats.cacheHits, stats.cacheMisses);
+            printf("Flash read: %llu bytes, saved: %llu bytes\n", (unsigned long long)stats.flashBytesRead, 
+                (unsigned long long)stats.flashBytesSaved);
+            printf("Pages programmed: %u in %u flash writes\n", stats.pagesProgrammed, stats.programCalls);
+            printf("Block erases: %u inline, %u ahead\n", stats.inlineErases, stats.idleErases);
+            printf("Transfers: %u, %u pages scanned, %u entries and %llu bytes copied\n", stats.transfers, stats.transferPages,
+                stats.transferEntries, (unsigned long long)stats.copyBytes);
+            printf("Mirror: %u pages copied, %u resynced\n", stats.mirrorPages, stats.mirrorResyncPages);
+            printf("Scrub: %u pages verified, %u passes, %u corrupt, %u relocations\n", stats.scrubPages, stats.scrubPasses,
+                stats.scrubCorrupt, stats.scrubRelocations);
+            printf("Update: %u calls, %llu log bytes saved, %u compare-and-swap misses\n", stats.updates, 
+                (unsigned long long)stats.updateBytesSaved, stats.casFailed);
+            printf("Sync: %u fdatasyncs, %u at the end of a group commit window\n", stats.syncs, stats.windowSyncs);
+        }
+        else if(!strcmp(str, "latency\n"))
+        {
+#ifdef EMUEEPROM_METRICS
+            emuEepromLatencyDump();
+#else
+            printf("Built without latency metrics.\n");
+#endif
+        }
+        else if(!strcmp(str, "record\n"))
+        {
+#ifdef EMUEEPROM_METRICS
+            if(recording)
+            {
+                traceRecordStop();
+                recording = 0;
+                printf("Recording stopped.\n");
+            }
+            else if(traceRecordStart(TRACE_FILE) == 0)
+            {
+                recording = 1;
+                printf("Recording to %s.\n", TRACE_FILE);
+            }
+            else
+            {
+                printf("Error opening %s.\n", TRACE_FILE);
+            }
+#else
+            printf("Built without latency metrics.\n");
+#endif
+        }
+        else if(!strcmp(str, "destroy\n"))
+        {
+            printf("Are you sure? [y/n]\n");
+            fgets(str, INPUT_MAX_SIZE, stdin);
+            if(!strcmp(str, "y\n") || !strcmp(str, "Y\n"))
+            {
+                emuEepromDestroy();
+                printf("Shell commands will no longer work.\n");
+            }
+            else
+            {
+                printf("Input unknown.\n");
+            }
+            
+        }
+        else if(!strcmp(str, "test\n"))
+        {
+            int result = testSuiteEmuEeprom();
+            if(result >= 0)
+            {
+                printf("Test Passed!\n");
+            }
+            else
+            {
+                printf("Test Failed.\n");
+            }
+            
+        }
+        else if(!strcmp(str, "bench\n"))
+        {
+            int result = benchSuiteEmuEeprom();
+            if(result < 0)
+            {
+                printf("Benchmark Failed.\n");
+            }
+        }
+        else if((!strcmp(str, "exit\n")) || (!strcmp(str, "quit\n")))
+        {
+            break;
+        }
+    }
+
+#ifdef EMUEEPROM_METRICS
+    if(recording)
+    {
+        traceRecordStop();
+    }
+#endif
+
+    flashClose();
+
+    return 0;
 }
\ No newline at end of file
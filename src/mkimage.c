@@ -0,0 +1,130 @@
+/*
+* mkimage.c
+*
+* Notes:
+* - Builds a packed flash.bin for provisioning, in the current directory.
+* - Input is text, one value per line: <virtual address> <hex bytes>, e.g. "16 0a0b0c0d".
+* - Lines starting with '#' are ignored, later lines overwrite earlier ones.
+*
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <emueeprom.h>
+#include <flash.h>
+
+#define LINE_MAX_SIZE 512u
+
+int _mkimageParse(FILE *pFile, uint8_t *pImage, uint8_t *pValid);
+
+int main(int argc, char *argv[])
+{
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[MAX_VIRTUAL_ADDR / 8u];
+    int result = -1;
+
+    if(argc != 2)
+    {
+        printf("Usage: %s <values file>\n", argv[0]);
+        return -1;
+    }
+
+    FILE *pFile = fopen(argv[1], "r");
+    if(pFile == NULL)
+    {
+        printf("Error opening %s.\n", argv[1]);
+        return -1;
+    }
+
+    int count = _mkimageParse(pFile, image, valid);
+    fclose(pFile);
+    if(count < 0)
+    {
+        return -1;
+    }
+
+    // always start from a blank part
+    unlink("flash.bin");
+    if(flashInit() < 0)
+    {
+        printf("Error creating flash.bin.\n");
+        return -1;
+    }
+
+    emuEepromInit();
+    ssize_t amount = emuEepromImport(image, valid);
+    if(amount >= 0)
+    {
+        emueeprom_info_t info;
+        emuEepromInfo(&info);
+        printf("Imported %d bytes into block %d using %d pages.\n", (int)amount, info.currBlock + 1, info.currPage - 1);
+        result = 0;
+    }
+    else
+    {
+        printf("Image does not fit in a block.\n");
+    }
+
+    flashClose();
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read values from the input file into an image.
+    @param *pFile - Input file.
+    @param *pImage - Image of MAX_VIRTUAL_ADDR bytes.
+    @param *pValid - Bitmap of MAX_VIRTUAL_ADDR / 8 bytes, set for each address read.
+    @return Amount of values read or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+int _mkimageParse(FILE *pFile, uint8_t *pImage, uint8_t *pValid)
+{
+    char line[LINE_MAX_SIZE];
+    int lineNum = 0;
+    int count = 0;
+
+    memset(pImage, 0xFF, MAX_VIRTUAL_ADDR);
+    memset(pValid, 0, MAX_VIRTUAL_ADDR / 8u);
+
+    while(fgets(line, sizeof(line), pFile) != NULL)
+    {
+        char hex[LINE_MAX_SIZE];
+        unsigned int vAddr = 0;
+
+        lineNum++;
+        if((line[0] == '#') || (line[0] == '\n'))
+        {
+            continue;
+        }
+
+        size_t hexLen = 0;
+        if((sscanf(line, "%u %511s", &vAddr, hex) != 2) || ((hexLen = strlen(hex)) % 2u) ||
+            ((vAddr + (hexLen / 2u)) > MAX_VIRTUAL_ADDR))
+        {
+            printf("Line %d: expected <virtual address> <hex bytes> within %d addresses.\n", lineNum, MAX_VIRTUAL_ADDR);
+            return -1;
+        }
+
+        for(size_t i = 0; i < (hexLen / 2u); i++)
+        {
+            unsigned int byte = 0;
+            if(sscanf(&hex[i * 2u], "%2x", &byte) != 1)
+            {
+                printf("Line %d: bad hex byte.\n", lineNum);
+                return -1;
+            }
+
+            pImage[vAddr + i] = byte;
+            pValid[(vAddr + i) / 8u] |= (1u << ((vAddr + i) % 8u));
+        }
+
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,93 @@
+/*
+* replay.c
+*
+* Notes:
+* - Replays a trace recorded with the 'record' command against flash.bin in the current directory, updates,
+*   compare-and-swaps and adds included. Traces of version 1, from before those were recorded, are refused.
+* - Options: -p waits out the recorded time between calls, -n starts from a blank part,
+*   -q <depth> uses the io_uring backend at that queue depth.
+*
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <emueeprom.h>
+#include <flash.h>
+#include <trace.h>
+
+int main(int argc, char *argv[])
+{
+#ifdef EMUEEPROM_METRICS
+    int paced = 0;
+    int blank = 0;
+    uint32_t depth = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "pnq:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p':
+                paced = 1;
+                break;
+            case 'n':
+                blank = 1;
+                break;
+            case 'q':
+                depth = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if(optind != (argc - 1))
+    {
+        printf("Usage: %s [-p] [-n] [-q <queue depth>] <trace file>\n", argv[0]);
+        return -1;
+    }
+
+    if(blank)
+    {
+        unlink("flash.bin");
+    }
+
+    if(flashInit() < 0)
+    {
+        printf("Error opening flash.bin.\n");
+        return -1;
+    }
+
+    if(depth && (flashSetQueueDepth(depth) != depth))
+    {
+        printf("Queue depth %u unavailable, using blocking writes.\n", depth);
+    }
+
+    emuEepromInit();
+
+    trace_report_t report;
+    int result = traceReplay(argv[optind], paced, &report);
+    if(result < 0)
+    {
+        printf("Error reading %s.\n", argv[optind]);
+    }
+    else
+    {
+        traceReportPrint(&report);
+        result = 0;
+    }
+
+    flashClose();
+
+    return result;
+#else
+    (void)argc;
+    printf("Built without EMUEEPROM_METRICS, %s is not available.\n", argv[0]);
+
+    return -1;
+#endif
+}
@@ -1,205 +1,2198 @@
-/*
-* test.c
-*/
-
-#include <stdio.h>
-#include <stdint.h>
-#include <string.h>
-
-#include <emueeprom.h>
-#include <flash_config.h>
-#include <test.h>
-
-#define MIN_TEST_VIRT_ADDR 0u
-#define MAX_TEST_VIRT_ADDR 128u
-#define TEST_ERROR -1
-
-int _testWriteRead(void);
-int _testMultiPageWriteRead(void);
-int _testBlockTransfer(void);
-int _testEraseEntry(void);
-
-
-/*!------------------------------------------------------------------------------
-    @brief 
-*///-----------------------------------------------------------------------------
-int testSuiteEmuEeprom(void)
-{
-    // erase existing emueeprom
-    emuEepromDestroy();
-    emuEepromInit();
-
-    printf("Starting test..\n");
-    int result = _testWriteRead();
-    if(result >= 0)
-    {   
-        printf("Single write/read passed.\n");
-        result = _testMultiPageWriteRead();
-        if(result >= 0)
-        {
-            printf("Multi-page write/read passed.\n");
-            result = _testBlockTransfer();
-            if(result >= 0)
-            {
-                printf("Transfer passed.\n");
-                result = _testEraseEntry();
-                if(result >= 0)
-                {
-                    printf("Erase passed.\n");
-                }
-            }
-        }
-    }
-
-    return result;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief Write and read a single byte of data to the emulated EEPROM.
-    @param None
-    @return 0 if successful, -1 for error.
-*///-----------------------------------------------------------------------------
-int _testWriteRead(void)
-{
-    int result = TEST_ERROR;
-    uint8_t testValue = 0x01;
-    uint16_t vAddr = 1u;
-
-    ssize_t amount = emuEepromWrite(vAddr, &testValue, sizeof(testValue));
-    if(amount > 0)
-    {
-        uint8_t value = 0u;
-        amount = emuEepromRead(vAddr, &value, sizeof(value));
-        if(amount > 0u)
-        {
-            if(value == testValue)
-            {
-                result = 0;
-            }
-        }
-    }
-
-    return result;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief 
-    @param None
-    @return 0 if successful, -1 for error.
-*///-----------------------------------------------------------------------------
-int _testMultiPageWriteRead(void)
-{
-    int result = TEST_ERROR;
-    uint8_t testArray[PAGE_SIZE] = {0};
-    uint16_t vAddr = 50u;
-
-    memset(testArray, 1u, PAGE_SIZE);
-
-    ssize_t amount = emuEepromWrite(vAddr, &testArray, PAGE_SIZE);
-    if(amount > 0)
-    {
-        uint8_t valueArray[PAGE_SIZE] = {0};
-        amount = emuEepromRead(vAddr, &valueArray, PAGE_SIZE);
-        if(amount > 0)
-        {
-            result = 0;
-            for(int i = 0; i < PAGE_SIZE; i++)
-            {
-                if(valueArray[i] != testArray[i])
-                {
-                    result = TEST_ERROR; 
-                    break;
-                }
-            }
-        }
-    }
-
-    return result;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief
-    @param None
-    @return 0 if successful, -1 for error.
-*///-----------------------------------------------------------------------------
-int _testBlockTransfer(void)
-{
-    uint8_t testArray[PAGE_SIZE];
-    uint16_t count = 0u;
-    uint16_t vAddr = MIN_TEST_VIRT_ADDR;
-    int result = 0;
-    emueeprom_info_t info;
-    uint8_t testBlock = 0;
-
-    // get emueeprom infomation
-    emuEepromInfo(&info);
-    testBlock = info.currBlock;
-
-    while(testBlock == info.currBlock)
-    {
-        for(uint16_t i = 0; i < PAGE_SIZE; i++)
-        {
-            testArray[i] = count++ % MAX_TEST_VIRT_ADDR;
-        }
-
-        ssize_t amount = emuEepromWrite(vAddr, testArray, PAGE_SIZE);
-        if(amount < 0)
-        {
-            result = TEST_ERROR;
-            break;
-        }
-
-        vAddr += PAGE_SIZE;
-        if(vAddr >= MAX_TEST_VIRT_ADDR)
-        {
-            vAddr = MIN_TEST_VIRT_ADDR;
-        }
-
-        emuEepromInfo(&info);
-    }
-
-    for(uint16_t i = MIN_TEST_VIRT_ADDR; i < MAX_TEST_VIRT_ADDR; i++)
-    {
-        uint8_t data = 0;
-        ssize_t amount = emuEepromRead(i, &data, sizeof(uint8_t));
-        if((amount < 0) || (data != i))
-        {
-            result = TEST_ERROR;
-            break;
-        }        
-    }
-
-    return result;
-}
-
-
-/*!------------------------------------------------------------------------------
-    @brief 
-    @param None
-    @return 0 if successful, -1 for error.
-*///-----------------------------------------------------------------------------
-int _testEraseEntry(void)
-{
-    uint16_t vAddr = 50u;
-    int result = -1;
-
-    ssize_t count = emuEepromErase(vAddr, sizeof(uint8_t));
-    count = emuEepromFlush();
-    if(count >= 0)
-    {
-        uint8_t data = 1u;
-        count = emuEepromRead(vAddr, &data, sizeof(data));
-        if(count == 0)
-        {
-            result = 0;
-        }
-    }
-
-    return result;
-}
-
-
-
+/*
+* test.c
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <emueeprom.h>
+#include <flash.h>
+#include <test.h>
+#include <trace.h>
+
+#define MIN_TEST_VIRT_ADDR 0u
+#define MAX_TEST_VIRT_ADDR 128u
+#define TEST_ERROR -1
+#define TEST_ADDERS 4u
+#define TEST_ADDS 500u // increments per adder thread
+
+int _testWriteRead(void);
+int _testMultiPageWriteRead(void);
+int _testBlockTransfer(void);
+int _testTransferStats(void);
+int _testEraseEntry(void);
+int _testWearLeveling(void);
+int _testTransaction(void);
+int _testAsyncWrite(void);
+int _testQueueDepth(void);
+int _testDurability(void);
+int _testCache(void);
+int _testPageSummary(void);
+int _testReadRange(void);
+int _testImport(void);
+int _testHotCold(void);
+int _testHotColdCheck(uint16_t transfers);
+int _testPageBuffers(void);
+int _testSyncRing(void);
+int _testSyncRingFound(uint64_t pattern);
+int _testReadView(void);
+int _testReadMulti(void);
+int _testLargeWrite(void);
+int _testEraseAhead(void);
+int _testBulkErase(void);
+int _testShared(void);
+int _testChanges(void);
+int _testChange(uint16_t vAddr, uint16_t len, void const *pData, void *pContext);
+int _testMirror(void);
+int _testMirrorSame(void);
+int _testMirrorMount(void);
+int _testScrub(void);
+int _testLegacyCrc(void);
+int _testUpdate(void);
+int _testAtomic(void);
+void *_testAdder(void *pArg);
+int _testScrubPass(uint32_t *pCorrupt);
+void _testCorrupt(uint8_t block, uint16_t page, void *pContext);
+#ifdef EMUEEPROM_METRICS
+int _testLatency(void);
+int _testTraceReplay(void);
+int _testTraceCalls(void);
+void _testTrace(emueeprom_op_t op, int end, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result, void *pContext);
+#endif
+void _testAsyncDone(ssize_t result, void *pContext);
+
+typedef struct {
+    uint16_t count;
+    uint16_t vAddr[8];
+    uint16_t len[8];
+    uint8_t first[8]; // first byte of the data
+} test_changes_t;
+
+typedef struct {
+    uint32_t count;
+    uint8_t block; // last reported
+    uint16_t page;
+} test_corrupt_t;
+
+typedef struct {
+    int (*pTest)(void);
+    char const *pName;
+} test_case_t;
+
+static const test_case_t m_tests[] = {
+    {_testWriteRead, "Single write/read"},
+    {_testMultiPageWriteRead, "Multi-page write/read"},
+    {_testBlockTransfer, "Transfer"},
+    {_testTransferStats, "Transfer stats"},
+    {_testEraseEntry, "Erase"},
+    {_testWearLeveling, "Wear leveling"},
+    {_testTransaction, "Transaction"},
+    {_testAsyncWrite, "Async write"},
+    {_testQueueDepth, "Queue depth"},
+    {_testDurability, "Durability"},
+    {_testCache, "Cache"},
+    {_testPageSummary, "Page summary"},
+    {_testReadRange, "Read range"},
+    {_testImport, "Import"},
+    {_testHotCold, "Hot/cold"},
+    {_testPageBuffers, "Page buffers"},
+    {_testSyncRing, "Sync ring"},
+    {_testReadView, "Read view"},
+    {_testReadMulti, "Read multi"},
+    {_testLargeWrite, "Large write"},
+    {_testEraseAhead, "Erase ahead"},
+    {_testBulkErase, "Bulk erase"},
+    {_testShared, "Shared image"},
+    {_testChanges, "Change feed"},
+    {_testMirror, "Mirror"},
+    {_testMirrorMount, "Mirror mount"},
+    {_testScrub, "Scrub"},
+    {_testLegacyCrc, "Legacy CRC"},
+    {_testUpdate, "Update"},
+    {_testAtomic, "Atomic"},
+#ifdef EMUEEPROM_METRICS
+    {_testLatency, "Latency"},
+    {_testTraceReplay, "Trace replay"},
+    {_testTraceCalls, "Trace calls"},
+#endif
+};
+
+
+/*!------------------------------------------------------------------------------
+    @brief 
+*///-----------------------------------------------------------------------------
+int testSuiteEmuEeprom(void)
+{
+    // erase existing emueeprom
+    emuEepromDestroy();
+    emuEepromInit();
+
+    printf("Starting test..\n");
+    int result = 0;
+    for(size_t i = 0; i < (sizeof(m_tests) / sizeof(m_tests[0])); i++)
+    {
+        result = m_tests[i].pTest();
+        if(result < 0)
+        {
+            printf("%s failed.\n", m_tests[i].pName);
+            break;
+        }
+
+        printf("%s passed.\n", m_tests[i].pName);
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write and read a single byte of data to the emulated EEPROM.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testWriteRead(void)
+{
+    int result = TEST_ERROR;
+    uint8_t testValue = 0x01;
+    uint16_t vAddr = 1u;
+
+    ssize_t amount = emuEepromWrite(vAddr, &testValue, sizeof(testValue));
+    if(amount > 0)
+    {
+        uint8_t value = 0u;
+        amount = emuEepromRead(vAddr, &value, sizeof(value));
+        if(amount > 0u)
+        {
+            if(value == testValue)
+            {
+                result = 0;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief 
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testMultiPageWriteRead(void)
+{
+    int result = TEST_ERROR;
+    uint8_t testArray[PAGE_SIZE] = {0};
+    uint16_t vAddr = 50u;
+
+    memset(testArray, 1u, PAGE_SIZE);
+
+    ssize_t amount = emuEepromWrite(vAddr, &testArray, PAGE_SIZE);
+    if(amount > 0)
+    {
+        uint8_t valueArray[PAGE_SIZE] = {0};
+        amount = emuEepromRead(vAddr, &valueArray, PAGE_SIZE);
+        if(amount > 0)
+        {
+            result = 0;
+            for(uint16_t i = 0; i < PAGE_SIZE; i++)
+            {
+                if(valueArray[i] != testArray[i])
+                {
+                    result = TEST_ERROR; 
+                    break;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testBlockTransfer(void)
+{
+    uint8_t testArray[PAGE_SIZE];
+    uint16_t count = 0u;
+    uint16_t vAddr = MIN_TEST_VIRT_ADDR;
+    int result = 0;
+    emueeprom_info_t info;
+    uint8_t testBlock = 0;
+
+    // get emueeprom infomation
+    emuEepromInfo(&info);
+    testBlock = info.currBlock;
+
+    while(testBlock == info.currBlock)
+    {
+        for(uint16_t i = 0; i < PAGE_SIZE; i++)
+        {
+            testArray[i] = count++ % MAX_TEST_VIRT_ADDR;
+        }
+
+        ssize_t amount = emuEepromWrite(vAddr, testArray, PAGE_SIZE);
+        if(amount < 0)
+        {
+            result = TEST_ERROR;
+            break;
+        }
+
+        vAddr += PAGE_SIZE;
+        if(vAddr >= MAX_TEST_VIRT_ADDR)
+        {
+            vAddr = MIN_TEST_VIRT_ADDR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    for(uint16_t i = MIN_TEST_VIRT_ADDR; i < MAX_TEST_VIRT_ADDR; i++)
+    {
+        uint8_t data = 0;
+        ssize_t amount = emuEepromRead(i, &data, sizeof(uint8_t));
+        if((amount < 0) || (data != i))
+        {
+            result = TEST_ERROR;
+            break;
+        }        
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Run the transfer test again and check the transfer stats: the whole old
+    block was scanned and every live byte copied once.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testTransferStats(void)
+{
+    emueeprom_stats_t stats;
+
+    emuEepromStatsReset();
+    int result = _testBlockTransfer();
+    emuEepromStats(&stats);
+    if((stats.transfers != 1u) || (stats.transferPages != ((BLOCK_SIZE / PAGE_SIZE) - 1u)) ||
+        (stats.copyBytes != MAX_TEST_VIRT_ADDR) || (stats.transferEntries < (MAX_TEST_VIRT_ADDR / MAX_DATA_PER_PAGE)))
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief 
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testEraseEntry(void)
+{
+    uint16_t vAddr = 50u;
+    int result = -1;
+
+    ssize_t count = emuEepromErase(vAddr, sizeof(uint8_t));
+    count = emuEepromFlush();
+    if(count >= 0)
+    {
+        uint8_t data = 1u;
+        count = emuEepromRead(vAddr, &data, sizeof(data));
+        if(count == 0)
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Transfer through every block and check that wear stays even.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testWearLeveling(void)
+{
+    uint8_t testArray[PAGE_SIZE];
+    emueeprom_wear_t startWear, endWear;
+    int result = 0;
+
+    emuEepromWear(&startWear);
+    memset(testArray, 0xA5, sizeof(testArray));
+
+    // fill enough pages to transfer through each block twice
+    for(uint32_t i = 0; i < ((2u * BLOCK_COUNT * BLOCK_SIZE) / PAGE_SIZE); i++)
+    {
+        uint16_t vAddr = MAX_TEST_VIRT_ADDR + ((i * PAGE_SIZE) % MAX_TEST_VIRT_ADDR);
+        if(emuEepromWrite(vAddr, testArray, PAGE_SIZE) < 0)
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    emuEepromWear(&endWear);
+    if((endWear.maxCount - endWear.minCount) > 1u)
+    {
+        result = TEST_ERROR;
+    }
+
+    for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+    {
+        if(endWear.eraseCount[i] <= startWear.eraseCount[i])
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Records of a transaction are only visible once committed.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testTransaction(void)
+{
+    uint32_t group[3] = {0}; // ip, mask, gateway
+    uint32_t value = 0;
+    uint16_t vAddr = 2u * MAX_TEST_VIRT_ADDR;
+
+    // aborted records are never seen
+    emuEepromTxBegin();
+    for(uint16_t i = 0; i < 3u; i++)
+    {
+        value = 0xDEAD0000 + i;
+        emuEepromWrite(vAddr + (i * sizeof(value)), &value, sizeof(value));
+    }
+
+    if(emuEepromRead(vAddr, &value, sizeof(value)) != 0)
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromTxAbort();
+    if(emuEepromRead(vAddr, &value, sizeof(value)) != 0)
+    {
+        return TEST_ERROR;
+    }
+
+    // commit enough groups to span block transfers
+    for(uint32_t round = 1; round <= ((2u * BLOCK_SIZE) / PAGE_SIZE); round++)
+    {
+        if(emuEepromTxBegin() < 0)
+        {
+            return TEST_ERROR;
+        }
+
+        for(uint16_t i = 0; i < 3u; i++)
+        {
+            value = (round << 8) | i;
+            emuEepromWrite(vAddr + (i * sizeof(value)), &value, sizeof(value));
+        }
+
+        if(emuEepromTxCommit() != sizeof(group))
+        {
+            return TEST_ERROR;
+        }
+
+        if(emuEepromRead(vAddr, group, sizeof(group)) != sizeof(group))
+        {
+            return TEST_ERROR;
+        }
+
+        for(uint16_t i = 0; i < 3u; i++)
+        {
+            if(group[i] != ((round << 8) | i))
+            {
+                return TEST_ERROR;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Queued writes are readable right away and done in order by the worker.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testAsyncWrite(void)
+{
+    int result = 0;
+    uint32_t done = 0;
+    uint16_t vAddr = 3u * MAX_TEST_VIRT_ADDR;
+
+    if(emuEepromAsyncStart() < 0)
+    {
+        return TEST_ERROR;
+    }
+
+    // enough writes to fill the queue and span a transfer
+    for(uint32_t i = 0; i < (BLOCK_SIZE / sizeof(i)); i++)
+    {
+        uint32_t value = 0;
+        uint16_t addr = vAddr + ((i % MAX_TEST_VIRT_ADDR) & ~(sizeof(i) - 1u));
+        if(emuEepromWriteAsync(addr, &i, sizeof(i), _testAsyncDone, &done) < 0)
+        {
+            result = TEST_ERROR;
+            break;
+        }
+
+        if((emuEepromRead(addr, &value, sizeof(value)) != sizeof(value)) || (value != i))
+        {
+            result = TEST_ERROR;
+            break;
+        }
+    }
+
+    if((emuEepromSync() < 0) || (done != (BLOCK_SIZE / sizeof(uint32_t))))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromAsyncStop();
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Counts completed async writes.
+    @param result - Result of the write.
+    @param *pContext - Counter of successful writes.
+    @return None
+*///-----------------------------------------------------------------------------
+void _testAsyncDone(ssize_t result, void *pContext)
+{
+    if(result > 0)
+    {
+        (*(uint32_t *)pContext)++;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Writes through a transfer with queued flash io and reads it back.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testQueueDepth(void)
+{
+    uint8_t testArray[PAGE_SIZE];
+    uint16_t const baseAddr = 512u;
+    emueeprom_info_t info;
+    int result = 0;
+
+    if(flashSetQueueDepth(16u) != 16u)
+    {
+        // no queued backend in this build, nothing to check
+        return 0;
+    }
+
+    emuEepromInfo(&info);
+    uint8_t testBlock = info.currBlock;
+    uint8_t count = 0u;
+
+    while((testBlock == info.currBlock) && (result == 0))
+    {
+        for(uint16_t i = 0; i < PAGE_SIZE; i++)
+        {
+            testArray[i] = count + i;
+        }
+
+        if(emuEepromWrite(baseAddr, testArray, PAGE_SIZE) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        count++;
+        emuEepromInfo(&info);
+    }
+
+    if((result == 0) && (emuEepromFlush() < 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    for(uint16_t i = 0; (i < PAGE_SIZE) && (result == 0); i++)
+    {
+        uint8_t data = 0;
+        ssize_t amount = emuEepromRead(baseAddr + i, &data, sizeof(data));
+        if((amount < 0) || (data != (uint8_t)(count - 1u + i)))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    flashSetQueueDepth(0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Writes, flushes and reads back under each durability mode, then checks a
+    group commit left open is synced by idle time.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testDurability(void)
+{
+    emueeprom_durability_t const modes[] = {durable_flush, durable_group, durable_dsync, durable_none};
+    uint16_t const baseAddr = 640u;
+    int result = 0;
+
+    for(size_t m = 0; (m < (sizeof(modes) / sizeof(modes[0]))) && (result == 0); m++)
+    {
+        if(emuEepromDurability(modes[m], 1000000u, 4u) < 0)
+        {
+            result = TEST_ERROR;
+            break;
+        }
+
+        for(uint16_t i = 0; (i < 8u) && (result == 0); i++)
+        {
+            uint16_t value = (m << 8) | i;
+            uint16_t data = 0;
+            if((emuEepromWrite(baseAddr + (i * sizeof(value)), &value, sizeof(value)) < 0) || (emuEepromFlush() < 0) || 
+                (emuEepromRead(baseAddr + (i * sizeof(value)), &data, sizeof(data)) < 0) || (data != value))
+            {
+                result = TEST_ERROR;
+            }
+        }
+
+        if(emuEepromSync() < 0)
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    // a lone flush stays in the group until idle time finds its window ran out
+    emueeprom_stats_t startStats, stats;
+    uint16_t value = 0x5A5Au;
+    if((result == 0) && ((emuEepromDurability(durable_group, 2000u, 64u) < 0) || (emuEepromWrite(baseAddr, &value, sizeof(value)) < 0)))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&startStats);
+    if((result == 0) && ((emuEepromFlush() < 0) || (emuEepromIdle() < 0)))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&stats);
+    if((result == 0) && (stats.syncs != startStats.syncs))
+    {
+        result = TEST_ERROR;
+    }
+
+    usleep(4000u);
+    while((result == 0) && (emuEepromIdle() > 0))
+    {
+    }
+
+    emuEepromStats(&stats);
+    if((result == 0) && ((stats.windowSyncs != (startStats.windowSyncs + 1u)) || (stats.syncs != (startStats.syncs + 1u))))
+    {
+        result = TEST_ERROR;
+    }
+
+    if(emuEepromDurability(durable_none, 0u, 0u) < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reads through a transfer with the active block cached, then checks they
+    did not go to flash.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testCache(void)
+{
+    uint16_t const baseAddr = 768u;
+    emueeprom_stats_t stats;
+    emueeprom_info_t info;
+    int result = 0;
+
+    if(emuEepromCache(BLOCK_SIZE) != BLOCK_SIZE)
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromInfo(&info);
+    uint8_t testBlock = info.currBlock;
+    uint32_t value = 0u;
+
+    while((testBlock == info.currBlock) && (result == 0))
+    {
+        value++;
+        if(emuEepromWrite(baseAddr + ((value % 16u) * sizeof(value)), &value, sizeof(value)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    emuEepromFlush();
+    emuEepromStatsReset();
+    for(uint32_t i = 0; (i < 16u) && (result == 0); i++)
+    {
+        uint32_t data = 0u;
+        uint32_t expected = value - ((value - i) % 16u);
+        if((emuEepromRead(baseAddr + (i * sizeof(data)), &data, sizeof(data)) < 0) || (data != expected))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    emuEepromStats(&stats);
+    if((stats.cacheMisses != 0u) || (stats.cacheHits == 0u))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromCache(0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reads a value and a transaction written before many pages of other
+    addresses, which should be found while skipping pages.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testPageSummary(void)
+{
+    uint16_t const coldAddr = 900u;
+    uint32_t const coldValue = 0xC01DC01D;
+    uint32_t const txValue = 0x7E577E57;
+    emueeprom_stats_t stats;
+    int result = 0;
+
+    if((emuEepromWrite(coldAddr, &coldValue, sizeof(coldValue)) < 0) || (emuEepromTxBegin() < 0) || 
+        (emuEepromWrite(coldAddr + sizeof(coldValue), &txValue, sizeof(txValue)) < 0) || (emuEepromTxCommit() < 0))
+    {
+        return TEST_ERROR;
+    }
+
+    for(uint16_t i = 0; (i < (8u * PAGE_SIZE)) && (result == 0); i++)
+    {
+        uint8_t value = i;
+        if(emuEepromWrite(MIN_TEST_VIRT_ADDR + (i % MAX_TEST_VIRT_ADDR), &value, sizeof(value)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    emuEepromStatsReset();
+    uint32_t data[2] = {0u, 0u};
+    if((result == 0) && ((emuEepromRead(coldAddr, data, sizeof(data)) != sizeof(data)) || 
+        (data[0] != coldValue) || (data[1] != txValue)))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&stats);
+    if(stats.pagesSkipped == 0u)
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Reads a range with gaps, an erased value and an overwritten value.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testReadRange(void)
+{
+    uint16_t const baseAddr = 1024u;
+    uint8_t values[] = {1u, 2u, 3u, 4u};
+    uint8_t image[32];
+    uint8_t valid[sizeof(image) / 8u];
+
+    // bytes 0-3 written then 1 overwritten, 8-11 written then 9 erased, the rest never written
+    if((emuEepromWrite(baseAddr, values, sizeof(values)) < 0) || (emuEepromWrite(baseAddr + 8u, values, sizeof(values)) < 0) || 
+        (emuEepromWrite(baseAddr + 1u, &values[3], 1u) < 0) || (emuEepromErase(baseAddr + 9u, 1u) < 0))
+    {
+        return TEST_ERROR;
+    }
+
+    if(emuEepromReadRange(baseAddr, image, sizeof(image), valid) != 7)
+    {
+        return TEST_ERROR;
+    }
+
+    if((valid[0] != 0x0F) || (valid[1] != 0x0D) || (valid[2] != 0x00) || (valid[3] != 0x00) || 
+        (image[0] != 1u) || (image[1] != 4u) || (image[2] != 3u) || (image[8] != 1u) || (image[10] != 3u))
+    {
+        return TEST_ERROR;
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Imports an image over existing data, which must be replaced by it.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testImport(void)
+{
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[MAX_VIRTUAL_ADDR / 8u];
+    static uint8_t readValid[MAX_VIRTUAL_ADDR / 8u];
+    emueeprom_info_t info;
+
+    memset(image, 0, sizeof(image));
+    memset(valid, 0, sizeof(valid));
+    for(uint16_t i = 0; i < 100u; i++)
+    {
+        // a long run across pages and a short one
+        image[200u + i] = i;
+        valid[(200u + i) / 8u] |= (1u << ((200u + i) % 8u));
+    }
+
+    image[1500] = 0x15;
+    valid[1500 / 8u] |= (1u << (1500 % 8u));
+
+    emuEepromInfo(&info);
+    uint8_t lastBlock = info.currBlock;
+    if((emuEepromImport(image, valid) != 101) || (emuEepromReadAll(image, readValid) != 101) || 
+        memcmp(valid, readValid, sizeof(valid)) || (image[250] != 50u) || (image[1500] != 0x15))
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromInfo(&info);
+
+    return (info.currBlock != lastBlock) ? 0 : TEST_ERROR;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Demote values to the cold block while a counter keeps transferring, then
+    turn separation off and check the cold block is folded back in.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testHotCold(void)
+{
+    int result = TEST_ERROR;
+
+    if(emuEepromHotCold(1u) >= 0)
+    {
+        for(uint32_t i = 0; i < 16u; i++)
+        {
+            emuEepromWrite(1100u + (i * sizeof(i)), &i, sizeof(i));
+        }
+
+        emuEepromErase(1100u, 1u);
+        if(_testHotColdCheck(4u) >= 0)
+        {
+            emuEepromHotCold(0u);
+            result = _testHotColdCheck(2u);
+        }
+    }
+
+    emuEepromHotCold(0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Rewrite a counter through some transfers and read back the values set
+    by _testHotCold.
+    @param transfers - Amount of transfers to wait for.
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testHotColdCheck(uint16_t transfers)
+{
+    emueeprom_wear_t startWear, wear;
+    uint32_t erases = 0;
+
+    emuEepromWear(&startWear);
+    for(uint32_t count = 0; erases < transfers; count++)
+    {
+        if(emuEepromWrite(1200u, &count, sizeof(count)) < 0)
+        {
+            return TEST_ERROR;
+        }
+
+        emuEepromWear(&wear);
+        erases = 0;
+        for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+        {
+            erases += (wear.eraseCount[i] - startWear.eraseCount[i]);
+        }
+    }
+
+    uint8_t erased = 0;
+    if(emuEepromRead(1100u, &erased, sizeof(erased)) != 0)
+    {
+        return TEST_ERROR;
+    }
+
+    for(uint32_t i = 1; i < 16u; i++)
+    {
+        uint32_t value = ~i;
+        if((emuEepromRead(1100u + (i * sizeof(i)), &value, sizeof(value)) != sizeof(value)) || (value != i))
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Fill pages that stay in the ring and read them back before and after
+    they are programmed.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testPageBuffers(void)
+{
+    emueeprom_stats_t stats;
+    int result = TEST_ERROR;
+
+    if((emuEepromPageBuffers(0u) < 0) && (emuEepromPageBuffers(PAGE_BUFFER_COUNT + 1u) < 0) && 
+        (emuEepromPageBuffers(PAGE_BUFFER_COUNT) >= 0))
+    {
+        emuEepromFlush();
+        emuEepromStatsReset();
+
+        // a few pages, less than the ring holds
+        for(uint32_t i = 0; i < 12u; i++)
+        {
+            emuEepromWrite(1300u + (i * sizeof(i)), &i, sizeof(i));
+        }
+
+        emuEepromStats(&stats);
+        result = (stats.programCalls == 0u) ? 0 : TEST_ERROR;
+        for(int pass = 0; (pass < 2) && (result >= 0); pass++)
+        {
+            for(uint32_t i = 0; i < 12u; i++)
+            {
+                uint32_t value = ~i;
+                if((emuEepromRead(1300u + (i * sizeof(i)), &value, sizeof(value)) != sizeof(value)) || (value != i))
+                {
+                    result = TEST_ERROR;
+                }
+            }
+
+            emuEepromFlush();
+        }
+
+        emuEepromStats(&stats);
+        if(stats.programCalls != 1u)
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    emuEepromPageBuffers(1u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Hold pages in the ring without syncing and check emuEepromSync programs
+    them into the image, through the caller and through the async worker.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testSyncRing(void)
+{
+    uint64_t const patterns[] = {0x5359A1C0DE0F1A5Bull, 0x5359A2C0DE0F1A5Bull};
+    int result = 0;
+
+    if((emuEepromDurability(durable_none, 0u, 0u) < 0) || (emuEepromPageBuffers(PAGE_BUFFER_COUNT) < 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    for(size_t i = 0; (i < (sizeof(patterns) / sizeof(patterns[0]))) && (result == 0); i++)
+    {
+        if((i == 1u) && (emuEepromAsyncStart() < 0))
+        {
+            result = TEST_ERROR;
+            break;
+        }
+
+        // starting on an empty page keeps the value in one piece
+        if((emuEepromFlush() < 0) || (emuEepromWrite(1340u, &patterns[i], sizeof(patterns[i])) < 0) || (emuEepromSync() < 0) || 
+            (_testSyncRingFound(patterns[i]) < 0))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    emuEepromAsyncStop();
+    emuEepromPageBuffers(1u);
+    emuEepromErase(1340u, sizeof(patterns[0]));
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Look for a value in the current block of the flash image.
+    @param pattern - Value written as one entry.
+    @return 0 if found, -1 if not.
+*///-----------------------------------------------------------------------------
+int _testSyncRingFound(uint64_t pattern)
+{
+    static uint8_t block[BLOCK_SIZE];
+    emueeprom_info_t info;
+
+    emuEepromInfo(&info);
+    if(flashRead(BLOCK_START_ADDR + (info.currBlock * BLOCK_SIZE), block, sizeof(block)) != sizeof(block))
+    {
+        return TEST_ERROR;
+    }
+
+    for(size_t offset = 0; offset <= (sizeof(block) - sizeof(pattern)); offset++)
+    {
+        if(memcmp(&block[offset], &pattern, sizeof(pattern)) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return TEST_ERROR;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief View a value in place, keep the view through transfers and check its
+    block is only erased once released. Ranges over two entries are copied.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testReadView(void)
+{
+    uint8_t blob[20];
+    emueeprom_view_t view, spanView;
+    emueeprom_wear_t startWear, wear;
+    int result = 0;
+
+    for(uint16_t i = 0; i < sizeof(blob); i++)
+    {
+        blob[i] = 0xA0 + i;
+    }
+
+    emuEepromWrite(1400u, blob, sizeof(blob));
+    emuEepromWrite(1420u, blob, 4u);
+    emuEepromFlush();
+    if((emuEepromReadView(1402u, 16u, &view) != 16) || (view.block >= BLOCK_COUNT) || memcmp(view.pData, &blob[2], 16u) ||
+        (emuEepromReadView(1410u, 12u, &spanView) != 12) || (spanView.block != BLOCK_COUNT) || 
+        memcmp(spanView.pData, &blob[10], 10u) || memcmp(&spanView.pData[10], blob, 2u))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromReleaseView(&spanView);
+
+    // two transfers, the first would erase the viewed block
+    emuEepromWear(&startWear);
+    uint8_t viewBlock = view.block;
+    uint32_t erases = 0;
+    for(uint32_t count = 0; (erases < 2u) && (result >= 0); count++)
+    {
+        if(emuEepromWrite(1500u, &count, sizeof(count)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromWear(&wear);
+        erases = 0;
+        for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+        {
+            erases += (wear.eraseCount[i] - startWear.eraseCount[i]);
+        }
+    }
+
+    if((result >= 0) && (memcmp(view.pData, &blob[2], 16u) || (wear.eraseCount[viewBlock] != startWear.eraseCount[viewBlock])))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromReleaseView(&view);
+    emuEepromWear(&wear);
+    if(wear.eraseCount[viewBlock] != (startWear.eraseCount[viewBlock] + 1u))
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Resolve overlapping, repeated, erased and unwritten ranges in one call
+    and compare with single reads, then read one byte through more requests than a
+    uint16_t counts.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testReadMulti(void)
+{
+    uint8_t bytes[8] = {1u, 2u, 3u, 4u, 5u, 6u, 7u, 8u};
+    uint8_t buffers[5][8];
+    uint8_t valid[5];
+    emueeprom_req_t reqs[5] = {
+        {1600u, 8u, buffers[0], &valid[0]},
+        {1602u, 4u, buffers[1], &valid[1]},
+        {1610u, 2u, buffers[2], &valid[2]}, // erased and never written
+        {1600u, 8u, buffers[3], &valid[3]},
+        {1000u, 1u, buffers[4], NULL}, // before the others once sorted
+    };
+    ssize_t expected = 0;
+
+    emuEepromWrite(1000u, bytes, 1u);
+    emuEepromWrite(1600u, bytes, sizeof(bytes));
+    emuEepromFlush();
+    emuEepromWrite(1604u, &bytes[4], 4u);
+    emuEepromWrite(1610u, bytes, 1u);
+    emuEepromErase(1610u, 1u);
+
+    memset(buffers, 0, sizeof(buffers));
+    if(emuEepromReadMulti(reqs, 5u) != (8 + 4 + 0 + 8 + 1))
+    {
+        return TEST_ERROR;
+    }
+
+    for(uint16_t i = 0; i < 5u; i++)
+    {
+        uint8_t single[8] = {0};
+        ssize_t count = emuEepromRead(reqs[i].vAddr, single, reqs[i].len);
+        expected += count;
+        if(memcmp(single, buffers[i], reqs[i].len) || ((reqs[i].pValid != NULL) && (valid[i] != ((count == 8) ? 0xFF : 
+            ((count == 4) ? 0x0F : 0x00)))))
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    if(expected != 21)
+    {
+        return TEST_ERROR;
+    }
+
+    // more requests than a uint16_t counts, all of the same byte
+    size_t const many = UINT16_MAX + 16u;
+    emueeprom_req_t *pMany = malloc(many * sizeof(emueeprom_req_t));
+    uint8_t *pBytes = malloc(many);
+    int result = TEST_ERROR;
+    if((pMany != NULL) && (pBytes != NULL))
+    {
+        memset(pBytes, 0, many);
+        for(size_t i = 0; i < many; i++)
+        {
+            pMany[i] = (emueeprom_req_t){1000u, 1u, &pBytes[i], NULL};
+        }
+
+        if((emuEepromReadMulti(pMany, many) == (ssize_t)many) && (pBytes[0] == bytes[0]) && (pBytes[many - 1u] == bytes[0]))
+        {
+            result = 0;
+        }
+    }
+
+    free(pMany);
+    free(pBytes);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Write a value of many pages, starting mid page, until the block fills
+    up and transfers. The whole pages are programmed together.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testLargeWrite(void)
+{
+    uint8_t blob[390];
+    uint8_t value[sizeof(blob)];
+    emueeprom_stats_t stats;
+    emueeprom_wear_t startWear, wear;
+    uint32_t erases = 0;
+    int result = 0;
+
+    emuEepromWear(&startWear);
+    for(uint8_t pass = 0; (erases == 0u) && (result >= 0); pass++)
+    {
+        for(uint16_t i = 0; i < sizeof(blob); i++)
+        {
+            blob[i] = pass + i;
+        }
+
+        emuEepromFlush();
+        emuEepromStatsReset();
+        emuEepromWrite(1650u, &pass, sizeof(pass));
+        if(emuEepromWrite(1651u, blob, sizeof(blob)) != sizeof(blob))
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromWear(&wear);
+        for(uint16_t i = 0; i < BLOCK_COUNT; i++)
+        {
+            erases += (wear.eraseCount[i] - startWear.eraseCount[i]);
+        }
+
+        // the page holding the first byte, then the whole pages in one write
+        emuEepromStats(&stats);
+        if((erases == 0u) && ((stats.pagesProgrammed < 14u) || (stats.programCalls > 2u)))
+        {
+            result = TEST_ERROR;
+        }
+
+        memset(value, 0, sizeof(value));
+        if((emuEepromRead(1651u, value, sizeof(value)) != sizeof(value)) || memcmp(value, blob, sizeof(blob)))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Retire the old block at a transfer, erase it from the idle hook once and
+    check the next transfer finds its block blank. Values stay readable throughout.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testEraseAhead(void)
+{
+    emueeprom_info_t info;
+    emueeprom_stats_t stats;
+    emueeprom_wear_t startWear, wear;
+    int result = 0;
+
+    emuEepromEraseAhead(1);
+    emuEepromStatsReset();
+    for(uint16_t transfers = 0; (transfers < 2u) && (result >= 0); transfers++)
+    {
+        emuEepromInfo(&info);
+        uint8_t lastBlock = info.currBlock;
+        emuEepromWear(&startWear);
+        for(uint32_t count = 0; (info.currBlock == lastBlock) && (result >= 0); count++)
+        {
+            uint32_t value = 0;
+            if((emuEepromWrite(1700u, &count, sizeof(count)) < 0) || 
+                (emuEepromRead(1700u, &value, sizeof(value)) != sizeof(value)) || (value != count))
+            {
+                result = TEST_ERROR;
+            }
+
+            emuEepromInfo(&info);
+        }
+
+        // left for the idle hook, erased by it once
+        emuEepromWear(&wear);
+        if((wear.eraseCount[lastBlock] != startWear.eraseCount[lastBlock]) || (emuEepromIdle() != 1) || 
+            (emuEepromIdle() != 0))
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromWear(&wear);
+        if(wear.eraseCount[lastBlock] != (startWear.eraseCount[lastBlock] + 1u))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    emuEepromStats(&stats);
+    if((stats.idleErases != 2u) || (stats.inlineErases != 0u))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromEraseAhead(0);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Erase several blocks past the emulated EEPROM in one call and check the
+    block after them is left alone.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testBulkErase(void)
+{
+    static uint8_t block[BLOCK_SIZE];
+    uint8_t page[PAGE_SIZE];
+    int result = 0;
+
+    if((FLASH_SIZE / BLOCK_SIZE) < (BLOCK_COUNT + 4u))
+    {
+        return 0;
+    }
+
+    memset(page, 0xA5, sizeof(page));
+    for(uint16_t i = 0; i < 4u; i++)
+    {
+        off_t offset = (BLOCK_COUNT + i) * BLOCK_SIZE;
+        flashWrite(offset, page, sizeof(page));
+        flashWrite(offset + BLOCK_SIZE - PAGE_SIZE, page, sizeof(page));
+    }
+
+    flashBlockErase(BLOCK_COUNT, 3);
+    for(uint16_t i = 0; (i < 4u) && (result >= 0); i++)
+    {
+        if(flashRead((BLOCK_COUNT + i) * BLOCK_SIZE, block, BLOCK_SIZE) != BLOCK_SIZE)
+        {
+            result = TEST_ERROR;
+        }
+
+        for(uint16_t u = 0; (u < BLOCK_SIZE) && (result >= 0); u++)
+        {
+            bool programmed = ((i == 3u) && ((u < PAGE_SIZE) || (u >= (BLOCK_SIZE - PAGE_SIZE))));
+            if(block[u] != (programmed ? 0xA5 : 0xFF))
+            {
+                result = TEST_ERROR;
+            }
+        }
+    }
+
+    flashBlockErase(BLOCK_COUNT + 3u, 1);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Another process reads a value through the shared image after a transfer,
+    and cannot take the writer role while this one holds it.
+*///-----------------------------------------------------------------------------
+int _testShared(void)
+{
+    uint32_t value = 0x5A17C0DEu;
+    emueeprom_info_t info;
+    int result = 0;
+    int status = -1;
+
+    if(emuEepromShareWriter(0) < 0)
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromInfo(&info);
+    uint8_t startBlock = info.currBlock;
+    uint32_t generation = emuEepromShareGeneration();
+    if((emuEepromWrite(1796u, &value, sizeof(value)) < 0) || (emuEepromFlush() < 0) || 
+        (emuEepromShareGeneration() == generation) || (emuEepromShareGeneration() & 1u))
+    {
+        result = TEST_ERROR;
+    }
+
+    for(uint32_t i = 0; (info.currBlock == startBlock) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(1800u, &i, sizeof(i)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    fflush(stdout);
+    pid_t pid = (result >= 0) ? fork() : -1;
+    if(pid == 0)
+    {
+        // own descriptors, as a separate daemon would have
+        uint32_t readBack = 0;
+        flashClose();
+        bool ok = ((flashInit() > 0) && (emuEepromShareWriter(0) < 0) && (emuEepromShareAttach() == 0) &&
+            (emuEepromShareRead(1796u, &readBack, sizeof(readBack)) == sizeof(readBack)) && (readBack == value));
+        _exit(ok ? 0 : 1);
+    }
+
+    if((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    if(emuEepromShareRelease() < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Follow writes, an erase and a transaction through the change feed, across
+    a transfer, and check a cursor goes stale once an erase it missed is dropped.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testChanges(void)
+{
+    test_changes_t changes = {0};
+    emueeprom_cursor_t cursor;
+    emueeprom_info_t info;
+    uint32_t value = 0xC4A16E5Du;
+    uint8_t flag = 0x3C;
+    uint16_t txValue = 0x7E57;
+    int result = 0;
+
+    emuEepromCursor(&cursor);
+    if((emuEepromWrite(1804u, &value, sizeof(value)) < 0) || (emuEepromWrite(1808u, &flag, sizeof(flag)) < 0) ||
+        (emuEepromErase(1804u, 1u) < 0) || (emuEepromTxBegin() < 0) || (emuEepromWrite(1812u, &txValue, sizeof(txValue)) < 0))
+    {
+        return TEST_ERROR;
+    }
+
+    // nothing of an open transaction is passed
+    if((emuEepromChangesSince(&cursor, _testChange, &changes) != 3) || (emuEepromTxCommit() < 0) ||
+        (emuEepromChangesSince(&cursor, _testChange, &changes) != 1) || (changes.count != 4u))
+    {
+        return TEST_ERROR;
+    }
+
+    uint16_t const vAddrs[] = {1804u, 1808u, 1804u, 1812u};
+    uint16_t const lens[] = {sizeof(value), sizeof(flag), 0u, sizeof(txValue)};
+    uint8_t const firsts[] = {0x5D, 0x3C, 0x00, 0x57};
+    for(uint16_t i = 0; i < changes.count; i++)
+    {
+        if((changes.vAddr[i] != vAddrs[i]) || (changes.len[i] != lens[i]) || (changes.first[i] != firsts[i]))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    // the copy made by a transfer is passed again, the latest values last
+    emuEepromInfo(&info);
+    uint8_t startBlock = info.currBlock;
+    for(uint32_t i = 0; (info.currBlock == startBlock) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(1816u, &i, sizeof(i)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    changes.count = 0;
+    ssize_t count = emuEepromChangesSince(&cursor, _testChange, &changes);
+    if((count <= 0) || (emuEepromChangesSince(&cursor, _testChange, &changes) != 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    // an erase written after the cursor and dropped by the transfer cannot be passed
+    emueeprom_cursor_t missed;
+    emuEepromCursor(&missed);
+    emuEepromErase(1808u, 1u);
+    emuEepromInfo(&info);
+    startBlock = info.currBlock;
+    for(uint32_t i = 0; (info.currBlock == startBlock) && (result >= 0); i++)
+    {
+        emuEepromWrite(1816u, &i, sizeof(i));
+        emuEepromInfo(&info);
+    }
+
+    if((emuEepromChangesSince(&missed, _testChange, &changes) != CURSOR_STALE) ||
+        (emuEepromChangesSince(&cursor, _testChange, &changes) != CURSOR_STALE))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromErase(1812u, sizeof(txValue));
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Change feed callback, keeps the first changes passed.
+*///-----------------------------------------------------------------------------
+int _testChange(uint16_t vAddr, uint16_t len, void const *pData, void *pContext)
+{
+    test_changes_t *pChanges = pContext;
+
+    if(pChanges->count < (sizeof(pChanges->vAddr) / sizeof(pChanges->vAddr[0])))
+    {
+        pChanges->vAddr[pChanges->count] = vAddr;
+        pChanges->len[pChanges->count] = len;
+        pChanges->first[pChanges->count] = (pData != NULL) ? *(uint8_t const *)pData : 0u;
+    }
+
+    pChanges->count++;
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Mirror in the same call and lagged through a transfer, then bring back a
+    mirror that missed some pages and check only those are copied.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testMirror(void)
+{
+    emueeprom_stats_t startStats, stats;
+    emueeprom_info_t info;
+    int result = 0;
+
+    if((emuEepromMirror(1, 0u) < 0) || (_testMirrorSame() < 0))
+    {
+        emuEepromMirror(0, 0u);
+        return TEST_ERROR;
+    }
+
+    emuEepromStats(&startStats);
+    for(uint32_t i = 0; i < 8u; i++)
+    {
+        emuEepromWrite(1840u, &i, sizeof(i));
+        emuEepromFlush();
+    }
+
+    emuEepromStats(&stats);
+    if((_testMirrorSame() < 0) || (stats.mirrorPages < (startStats.mirrorPages + 8u)))
+    {
+        result = TEST_ERROR;
+    }
+
+    // lagged, the mirror trails until idle catches it up
+    emuEepromMirror(1, 4u);
+    emuEepromInfo(&info);
+    uint8_t startBlock = info.currBlock;
+    for(uint32_t i = 0; (info.currBlock == startBlock) && (result >= 0); i++)
+    {
+        if(emuEepromWrite(1844u, &i, sizeof(i)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    emuEepromWrite(1840u, &info, sizeof(uint32_t));
+    emuEepromFlush();
+    if(_testMirrorSame() == 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    while(emuEepromIdle() > 0)
+    {
+    }
+
+    if(_testMirrorSame() < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    // pages written while stopped are the only ones copied back
+    emuEepromMirror(0, 0u);
+    for(uint32_t i = 0; i < 3u; i++)
+    {
+        emuEepromWrite(1848u, &i, sizeof(i));
+        emuEepromFlush();
+    }
+
+    emuEepromStats(&startStats);
+    ssize_t count = emuEepromMirror(1, 0u);
+    emuEepromStats(&stats);
+    if((count != 3) || ((stats.mirrorResyncPages - startStats.mirrorResyncPages) != (uint32_t)count) ||
+        (_testMirrorSame() < 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromErase(1840u, 12u);
+    emuEepromMirror(0, 0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Leave the mirror behind, then set up mirroring before mounting the way a
+    new process would and check the mount brings the mirror up to date. Starts over
+    from an erased part.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testMirrorMount(void)
+{
+    emueeprom_stats_t stats;
+    int result = 0;
+
+    // erased with mirroring off, the mirror keeps the old pages
+    emuEepromDestroy();
+    if(emuEepromMirror(1, 0u) < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStatsReset();
+    emuEepromInit();
+    emuEepromStats(&stats);
+    if((stats.mirrorResyncPages == 0u) || (_testMirrorSame() < 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromMirror(0, 0u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Compare the emulated EEPROM blocks of flash and of the mirror.
+    @param None
+    @return 0 if they match, -1 if not.
+*///-----------------------------------------------------------------------------
+int _testMirrorSame(void)
+{
+    static uint8_t flash[BLOCK_COUNT * BLOCK_SIZE];
+    static uint8_t mirror[BLOCK_COUNT * BLOCK_SIZE];
+
+    if((flashRead(BLOCK_START_ADDR, flash, sizeof(flash)) != sizeof(flash)) || 
+        (flashMirrorRead(BLOCK_START_ADDR, mirror, sizeof(mirror)) != sizeof(mirror)))
+    {
+        return TEST_ERROR;
+    }
+
+    return memcmp(flash, mirror, sizeof(flash)) ? TEST_ERROR : 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Scrub a clean image, corrupt a programmed page behind the engine's back and
+    check it is reported, then relocate the block and check nothing was lost.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testScrub(void)
+{
+    test_corrupt_t reports = {0};
+    uint8_t data[MAX_DATA_PER_PAGE];
+    uint8_t readBack[MAX_DATA_PER_PAGE];
+    emueeprom_info_t info;
+    uint32_t corrupt = 0;
+    uint32_t keep = 0x5C5C5C5Cu;
+    int result = 0;
+
+    emuEepromScrub(1000000u, 0, _testCorrupt, &reports);
+    if((_testScrubPass(&corrupt) < 0) || corrupt || reports.count)
+    {
+        emuEepromScrub(0u, 0, NULL, NULL);
+        return TEST_ERROR;
+    }
+
+    // one entry filling a page on its own
+    memset(data, 0x55, sizeof(data));
+    emuEepromWrite(1852u, &keep, sizeof(keep));
+    emuEepromFlush();
+    emuEepromWrite(1856u, data, sizeof(data));
+    emuEepromFlush();
+    emuEepromInfo(&info);
+
+    uint8_t block = info.currBlock;
+    uint16_t page = info.currPage - 1u;
+    uint8_t flipped = 0x15;
+    flashWrite(BLOCK_START_ADDR + (block * BLOCK_SIZE) + (page * PAGE_SIZE) + 8u, &flipped, sizeof(flipped));
+    if((_testScrubPass(&corrupt) < 0) || (corrupt != 1u) || !reports.count || 
+        (reports.block != block) || (reports.page != page))
+    {
+        result = TEST_ERROR;
+    }
+
+    // found again, this time the data is moved off the block and the corrupt entry
+    // is dropped by the transfer
+    emueeprom_stats_t startStats, stats;
+    emuEepromStats(&startStats);
+    emuEepromScrub(1000000u, 1, _testCorrupt, &reports);
+    if(_testScrubPass(&corrupt) < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&stats);
+    emuEepromInfo(&info);
+    uint32_t value = 0;
+    if((info.currBlock == block) || (stats.scrubRelocations != (startStats.scrubRelocations + 1u)) || (emuEepromRead(1852u, &value, sizeof(value)) != sizeof(value)) ||
+        (value != keep) || ((emuEepromRead(1856u, readBack, sizeof(readBack)) == sizeof(readBack)) && 
+        !memcmp(readBack, data, sizeof(data))))
+    {
+        result = TEST_ERROR;
+    }
+
+    if((_testScrubPass(&corrupt) < 0) || corrupt)
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromErase(1852u, 4u + MAX_DATA_PER_PAGE);
+    emuEepromScrub(0u, 0, NULL, NULL);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Turn the current block back into one written before page CRCs, with the
+    constant CRCs and no format in the header, then transfer it and read every entry
+    back. Scrub passes find nothing corrupt before or after the transfer.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testLegacyCrc(void)
+{
+    uint16_t const baseAddr = 1976u;
+    uint16_t const legacyHeaderCrc = 0xCECE;
+    uint16_t const legacyPageCrc = 0xBEEF;
+    uint32_t const erased = 0xFFFFFFFFu; // format and the reserved word after it
+    emueeprom_info_t info;
+    uint32_t corrupt = 0;
+    int result = 0;
+
+    for(uint16_t i = 0; i < 8u; i++)
+    {
+        uint16_t value = 0x1E00u | i;
+        if((emuEepromWrite(baseAddr + (i * sizeof(value)), &value, sizeof(value)) < 0) || (emuEepromFlush() < 0))
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    emuEepromSync();
+    emuEepromInfo(&info);
+
+    // header CRC at offset 8 and format at offset 16, page CRC in the last two bytes
+    uint8_t block = info.currBlock;
+    uint32_t blockOffset = BLOCK_START_ADDR + (block * BLOCK_SIZE);
+    flashWrite(blockOffset + 8u, &legacyHeaderCrc, sizeof(legacyHeaderCrc));
+    flashWrite(blockOffset + 16u, &erased, sizeof(erased));
+    for(uint16_t page = 1u; page < info.currPage; page++)
+    {
+        flashWrite(blockOffset + ((page + 1u) * PAGE_SIZE) - sizeof(legacyPageCrc), &legacyPageCrc, sizeof(legacyPageCrc));
+    }
+
+    emuEepromScrub(1000000u, 0, NULL, NULL);
+    if((_testScrubPass(&corrupt) < 0) || corrupt)
+    {
+        result = TEST_ERROR;
+    }
+
+    for(uint16_t filler = 0; (info.currBlock == block) && (result == 0); filler++)
+    {
+        if(emuEepromWrite(baseAddr + 16u, &filler, sizeof(filler)) < 0)
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromInfo(&info);
+    }
+
+    for(uint16_t i = 0; (i < 8u) && (result == 0); i++)
+    {
+        uint16_t value = 0;
+        if((emuEepromRead(baseAddr + (i * sizeof(value)), &value, sizeof(value)) != sizeof(value)) || (value != (0x1E00u | i)))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    // the block transferred to has a format and real CRCs
+    if((_testScrubPass(&corrupt) < 0) || corrupt)
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromScrub(0u, 0, NULL, NULL);
+    emuEepromErase(baseAddr, 18u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Scrub through emuEepromIdle until a whole pass is done.
+    @param *pCorrupt - Set to the corrupt pages found.
+    @return 0 if successful, -1 if the pass never ended.
+*///-----------------------------------------------------------------------------
+int _testScrubPass(uint32_t *pCorrupt)
+{
+    emueeprom_stats_t startStats, stats;
+
+    // the first wrap ends the pass under way, the second one a whole pass
+    for(int wraps = 0; wraps < 2; wraps++)
+    {
+        emuEepromStats(&startStats);
+        stats = startStats;
+
+        // idle returns 0 until the budget has built up a page
+        for(uint32_t i = 0; (stats.scrubPasses == startStats.scrubPasses) && (i < 1000000u); i++)
+        {
+            emuEepromIdle();
+            emuEepromStats(&stats);
+        }
+
+        if(stats.scrubPasses == startStats.scrubPasses)
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    *pCorrupt = stats.scrubCorrupt - startStats.scrubCorrupt;
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Scrub callback, counts corrupt pages.
+*///-----------------------------------------------------------------------------
+void _testCorrupt(uint8_t block, uint16_t page, void *pContext)
+{
+    test_corrupt_t *pReports = pContext;
+
+    pReports->count++;
+    pReports->block = block;
+    pReports->page = page;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Update a struct a few bytes at a time and check only the changed runs
+    are written, nearby ones joined, until the value is split in too many pieces,
+    and that a transaction writes all of it.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testUpdate(void)
+{
+    emueeprom_stats_t startStats, stats;
+    uint8_t data[64];
+    uint8_t readBack[sizeof(data)];
+    int result = 0;
+
+    for(uint16_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i;
+    }
+
+    // starting on an empty page buffer the value is stored in 3 pieces
+    emuEepromErase(1890u, sizeof(data));
+    emuEepromFlush();
+    emuEepromStats(&startStats);
+    if((emuEepromUpdate(1890u, data, sizeof(data)) != sizeof(data)) || (emuEepromUpdate(1890u, data, sizeof(data)) != 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    // 10 and 12 are one run, 20 another, 40 would leave the value in more than 8 pieces
+    data[10] ^= 0xFF;
+    data[12] ^= 0xFF;
+    ssize_t joined = emuEepromUpdate(1890u, data, sizeof(data));
+    data[20] ^= 0xFF;
+    ssize_t single = emuEepromUpdate(1890u, data, sizeof(data));
+    data[40] ^= 0xFF;
+    ssize_t whole = emuEepromUpdate(1890u, data, sizeof(data));
+    emuEepromStats(&stats);
+    uint64_t entry = INFO_SIZE + sizeof(data);
+    uint64_t saved = entry + (entry - (INFO_SIZE + 3u)) + (entry - (INFO_SIZE + 1u));
+    if((joined != 3) || (single != 1) || (whole != sizeof(data)) || (stats.updates != (startStats.updates + 5u)) || 
+        ((stats.updateBytesSaved - startStats.updateBytesSaved) != saved) || 
+        (emuEepromRead(1890u, readBack, sizeof(readBack)) != sizeof(readBack)) || memcmp(readBack, data, sizeof(data)))
+    {
+        result = TEST_ERROR;
+    }
+
+    data[0] ^= 0xFF;
+    if((emuEepromTxBegin() < 0) || (emuEepromUpdate(1890u, data, sizeof(data)) != sizeof(data)) || (emuEepromTxCommit() < 0) ||
+        (emuEepromRead(1890u, readBack, sizeof(readBack)) != sizeof(readBack)) || memcmp(readBack, data, sizeof(data)))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromErase(1890u, sizeof(data));
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Count from threads racing on one counter, check an increment logs a single
+    byte, and swap only from the expected value.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testAtomic(void)
+{
+    emueeprom_stats_t startStats, stats;
+    pthread_t adders[TEST_ADDERS];
+    uint32_t value = 0;
+    int result = 0;
+
+    // an unwritten counter starts at 0, in one entry on an empty page buffer
+    emuEepromErase(1960u, 12u);
+    emuEepromFlush();
+    if((emuEepromAdd(1960u, 1, &value) != sizeof(value)) || (value != 1u) || 
+        (emuEepromAdd(1960u, 1, &value) != 1) || (value != 2u) || (emuEepromAdd(1960u, 254, &value) != 2) || (value != 256u) ||
+        (emuEepromAdd(1960u, -257, &value) < 0) || (value != UINT32_MAX))
+    {
+        result = TEST_ERROR;
+    }
+
+    for(uint16_t i = 0; i < TEST_ADDERS; i++)
+    {
+        if(pthread_create(&adders[i], NULL, _testAdder, NULL) != 0)
+        {
+            return TEST_ERROR;
+        }
+    }
+
+    for(uint16_t i = 0; i < TEST_ADDERS; i++)
+    {
+        pthread_join(adders[i], NULL);
+    }
+
+    emuEepromFlush();
+    value = 0;
+    if((emuEepromRead(1964u, &value, sizeof(value)) != sizeof(value)) || (value != (TEST_ADDERS * TEST_ADDS)))
+    {
+        result = TEST_ERROR;
+    }
+
+    uint32_t expected = 0x11223344u;
+    uint32_t desired = 0x55667788u;
+    emuEepromStats(&startStats);
+    if((emuEepromCas(1968u, &expected, &desired, sizeof(expected)) != 0) || 
+        (emuEepromWrite(1968u, &expected, sizeof(expected)) != sizeof(expected)) ||
+        (emuEepromCas(1968u, &desired, &expected, sizeof(expected)) != 0) ||
+        (emuEepromCas(1968u, &expected, &desired, sizeof(expected)) != 1) ||
+        (emuEepromRead(1968u, &value, sizeof(value)) != sizeof(value)) || (value != desired))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&stats);
+    if((stats.casFailed - startStats.casFailed) != 2u)
+    {
+        result = TEST_ERROR;
+    }
+
+    // staged writes are not visible to the lookup
+    if(emuEepromTxBegin() >= 0)
+    {
+        if((emuEepromAdd(1960u, 1, NULL) >= 0) || (emuEepromCas(1968u, &desired, &expected, sizeof(expected)) >= 0))
+        {
+            result = TEST_ERROR;
+        }
+
+        emuEepromTxAbort();
+    }
+
+    emuEepromErase(1960u, 12u);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Thread counting up the counter at 1964.
+*///-----------------------------------------------------------------------------
+void *_testAdder(void *pArg)
+{
+    for(uint32_t i = 0; i < TEST_ADDS; i++)
+    {
+        emuEepromAdd(1964u, 1, NULL);
+    }
+
+    return pArg;
+}
+
+
+#ifdef EMUEEPROM_METRICS
+/*!------------------------------------------------------------------------------
+    @brief Count calls in the histograms and trace hook through a transfer.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testLatency(void)
+{
+    uint32_t traced[op_total][2] = {{0}};
+    emueeprom_latency_t latency[op_total];
+    emueeprom_info_t info;
+    uint8_t value = 0x5A;
+    int result = 0;
+
+    emuEepromLatencyReset();
+    emuEepromTrace(_testTrace, traced);
+    emuEepromInfo(&info);
+    uint8_t lastBlock = info.currBlock;
+    uint32_t writes = 0;
+    for(; info.currBlock == lastBlock; writes++)
+    {
+        emuEepromWrite(1750u, &writes, sizeof(writes));
+        emuEepromInfo(&info);
+    }
+
+    emuEepromRead(1750u, &value, sizeof(value));
+    emuEepromErase(1760u, 1u);
+    emuEepromFlush();
+    emuEepromTrace(NULL, NULL);
+
+    uint32_t expected[op_total] = {[op_write] = writes, [op_read] = 1u, [op_erase] = 1u, [op_flush] = 1u, [op_transfer] = 1u};
+    for(emueeprom_op_t op = op_write; op < op_total; op++)
+    {
+        emuEepromLatency(op, &latency[op]);
+        uint32_t bucketed = 0;
+        for(uint16_t i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            bucketed += latency[op].buckets[i];
+        }
+
+        if((latency[op].count != expected[op]) || (bucketed != expected[op]) || (traced[op][0] != expected[op]) || 
+            (traced[op][1] != expected[op]) || (emuEepromLatencyQuantile(&latency[op], 999u) > latency[op].maxNs) ||
+            (emuEepromLatencyQuantile(&latency[op], 500u) > emuEepromLatencyQuantile(&latency[op], 999u)))
+        {
+            result = TEST_ERROR;
+        }
+    }
+
+    // the write that filled the block waited for the transfer
+    if(latency[op_write].maxNs < latency[op_transfer].maxNs)
+    {
+        result = TEST_ERROR;
+    }
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Trace hook counting the start and end of each operation.
+*///-----------------------------------------------------------------------------
+void _testTrace(emueeprom_op_t op, int end, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result, void *pContext)
+{
+    uint32_t (*pTraced)[2] = pContext;
+    (void)vAddr;
+    (void)len;
+    (void)pData;
+    (void)result;
+
+    pTraced[op][end ? 1 : 0]++;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Record a few calls, replay them and compare what was read back. Then the
+    same for an update, a compare-and-swap expecting the updated value and an add.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testTraceReplay(void)
+{
+    char const *pPath = "trace_test.bin";
+    uint8_t blob[40];
+    uint8_t first[sizeof(blob)];
+    uint8_t second[sizeof(blob)];
+    trace_report_t report;
+    int result = 0;
+
+    for(uint16_t i = 0; i < sizeof(blob); i++)
+    {
+        blob[i] = i * 7u;
+    }
+
+    if(traceRecordStart(pPath) < 0)
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromWrite(1780u, blob, sizeof(blob));
+    emuEepromWrite(1785u, blob, 3u);
+    emuEepromErase(1790u, 2u);
+    emuEepromRead(1780u, first, sizeof(first));
+    emuEepromFlush();
+    traceRecordStop();
+
+    // the same calls again, replayed writes carry their own data
+    emuEepromErase(1780u, sizeof(blob));
+    if((traceReplay(pPath, 0, &report) != 5) || (report.errors != 0u) || (report.calls[op_write] != 2u) || 
+        (report.calls[op_read] != 1u) || (report.calls[op_erase] != 1u) || (report.calls[op_flush] != 1u) || 
+        (report.userBytes != (sizeof(blob) + 3u + 2u)))
+    {
+        result = TEST_ERROR;
+    }
+
+    // written and erased bytes line up with the recorded ones
+    memset(second, 0, sizeof(second));
+    if((emuEepromRead(1780u, second, sizeof(second)) != (sizeof(second) - 2u)) || 
+        (emuEepromRead(1790u, second, 2u) != 0))
+    {
+        result = TEST_ERROR;
+    }
+
+    emueeprom_stats_t stats;
+    uint32_t counter = 0;
+    emuEepromErase(1824u, 8u);
+    if(traceRecordStart(pPath) < 0)
+    {
+        return TEST_ERROR;
+    }
+
+    emuEepromUpdate(1824u, blob, 4u);
+    emuEepromCas(1824u, blob, &blob[4], 4u);
+    emuEepromAdd(1828u, 3, NULL);
+    traceRecordStop();
+
+    // the replayed compare-and-swap expects the data the replayed update wrote
+    emuEepromErase(1824u, 8u);
+    if((traceReplay(pPath, 0, &report) != 3) || (report.errors != 0u) || (report.calls[op_update] != 1u) || 
+        (report.calls[op_cas] != 1u) || (report.calls[op_add] != 1u))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromStats(&stats);
+    if((stats.casFailed != 0u) || (emuEepromRead(1828u, &counter, sizeof(counter)) != sizeof(counter)) || (counter != 3u))
+    {
+        result = TEST_ERROR;
+    }
+
+    emuEepromErase(1824u, 8u);
+    unlink(pPath);
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Record an import, an aborted and a committed transaction, an async write
+    with a sync and each kind of read, then replay them. Only the committed and the
+    async write may be visible afterwards.
+    @param None
+    @return 0 if successful, -1 for error.
+*///-----------------------------------------------------------------------------
+int _testTraceCalls(void)
+{
+    char const *pPath = "trace_test.bin";
+    static uint8_t image[MAX_VIRTUAL_ADDR];
+    static uint8_t imageValid[MAX_VIRTUAL_ADDR / 8u];
+    static uint8_t all[MAX_VIRTUAL_ADDR];
+    static uint8_t allValid[MAX_VIRTUAL_ADDR / 8u];
+    uint32_t const values[] = {0x11111111u, 0x22222222u, 0x33333333u};
+    uint8_t range[12];
+    uint8_t rangeValid[2];
+    emueeprom_req_t reqs[2] = {{.vAddr = 1844u, .len = 4u, .pBuffer = range, .pValid = NULL},
+        {.vAddr = 1850u, .len = 2u, .pBuffer = &range[4], .pValid = rangeValid}};
+    emueeprom_view_t view;
+    trace_report_t report;
+    int result = 0;
+
+    // the recorded import changes nothing, the replayed one is undone at the end
+    emuEepromErase(1840u, sizeof(range));
+    if((emuEepromReadAll(image, imageValid) < 0) || (emuEepromAsyncStart() < 0))
+    {
+        return TEST_ERROR;
+    }
+
+    if(traceRecordStart(pPath) < 0)
+    {
+        emuEepromAsyncStop();
+        return TEST_ERROR;
+    }
+
+    emuEepromImport(image, imageValid);
+    emuEepromTxBegin();
+    emuEepromWrite(1840u, &values[0], sizeof(values[0]));
+    emuEepromTxAbort();
+    emuEepromTxBegin();
+    emuEepromWrite(1844u, &values[1], sizeof(values[1]));
+    emuEepromTxCommit();
+    emuEepromWriteAsync(1848u, &values[2], sizeof(values[2]), NULL, NULL);
+    emuEepromSync();
+    emuEepromReadRange(1840u, range, sizeof(range), rangeValid);
+    emuEepromReadAll(all, allValid);
+    emuEepromReadMulti(reqs, 2u);
+    if(emuEepromReadView(1844u, sizeof(values[1]), &view) >= 0)
+    {
+        emuEepromReleaseView(&view);
+    }
+
+    traceRecordStop();
+    emuEepromAsyncStop();
+
+    emuEepromErase(1840u, sizeof(range));
+    if((traceReplay(pPath, 0, &report) != 13) || (report.errors != 0u) || (report.calls[op_import] != 1u) || 
+        (report.calls[op_tx_begin] != 2u) || (report.calls[op_tx_abort] != 1u) || (report.calls[op_tx_commit] != 1u) || 
+        (report.calls[op_write] != 2u) || (report.calls[op_write_async] != 1u) || (report.calls[op_sync] != 1u) || 
+        (report.calls[op_read_range] != 1u) || (report.calls[op_read_all] != 1u) || (report.calls[op_read_multi] != 1u) || 
+        (report.calls[op_read_view] != 1u))
+    {
+        result = TEST_ERROR;
+    }
+
+    // the aborted write stays invisible, the committed and the async one are there
+    uint32_t value = 0;
+    if((emuEepromRead(1840u, &value, sizeof(value)) != 0) || (emuEepromRead(1844u, &value, sizeof(value)) != sizeof(value)) || 
+        (emuEepromRead(1848u, &value, sizeof(value)) != sizeof(value)))
+    {
+        result = TEST_ERROR;
+    }
+
+    if(emuEepromImport(image, imageValid) < 0)
+    {
+        result = TEST_ERROR;
+    }
+
+    unlink(pPath);
+
+    return result;
+}
+#endif
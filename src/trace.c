@@ -0,0 +1,544 @@
+/*
+* trace.c
+*
+* Notes:
+* - Records every public call that reads or changes the contents, using the emuEepromTrace hook.
+* - A trace is a trace_header_t followed by one trace_record_t per call, in the order the calls started. A
+*   multi read record is followed by a trace_span_t per request, an import record by its validity bitmap.
+* - Replayed writes carry data made from the recorded hash, so the same value gives the same data. A
+*   compare-and-swap expecting a value written earlier in the trace finds it again.
+* - Transactions are replayed as recorded, so an aborted one is never visible. A transaction still open at
+*   the end of the trace is aborted.
+* - Async writes are queued on a worker started for them and stopped once the trace ends. Views are
+*   released as soon as they are read.
+*
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <emueeprom.h>
+#include <trace.h>
+
+#ifdef EMUEEPROM_METRICS
+
+#define FNV_OFFSET 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+void _traceHook(emueeprom_op_t op, int end, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result, void *pContext);
+void _traceWritePayload(emueeprom_op_t op, void const *pData);
+bool _traceValid(trace_record_t const *pRecord);
+int _traceReadSpans(FILE *pFile, emueeprom_req_t *pReqs, uint32_t numReqs, uint8_t *pData, uint8_t *pValid);
+uint32_t _traceHash(void const *pData, uint16_t len);
+void _traceFill(uint8_t *pData, uint16_t len, uint32_t hash);
+uint64_t _traceNowUs(void);
+
+static FILE *m_pFile = NULL;
+static uint64_t m_lastUs;
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!------------------------------------------------------------------------------
+    @brief Start recording calls to a trace file, replacing it.
+    @param *pPath - The trace file.
+    @return 0 if successful or -1 if an error occured.
+*///-----------------------------------------------------------------------------
+int traceRecordStart(char const *pPath)
+{
+    trace_header_t header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION, .recordSize = sizeof(trace_record_t)};
+
+    if(m_pFile != NULL)
+    {
+        return -1;
+    }
+
+    FILE *pFile = fopen(pPath, "wb");
+    if(pFile == NULL)
+    {
+        return -1;
+    }
+
+    if(fwrite(&header, sizeof(header), 1, pFile) != 1)
+    {
+        fclose(pFile);
+        return -1;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_pFile = pFile;
+    m_lastUs = _traceNowUs();
+    pthread_mutex_unlock(&m_lock);
+    emuEepromTrace(_traceHook, NULL);
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Stop recording and close the trace file.
+    @param None
+    @return None
+*///-----------------------------------------------------------------------------
+void traceRecordStop(void)
+{
+    emuEepromTrace(NULL, NULL);
+
+    pthread_mutex_lock(&m_lock);
+    if(m_pFile != NULL)
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Run a trace against the emulated EEPROM, on top of what it holds. Stats and
+    latency histograms are reset first.
+    @param *pPath - The trace file.
+    @param paced - Non-zero to wait out the recorded time between calls.
+    @param *pReport - Filled with what the replay did.
+    @return Amount of calls replayed or -1 if the trace could not be read.
+*///-----------------------------------------------------------------------------
+int traceReplay(char const *pPath, int paced, trace_report_t *pReport)
+{
+    static uint8_t data[MAX_VIRTUAL_ADDR];
+    static uint8_t expected[MAX_VIRTUAL_ADDR];
+    static uint8_t valid[TRACE_VALID_SIZE];
+    trace_header_t header;
+    trace_record_t record;
+    emueeprom_stats_t stats;
+    bool async = false;
+    bool txOpen = false;
+    int result = 0;
+
+    FILE *pFile = fopen(pPath, "rb");
+    if(pFile == NULL)
+    {
+        return -1;
+    }
+
+    if((fread(&header, sizeof(header), 1, pFile) != 1) || (header.magic != TRACE_MAGIC) ||
+        (header.version != TRACE_VERSION) || (header.recordSize != sizeof(trace_record_t)))
+    {
+        fclose(pFile);
+        return -1;
+    }
+
+    memset(pReport, 0, sizeof(*pReport));
+    emuEepromStatsReset();
+    emuEepromLatencyReset();
+
+    uint64_t startUs = _traceNowUs();
+    uint64_t dueUs = 0;
+    while(fread(&record, sizeof(record), 1, pFile) == 1)
+    {
+        emueeprom_req_t *pReqs = NULL;
+        if(!_traceValid(&record))
+        {
+            result = -1;
+            break;
+        }
+
+        // the payload is read before the call is due
+        if(record.op == op_read_multi)
+        {
+            pReqs = calloc(record.hash ? record.hash : 1u, sizeof(emueeprom_req_t));
+            if((pReqs == NULL) || (_traceReadSpans(pFile, pReqs, record.hash, data, valid) < 0))
+            {
+                free(pReqs);
+                result = -1;
+                break;
+            }
+        }
+        else if((record.op == op_import) && (fread(valid, sizeof(valid), 1, pFile) != 1))
+        {
+            result = -1;
+            break;
+        }
+
+        dueUs += record.deltaUs;
+        uint64_t nowUs = _traceNowUs() - startUs;
+        if(paced && (dueUs > nowUs))
+        {
+            usleep(dueUs - nowUs);
+        }
+
+        ssize_t count = 0;
+        switch(record.op)
+        {
+            case op_write:
+                _traceFill(data, record.len, record.hash);
+                count = emuEepromWrite(record.vAddr, data, record.len);
+                break;
+            case op_read:
+                count = emuEepromRead(record.vAddr, data, record.len);
+                break;
+            case op_erase:
+                count = emuEepromErase(record.vAddr, record.len);
+                break;
+            case op_update:
+                _traceFill(data, record.len, record.hash);
+                count = emuEepromUpdate(record.vAddr, data, record.len);
+                break;
+            case op_cas:
+                _traceFill(expected, record.len, record.expectHash);
+                _traceFill(data, record.len, record.hash);
+                count = emuEepromCas(record.vAddr, expected, data, record.len);
+                break;
+            case op_add:
+                count = emuEepromAdd(record.vAddr, (int32_t)record.hash, NULL);
+                break;
+            case op_tx_begin:
+                count = emuEepromTxBegin();
+                txOpen = (txOpen || (count >= 0));
+                break;
+            case op_tx_commit:
+                count = emuEepromTxCommit();
+                txOpen = false;
+                break;
+            case op_tx_abort:
+                emuEepromTxAbort();
+                txOpen = false;
+                break;
+            case op_write_async:
+                if(!async && (emuEepromAsyncStart() >= 0))
+                {
+                    async = true;
+                }
+
+                _traceFill(data, record.len, record.hash);
+                count = emuEepromWriteAsync(record.vAddr, data, record.len, NULL, NULL);
+                break;
+            case op_sync:
+                count = emuEepromSync();
+                break;
+            case op_read_range:
+                count = emuEepromReadRange(record.vAddr, data, record.len, valid);
+                break;
+            case op_read_all:
+                count = emuEepromReadAll(data, valid);
+                break;
+            case op_read_multi:
+                count = emuEepromReadMulti(pReqs, record.hash);
+                free(pReqs);
+                break;
+            case op_read_view:
+            {
+                emueeprom_view_t view;
+                count = emuEepromReadView(record.vAddr, record.len, &view);
+                if(count >= 0)
+                {
+                    emuEepromReleaseView(&view);
+                }
+
+                break;
+            }
+            case op_import:
+                _traceFill(data, MAX_VIRTUAL_ADDR, record.hash);
+                count = emuEepromImport(data, valid);
+                break;
+            default:
+                count = emuEepromFlush();
+                break;
+        }
+
+        if(count < 0)
+        {
+            pReport->errors++;
+        }
+
+        pReport->calls[record.op]++;
+        result++;
+    }
+
+    fclose(pFile);
+    if(txOpen)
+    {
+        emuEepromTxAbort();
+    }
+
+    if(async)
+    {
+        emuEepromAsyncStop();
+    }
+
+    pReport->elapsedUs = _traceNowUs() - startUs;
+    emuEepromStats(&stats);
+    pReport->userBytes = stats.userBytes;
+    pReport->copyBytes = stats.copyBytes;
+    pReport->flashBytes = (uint64_t)stats.pagesProgrammed * PAGE_SIZE;
+    for(emueeprom_op_t op = op_write; op < op_total; op++)
+    {
+        emuEepromLatency(op, &pReport->latency[op]);
+    }
+
+    pReport->calls[op_transfer] = pReport->latency[op_transfer].count;
+
+    return result;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Print a replay report.
+    @param *pReport - Report from traceReplay.
+    @return None
+*///-----------------------------------------------------------------------------
+void traceReportPrint(trace_report_t const *pReport)
+{
+    char const *pNames[op_total] = {"write", "read", "erase", "flush", "update", "cas", "add", "tx begin", "tx commit",
+        "tx abort", "async", "sync", "range", "read all", "multi", "view", "import", "transfer"};
+    uint32_t calls = 0;
+
+    for(emueeprom_op_t op = op_write; op < op_transfer; op++)
+    {
+        calls += pReport->calls[op];
+    }
+
+    printf("Replayed %u calls in %.1f ms, %.0f calls/s, %u errors.\n", calls, pReport->elapsedUs / 1000.0,
+        pReport->elapsedUs ? ((calls * 1000000.0) / pReport->elapsedUs) : 0.0, pReport->errors);
+    printf("User bytes: %llu, copied: %llu, programmed: %llu, write amplification: %.2f\n",
+        (unsigned long long)pReport->userBytes, (unsigned long long)pReport->copyBytes,
+        (unsigned long long)pReport->flashBytes, pReport->userBytes ? ((double)pReport->flashBytes / pReport->userBytes) : 0.0);
+    printf("%10s %10s %10s %10s %10s %10s\n", "op", "calls", "p50 us", "p99 us", "p999 us", "max us");
+    for(emueeprom_op_t op = op_write; op < op_total; op++)
+    {
+        emueeprom_latency_t const *pLatency = &pReport->latency[op];
+        printf("%10s %10u %10.2f %10.2f %10.2f %10.2f\n", pNames[op], pReport->calls[op],
+            emuEepromLatencyQuantile(pLatency, 500u) / 1000.0, emuEepromLatencyQuantile(pLatency, 990u) / 1000.0,
+            emuEepromLatencyQuantile(pLatency, 999u) / 1000.0, pLatency->maxNs / 1000.0);
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Trace hook, appends a record when a call starts.
+*///-----------------------------------------------------------------------------
+void _traceHook(emueeprom_op_t op, int end, uint16_t vAddr, uint16_t len, void const *pData, ssize_t result, void *pContext)
+{
+    trace_record_t record = {0};
+    (void)result;
+    (void)pContext;
+
+    // transfers are caused by the calls, a replay makes its own
+    if(end || (op == op_transfer))
+    {
+        return;
+    }
+
+    record.op = op;
+    record.vAddr = vAddr;
+    record.len = len;
+    if(op == op_cas)
+    {
+        void const * const *pValues = pData;
+        record.expectHash = _traceHash(pValues[0], len);
+        record.hash = _traceHash(pValues[1], len);
+    }
+    else if(op == op_add)
+    {
+        int32_t delta;
+        memcpy(&delta, pData, sizeof(delta));
+        record.hash = (uint32_t)delta;
+    }
+    else if(op == op_read_multi)
+    {
+        void const * const *pValues = pData;
+        size_t numReqs = *(size_t const *)pValues[1];
+        record.hash = (numReqs > UINT32_MAX) ? UINT32_MAX : (uint32_t)numReqs;
+    }
+    else if(op == op_import)
+    {
+        void const * const *pValues = pData;
+        record.hash = _traceHash(pValues[0], MAX_VIRTUAL_ADDR);
+    }
+    else
+    {
+        record.hash = (pData != NULL) ? _traceHash(pData, len) : 0u;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    if(m_pFile != NULL)
+    {
+        uint64_t nowUs = _traceNowUs();
+        record.deltaUs = ((nowUs - m_lastUs) > UINT32_MAX) ? UINT32_MAX : (uint32_t)(nowUs - m_lastUs);
+        m_lastUs = nowUs;
+        if(fwrite(&record, sizeof(record), 1, m_pFile) != 1)
+        {
+            printf("Error writing trace.\n");
+        }
+
+        _traceWritePayload(op, pData);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Append what follows the record of a multi read or an import. m_lock must
+    be held.
+    @param op - The operation.
+    @param *pData - What the trace hook got for it.
+    @return None
+*///-----------------------------------------------------------------------------
+void _traceWritePayload(emueeprom_op_t op, void const *pData)
+{
+    void const * const *pValues = pData;
+    bool written = true;
+
+    if(op == op_read_multi)
+    {
+        emueeprom_req_t const *pReqs = pValues[0];
+        size_t numReqs = *(size_t const *)pValues[1];
+        for(uint32_t i = 0; (i < numReqs) && (i < UINT32_MAX) && written; i++)
+        {
+            trace_span_t span = {.vAddr = pReqs[i].vAddr, .len = pReqs[i].len};
+            if(pReqs[i].pValid != NULL)
+            {
+                span.len |= TRACE_SPAN_VALID;
+            }
+
+            written = (fwrite(&span, sizeof(span), 1, m_pFile) == 1);
+        }
+    }
+    else if(op == op_import)
+    {
+        written = (fwrite(pValues[1], TRACE_VALID_SIZE, 1, m_pFile) == 1);
+    }
+
+    if(!written)
+    {
+        printf("Error writing trace.\n");
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Check a record can be replayed.
+    @param *pRecord - The record.
+    @return True if its operation is known and its range fits.
+*///-----------------------------------------------------------------------------
+bool _traceValid(trace_record_t const *pRecord)
+{
+    bool sized = true;
+
+    switch(pRecord->op)
+    {
+        case op_flush:
+        case op_erase:
+        case op_tx_begin:
+        case op_tx_commit:
+        case op_tx_abort:
+        case op_sync:
+        case op_read_multi:
+        case op_import:
+            sized = false;
+            break;
+        default:
+            break;
+    }
+
+    return ((pRecord->op < op_transfer) && (!sized || (pRecord->len > 0u)) && 
+        ((pRecord->vAddr + pRecord->len) <= MAX_VIRTUAL_ADDR) && 
+        ((pRecord->op != op_add) || (pRecord->len == sizeof(uint32_t))));
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Read the requests of a multi read. Each one reads into the image, at its
+    own address, and into the shared bitmap if it had one.
+    @param *pFile - The trace, just past the record.
+    @param *pReqs - Filled with numReqs requests.
+    @param numReqs - Amount of requests recorded.
+    @param *pData - Image of MAX_VIRTUAL_ADDR bytes.
+    @param *pValid - Bitmap of TRACE_VALID_SIZE bytes.
+    @return 0 if successful or -1 if the trace is cut short or a request does not fit.
+*///-----------------------------------------------------------------------------
+int _traceReadSpans(FILE *pFile, emueeprom_req_t *pReqs, uint32_t numReqs, uint8_t *pData, uint8_t *pValid)
+{
+    for(uint32_t i = 0; i < numReqs; i++)
+    {
+        trace_span_t span;
+        if(fread(&span, sizeof(span), 1, pFile) != 1)
+        {
+            return -1;
+        }
+
+        pReqs[i].vAddr = span.vAddr;
+        pReqs[i].len = span.len & ~TRACE_SPAN_VALID;
+        pReqs[i].pBuffer = &pData[span.vAddr];
+        pReqs[i].pValid = (span.len & TRACE_SPAN_VALID) ? pValid : NULL;
+        if((pReqs[i].len == 0u) || ((pReqs[i].vAddr + pReqs[i].len) > MAX_VIRTUAL_ADDR))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief FNV-1a hash of written data.
+    @param *pData - The data.
+    @param len - Amount of bytes.
+    @return The hash.
+*///-----------------------------------------------------------------------------
+uint32_t _traceHash(void const *pData, uint16_t len)
+{
+    uint8_t const *pBytes = pData;
+    uint32_t hash = FNV_OFFSET;
+
+    for(uint16_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ pBytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Make data for a replayed write from its recorded hash.
+    @param *pData - Where to put the data.
+    @param len - Amount of bytes.
+    @param hash - Recorded hash.
+    @return None
+*///-----------------------------------------------------------------------------
+void _traceFill(uint8_t *pData, uint16_t len, uint32_t hash)
+{
+    uint32_t state = hash | 1u;
+
+    // xorshift, never reaches 0
+    for(uint16_t i = 0; i < len; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        pData[i] = (uint8_t)state;
+    }
+}
+
+
+/*!------------------------------------------------------------------------------
+    @brief Monotonic time in microseconds.
+    @param None
+    @return Current time.
+*///-----------------------------------------------------------------------------
+uint64_t _traceNowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000u) + ((uint64_t)now.tv_nsec / 1000u);
+}
+
+#endif